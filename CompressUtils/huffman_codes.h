@@ -0,0 +1,164 @@
+#ifndef __HUFFMAN_CODES_H__
+#define __HUFFMAN_CODES_H__
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <queue>
+#include <algorithm>
+
+// canonical huffman helpers shared by the native xph and lzx codecs.
+//
+// codes are canonical: shorter codes first, within one length ordered by symbol value.
+// this is the ordering used by both MS-XCA LZ77+Huffman and LZX.
+
+// calculate codelengths from symbol frequencies, limiting the length to 'maxbits'.
+// when only one symbol is used, a second dummy symbol is added, so the tree is always complete.
+inline void huff_buildlengths(const uint32_t *freq, int n, int maxbits, uint8_t *lens)
+{
+    std::vector<uint32_t> f(freq, freq+n);
+    memset(lens, 0, n);
+
+    int nused= 0;
+    for (int i=0 ; i<n ; i++)
+        if (f[i]) nused++;
+    if (nused==0)
+        return;
+    if (nused==1) {
+        for (int i=0 ; i<n ; i++)
+            if (f[i]) {
+                lens[i]= 1;
+                lens[i==0 ? 1 : 0]= 1;
+                break;
+            }
+        return;
+    }
+
+    while (true) {
+        // nodes [0,n) are leaves, the rest are internal nodes
+        std::vector<int> parent(2*n, -1);
+        typedef std::pair<uint64_t,int> item;
+        std::priority_queue<item, std::vector<item>, std::greater<item> > q;
+        for (int i=0 ; i<n ; i++)
+            if (f[i])
+                q.push(item(f[i], i));
+        int next= n;
+        while (q.size()>1) {
+            item a= q.top(); q.pop();
+            item b= q.top(); q.pop();
+            parent[a.second]= next;
+            parent[b.second]= next;
+            q.push(item(a.first+b.first, next));
+            next++;
+        }
+        // internal nodes are created in increasing order, so depths can be found top down.
+        std::vector<int> depth(next, 0);
+        for (int i=next-2 ; i>=n ; i--)
+            depth[i]= depth[parent[i]]+1;
+        int maxlen= 0;
+        for (int i=0 ; i<n ; i++)
+            if (f[i]) {
+                depth[i]= depth[parent[i]]+1;
+                maxlen= std::max(maxlen, depth[i]);
+            }
+        if (maxlen<=maxbits) {
+            for (int i=0 ; i<n ; i++)
+                lens[i]= f[i] ? depth[i] : 0;
+            return;
+        }
+        // flatten the distribution, and try again
+        for (int i=0 ; i<n ; i++)
+            if (f[i])
+                f[i]= (f[i]>>1)|1;
+    }
+}
+
+// assign canonical codes for the given lengths
+inline void huff_makecodes(const uint8_t *lens, int n, uint16_t *codes)
+{
+    uint16_t count[17]= {0};
+    uint16_t nextcode[17]= {0};
+    for (int i=0 ; i<n ; i++)
+        count[lens[i]]++;
+    count[0]= 0;
+    uint16_t code= 0;
+    for (int bits=1 ; bits<=16 ; bits++) {
+        code= (code + count[bits-1])<<1;
+        nextcode[bits]= code;
+    }
+    for (int i=0 ; i<n ; i++)
+        codes[i]= lens[i] ? nextcode[lens[i]]++ : 0;
+}
+
+// table driven decoder for canonical codes of at most 16 bits.
+// codes up to FASTBITS are resolved with a single lookup, longer codes walk the canonical counts.
+class huffdecoder {
+    enum { FASTBITS= 10 };
+    // (symbol<<5) | length,  0 for codes longer than FASTBITS
+    uint16_t _fast[1<<FASTBITS];
+    uint16_t _count[17];
+    std::vector<uint16_t> _symbols;
+public:
+    // returns false for an oversubscribed set of lengths
+    bool build(const uint8_t *lens, int n)
+    {
+        memset(_count, 0, sizeof(_count));
+        for (int i=0 ; i<n ; i++)
+            _count[lens[i]]++;
+        _count[0]= 0;
+
+        int left= 1;
+        for (int bits=1 ; bits<=16 ; bits++) {
+            left <<= 1;
+            left -= _count[bits];
+            if (left<0)
+                return false;
+        }
+
+        uint16_t offs[17];
+        offs[1]= 0;
+        for (int bits=1 ; bits<16 ; bits++)
+            offs[bits+1]= offs[bits] + _count[bits];
+        _symbols.resize(n);
+        for (int i=0 ; i<n ; i++)
+            if (lens[i])
+                _symbols[offs[lens[i]]++]= i;
+
+        memset(_fast, 0, sizeof(_fast));
+        std::vector<uint16_t> codes(n);
+        huff_makecodes(lens, n, &codes[0]);
+        for (int i=0 ; i<n ; i++) {
+            if (lens[i]==0 || lens[i]>FASTBITS)
+                continue;
+            int shift= FASTBITS-lens[i];
+            uint32_t first= uint32_t(codes[i])<<shift;
+            for (uint32_t j=0 ; j<(1U<<shift) ; j++)
+                _fast[first+j]= (i<<5)|lens[i];
+        }
+        return true;
+    }
+
+    // 'bits' holds the next 16 bits of the stream, msb first.
+    // returns the symbol, and its length in 'len', or -1 for an invalid code.
+    int decode(uint32_t bits, int &len) const
+    {
+        uint16_t e= _fast[(bits>>(16-FASTBITS)) & ((1<<FASTBITS)-1)];
+        if (e) {
+            len= e&31;
+            return e>>5;
+        }
+        int code= 0, first= 0, index= 0;
+        for (len=1 ; len<=16 ; len++) {
+            code |= (bits>>(16-len))&1;
+            int count= _count[len];
+            if (code - first < count)
+                return _symbols[index + code - first];
+            index += count;
+            first += count;
+            first <<= 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+#endif
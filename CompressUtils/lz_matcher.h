@@ -0,0 +1,68 @@
+#ifndef __LZ_MATCHER_H__
+#define __LZ_MATCHER_H__
+#include <stdint.h>
+#include <vector>
+
+// hash chain match finder, used by the native xpr, xph and lzx encoders.
+//
+// usage: for each position call 'find', then 'insert' the position,
+// and when a match was taken, also insert all positions covered by the match.
+class lzmatcher {
+    enum { HASHBITS= 14 };
+    const uint8_t *_data;
+    uint32_t _size;
+    uint32_t _window;
+    int _maxchain;
+
+    std::vector<int32_t> _head;
+    std::vector<int32_t> _prev;
+
+    uint32_t hash(uint32_t pos) const
+    {
+        uint32_t v= _data[pos] | (_data[pos+1]<<8) | (_data[pos+2]<<16);
+        return (v*2654435761U)>>(32-HASHBITS);
+    }
+public:
+    lzmatcher(const uint8_t *data, uint32_t size, uint32_t window, int maxchain= 32)
+        : _data(data), _size(size), _window(window), _maxchain(maxchain),
+          _head(1<<HASHBITS, -1), _prev(size, -1)
+    {
+    }
+    void insert(uint32_t pos)
+    {
+        if (pos+3 > _size)
+            return;
+        uint32_t h= hash(pos);
+        _prev[pos]= _head[h];
+        _head[h]= pos;
+    }
+    // returns the length of the longest match at 'pos', or 0 when shorter than 'minlen'
+    uint32_t find(uint32_t pos, uint32_t minlen, uint32_t maxlen, uint32_t &offset) const
+    {
+        if (pos+3 > _size || maxlen<minlen)
+            return 0;
+        if (maxlen > _size-pos)
+            maxlen= _size-pos;
+
+        uint32_t best= 0;
+        int chain= _maxchain;
+        for (int32_t cand= _head[hash(pos)] ; cand>=0 && chain-- ; cand= _prev[cand]) {
+            if (pos-cand > _window)
+                break;
+            if (_data[cand+best]!=_data[pos+best])
+                continue;
+            uint32_t len= 0;
+            while (len<maxlen && _data[cand+len]==_data[pos+len])
+                len++;
+            if (len>best) {
+                best= len;
+                offset= pos-cand;
+                if (len==maxlen)
+                    break;
+            }
+        }
+        return best>=minlen ? best : 0;
+    }
+};
+
+#endif
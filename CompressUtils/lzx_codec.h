@@ -0,0 +1,576 @@
+#ifndef __LZX_CODEC_H__
+#define __LZX_CODEC_H__
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "huffman_codes.h"
+#include "lz_matcher.h"
+
+// native implementation of the LZX format, as produced by cecompr_nt.dll.
+//
+// this is the same bitstream as used in .cab files:
+//   16 bit little endian words, read msb first.
+//   output is split in 32k frames, the bitstream is realigned at the end of each frame.
+//   verbatim, aligned and uncompressed blocks, huffman trees are delta coded through a pretree.
+//
+// the dll precedes the bitstream with an 8 byte header:
+//   uint32_t streamsize;   // size of the bitstream following the header
+//   uint32_t fullsize;     // size of the uncompressed data
+// empty input compresses to nothing, without a header.
+//
+// the window size matches the 0x10000 passed to LZX_CompressOpen by lzxxpr_convert.
+// the encoder only produces verbatim blocks, one per frame, without e8 translation.
+//
+// both functions return the resulting size, or 0xFFFFFFFF on error.
+
+enum {
+    LZX_WINDOWBITS= 16,
+    LZX_FRAMESIZE= 0x8000,
+    LZX_MINMATCH= 2,
+    LZX_MAXMATCH= 257,
+    LZX_NUMCHARS= 256,
+    LZX_PRETREE_NSYMBOLS= 20,
+    LZX_ALIGNED_NSYMBOLS= 8,
+    LZX_LENGTH_NSYMBOLS= 249,
+    LZX_NUMPOSITIONSLOTS= 32,   // for a 2^16 window
+    LZX_MAINTREE_NSYMBOLS= LZX_NUMCHARS + LZX_NUMPOSITIONSLOTS*8,
+
+    LZX_BLOCKTYPE_VERBATIM= 1,
+    LZX_BLOCKTYPE_ALIGNED= 2,
+    LZX_BLOCKTYPE_UNCOMPRESSED= 3,
+};
+
+struct lzx_positiontables {
+    uint8_t extrabits[LZX_NUMPOSITIONSLOTS];
+    uint32_t positionbase[LZX_NUMPOSITIONSLOTS+1];
+    lzx_positiontables()
+    {
+        for (int i=0, j=0 ; i<LZX_NUMPOSITIONSLOTS ; i+=2) {
+            extrabits[i]= extrabits[i+1]= j;
+            if (i!=0 && j<17)
+                j++;
+        }
+        positionbase[0]= 0;
+        for (int i=0 ; i<LZX_NUMPOSITIONSLOTS ; i++)
+            positionbase[i+1]= positionbase[i] + (1<<extrabits[i]);
+    }
+    int slot(uint32_t formattedoffset) const
+    {
+        int i= std::upper_bound(positionbase, positionbase+LZX_NUMPOSITIONSLOTS, formattedoffset) - positionbase;
+        return i-1;
+    }
+};
+inline const lzx_positiontables& lzx_tables()
+{
+    static lzx_positiontables t;
+    return t;
+}
+
+class lzx_bitreader {
+    const uint8_t *_p;
+    const uint8_t *_end;
+    uint32_t _buf;
+    int _bits;
+    int _padbits;    // bits in _buf which were read past the end
+public:
+    lzx_bitreader(const uint8_t *p, uint32_t size)
+        : _p(p), _end(p+size), _buf(0), _bits(0), _padbits(0)
+    {
+    }
+    void ensure(int n)
+    {
+        while (_bits < n) {
+            uint32_t w= 0;
+            if (_p+2 <= _end) {
+                w= _p[0] | (_p[1]<<8);
+                _p += 2;
+            }
+            else {
+                // allow readahead past the end, overrun() tells if those bits were used
+                _padbits += 16;
+            }
+            _buf |= w<<(16-_bits);
+            _bits += 16;
+        }
+    }
+    uint32_t peek16()
+    {
+        ensure(16);
+        return _buf>>16;
+    }
+    void remove(int n)
+    {
+        _buf <<= n;
+        _bits -= n;
+    }
+    uint32_t read(int n)
+    {
+        if (n==0)
+            return 0;
+        if (n>16)
+            return (read(n-16)<<16) | read(16);
+        ensure(n);
+        uint32_t v= _buf>>(32-n);
+        remove(n);
+        return v;
+    }
+    int decode(const huffdecoder& table)
+    {
+        int len;
+        int sym= table.decode(peek16(), len);
+        if (sym>=0)
+            remove(len);
+        return sym;
+    }
+    // realign to a 16 bit boundary
+    void align()
+    {
+        remove(_bits&15);
+    }
+    // switch to byte mode for uncompressed blocks, this always skips 1..16 padding bits
+    void startbytes()
+    {
+        ensure(16);
+        if (_bits > 16 && _padbits==0)
+            _p -= 2;
+        _bits= 0;
+        _buf= 0;
+        _padbits= 0;
+    }
+    bool overrun() const { return _padbits > _bits; }
+    const uint8_t *ptr() const { return _p; }
+    void skipbytes(uint32_t n) { _p += n; }
+    uint32_t bytesleft() const { return _p<=_end ? _end-_p : 0; }
+};
+
+// read a set of delta coded codelengths
+inline bool lzx_readlengths(lzx_bitreader& br, uint8_t *lens, int first, int last)
+{
+    uint8_t prelens[LZX_PRETREE_NSYMBOLS];
+    for (int i=0 ; i<LZX_PRETREE_NSYMBOLS ; i++)
+        prelens[i]= br.read(4);
+    huffdecoder pretree;
+    if (!pretree.build(prelens, LZX_PRETREE_NSYMBOLS))
+        return false;
+
+    int x= first;
+    while (x<last) {
+        int z= br.decode(pretree);
+        if (z<0)
+            return false;
+        if (z==17) {
+            int n= br.read(4)+4;
+            if (x+n > last) return false;
+            while (n--) lens[x++]= 0;
+        }
+        else if (z==18) {
+            int n= br.read(5)+20;
+            if (x+n > last) return false;
+            while (n--) lens[x++]= 0;
+        }
+        else if (z==19) {
+            int n= br.read(1)+4;
+            z= br.decode(pretree);
+            if (z<0 || z>16 || x+n > last)
+                return false;
+            int v= (lens[x]+17-z)%17;
+            while (n--) lens[x++]= v;
+        }
+        else {
+            lens[x]= (lens[x]+17-z)%17;
+            x++;
+        }
+    }
+    return true;
+}
+
+inline uint32_t lzx_get32(const uint8_t *p)
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16) | (uint32_t(p[3])<<24);
+}
+inline void lzx_set32(uint8_t *p, uint32_t v)
+{
+    p[0]= v; p[1]= v>>8; p[2]= v>>16; p[3]= v>>24;
+}
+
+inline uint32_t lzx_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (insize==0)
+        return 0;
+    if (insize<8)
+        return 0xFFFFFFFF;
+    uint32_t streamsize= lzx_get32(in);
+    uint32_t fullsize= lzx_get32(in+4);
+    if (streamsize > insize-8 || fullsize > outsize)
+        return 0xFFFFFFFF;
+    in += 8;
+    insize= streamsize;
+    outsize= fullsize;
+
+    const lzx_positiontables& tab= lzx_tables();
+    lzx_bitreader br(in, insize);
+
+    uint8_t mainlens[LZX_MAINTREE_NSYMBOLS]= {0};
+    uint8_t lengthlens[LZX_LENGTH_NSYMBOLS]= {0};
+    uint8_t alignedlens[LZX_ALIGNED_NSYMBOLS]= {0};
+    huffdecoder maintree, lengthtree, alignedtree;
+    bool haslengthtree= false;
+
+    uint32_t R0= 1, R1= 1, R2= 1;
+
+    bool e8translation= br.read(1);
+    uint32_t e8filesize= 0;
+    if (e8translation)
+        e8filesize= br.read(32);
+
+    int blocktype= 0;
+    uint32_t blockremaining= 0;
+    uint32_t outpos= 0;
+
+    while (outpos < outsize) {
+        uint32_t frameend= std::min(outsize, (outpos/LZX_FRAMESIZE+1)*LZX_FRAMESIZE);
+        uint32_t framestart= outpos;
+        while (outpos < frameend) {
+            if (blockremaining==0) {
+                if (blocktype==LZX_BLOCKTYPE_UNCOMPRESSED) {
+                    // uncompressed blocks of odd length are padded to an even size.
+                    // after that the bitstream restarts from the current byte position
+                    if (br.ptr() > in && ((br.ptr()-in)&1))
+                        br.skipbytes(1);
+                    br= lzx_bitreader(br.ptr(), br.bytesleft());
+                }
+                blocktype= br.read(3);
+                blockremaining= br.read(24);
+                if (blockremaining==0)
+                    return 0xFFFFFFFF;
+                switch(blocktype) {
+                case LZX_BLOCKTYPE_ALIGNED:
+                    for (int i=0 ; i<LZX_ALIGNED_NSYMBOLS ; i++)
+                        alignedlens[i]= br.read(3);
+                    if (!alignedtree.build(alignedlens, LZX_ALIGNED_NSYMBOLS))
+                        return 0xFFFFFFFF;
+                    // fall through
+                case LZX_BLOCKTYPE_VERBATIM:
+                    if (!lzx_readlengths(br, mainlens, 0, LZX_NUMCHARS))
+                        return 0xFFFFFFFF;
+                    if (!lzx_readlengths(br, mainlens, LZX_NUMCHARS, LZX_MAINTREE_NSYMBOLS))
+                        return 0xFFFFFFFF;
+                    if (!maintree.build(mainlens, LZX_MAINTREE_NSYMBOLS))
+                        return 0xFFFFFFFF;
+                    if (!lzx_readlengths(br, lengthlens, 0, LZX_LENGTH_NSYMBOLS))
+                        return 0xFFFFFFFF;
+                    haslengthtree= std::find_if(lengthlens, lengthlens+LZX_LENGTH_NSYMBOLS, [](uint8_t l) { return l!=0; }) != lengthlens+LZX_LENGTH_NSYMBOLS;
+                    if (haslengthtree && !lengthtree.build(lengthlens, LZX_LENGTH_NSYMBOLS))
+                        return 0xFFFFFFFF;
+                    break;
+                case LZX_BLOCKTYPE_UNCOMPRESSED:
+                    br.startbytes();
+                    if (br.bytesleft() < 12)
+                        return 0xFFFFFFFF;
+                    R0= lzx_get32(br.ptr());
+                    R1= lzx_get32(br.ptr()+4);
+                    R2= lzx_get32(br.ptr()+8);
+                    br.skipbytes(12);
+                    break;
+                default:
+                    return 0xFFFFFFFF;
+                }
+            }
+            uint32_t run= std::min(blockremaining, frameend-outpos);
+
+            if (blocktype==LZX_BLOCKTYPE_UNCOMPRESSED) {
+                if (br.bytesleft() < run)
+                    return 0xFFFFFFFF;
+                memcpy(out+outpos, br.ptr(), run);
+                br.skipbytes(run);
+                outpos += run;
+                blockremaining -= run;
+                continue;
+            }
+
+            uint32_t runend= outpos+run;
+            while (outpos < runend) {
+                int sym= br.decode(maintree);
+                if (sym<0)
+                    return 0xFFFFFFFF;
+                if (sym < LZX_NUMCHARS) {
+                    out[outpos++]= sym;
+                    continue;
+                }
+                sym -= LZX_NUMCHARS;
+                uint32_t length= sym&7;
+                if (length==7) {
+                    if (!haslengthtree)
+                        return 0xFFFFFFFF;
+                    int l= br.decode(lengthtree);
+                    if (l<0)
+                        return 0xFFFFFFFF;
+                    length += l;
+                }
+                length += LZX_MINMATCH;
+
+                uint32_t slot= sym>>3;
+                uint32_t offset;
+                if (slot > 2) {
+                    int extra= tab.extrabits[slot];
+                    if (blocktype==LZX_BLOCKTYPE_ALIGNED && extra>=3) {
+                        offset= tab.positionbase[slot]-2 + (br.read(extra-3)<<3);
+                        int a= br.decode(alignedtree);
+                        if (a<0)
+                            return 0xFFFFFFFF;
+                        offset += a;
+                    }
+                    else {
+                        offset= tab.positionbase[slot]-2 + br.read(extra);
+                    }
+                    R2= R1; R1= R0; R0= offset;
+                }
+                else if (slot==0) {
+                    offset= R0;
+                }
+                else if (slot==1) {
+                    offset= R1;
+                    R1= R0; R0= offset;
+                }
+                else {
+                    offset= R2;
+                    R2= R0; R0= offset;
+                }
+                if (offset==0 || offset > outpos)
+                    return 0xFFFFFFFF;
+                // matches may run past the end of the current run, but not past the block.
+                if (length > outsize-outpos)
+                    length= outsize-outpos;
+                const uint8_t *src= out+outpos-offset;
+                uint8_t *dst= out+outpos;
+                for (uint32_t i=0 ; i<length ; i++)
+                    dst[i]= src[i];
+                outpos += length;
+            }
+            uint32_t done= run + (outpos-runend);
+            if (done > blockremaining)
+                return 0xFFFFFFFF;
+            blockremaining -= done;
+        }
+        if (br.overrun())
+            return 0xFFFFFFFF;
+        if (blocktype!=LZX_BLOCKTYPE_UNCOMPRESSED)
+            br.align();
+
+        // undo the e8 call translation
+        if (e8translation && outpos-framestart > 10) {
+            uint8_t *p= out+framestart;
+            uint8_t *pend= out+outpos-10;
+            int32_t curpos= framestart;
+            while (p < pend) {
+                if (*p++ != 0xE8) {
+                    curpos++;
+                    continue;
+                }
+                int32_t absoff= lzx_get32(p);
+                if (absoff >= -curpos && absoff < int32_t(e8filesize)) {
+                    int32_t reloff= absoff>=0 ? absoff-curpos : absoff+e8filesize;
+                    lzx_set32(p, reloff);
+                }
+                p += 4;
+                curpos += 5;
+            }
+        }
+    }
+    return outpos;
+}
+
+class lzx_bitwriter {
+    uint8_t *_out;
+    uint32_t _outsize;
+    uint32_t _buf;
+    int _bits;
+public:
+    uint32_t _outpos;
+    bool _overflow;
+    lzx_bitwriter(uint8_t *out, uint32_t outsize)
+        : _out(out), _outsize(outsize), _buf(0), _bits(0), _outpos(0), _overflow(false)
+    {
+    }
+    void write(int n, uint32_t value)
+    {
+        if (n>16) {
+            write(n-16, value>>16);
+            write(16, value&0xFFFF);
+            return;
+        }
+        _buf= (_buf<<n) | (value & ((1U<<n)-1));
+        _bits += n;
+        if (_bits >= 16) {
+            _bits -= 16;
+            uint32_t w= _buf>>_bits;
+            if (_outpos+2 > _outsize) {
+                _overflow= true;
+                return;
+            }
+            _out[_outpos++]= w;
+            _out[_outpos++]= w>>8;
+        }
+    }
+    void align()
+    {
+        if (_bits)
+            write(16-_bits, 0);
+    }
+};
+
+// write delta coded codelengths, using runs of zeros where possible
+inline void lzx_writelengths(lzx_bitwriter& bw, const uint8_t *prev, const uint8_t *lens, int first, int last)
+{
+    struct item { uint8_t sym; uint8_t nbits; uint8_t extra; };
+    std::vector<item> items;
+    uint32_t freq[LZX_PRETREE_NSYMBOLS]= {0};
+    int x= first;
+    while (x<last) {
+        int run= 0;
+        while (x+run<last && lens[x+run]==0)
+            run++;
+        if (run>=4) {
+            while (run>=20) {
+                int n= std::min(run, 51);
+                items.push_back(item{18, 5, uint8_t(n-20)});
+                freq[18]++;
+                run -= n; x += n;
+            }
+            if (run>=4) {
+                items.push_back(item{17, 4, uint8_t(run-4)});
+                freq[17]++;
+                x += run;
+            }
+            continue;
+        }
+        uint8_t sym= (prev[x]+17-lens[x])%17;
+        items.push_back(item{sym, 0, 0});
+        freq[sym]++;
+        x++;
+    }
+    uint8_t prelens[LZX_PRETREE_NSYMBOLS];
+    uint16_t precodes[LZX_PRETREE_NSYMBOLS];
+    huff_buildlengths(freq, LZX_PRETREE_NSYMBOLS, 15, prelens);
+    huff_makecodes(prelens, LZX_PRETREE_NSYMBOLS, precodes);
+
+    for (int i=0 ; i<LZX_PRETREE_NSYMBOLS ; i++)
+        bw.write(4, prelens[i]);
+    for (auto const& it : items) {
+        bw.write(prelens[it.sym], precodes[it.sym]);
+        if (it.nbits)
+            bw.write(it.nbits, it.extra);
+    }
+}
+
+inline uint32_t lzx_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (insize==0)
+        return 0;
+    if (outsize<8)
+        return 0xFFFFFFFF;
+    const lzx_positiontables& tab= lzx_tables();
+    lzx_bitwriter bw(out+8, outsize-8);
+    lzmatcher matcher(in, insize, (1<<LZX_WINDOWBITS)-3);
+
+    uint8_t mainlens[LZX_MAINTREE_NSYMBOLS]= {0};
+    uint8_t lengthlens[LZX_LENGTH_NSYMBOLS]= {0};
+    uint32_t R0= 1, R1= 1, R2= 1;
+
+    // no e8 translation
+    bw.write(1, 0);
+
+    struct token { uint16_t mainsym; int16_t lengthsym; uint8_t extrabits; uint32_t extra; };
+    std::vector<token> tokens;
+
+    for (uint32_t framestart= 0 ; framestart<insize ; framestart += LZX_FRAMESIZE) {
+        uint32_t frameend= std::min(insize, framestart+LZX_FRAMESIZE);
+
+        tokens.clear();
+        uint32_t mainfreq[LZX_MAINTREE_NSYMBOLS]= {0};
+        uint32_t lengthfreq[LZX_LENGTH_NSYMBOLS]= {0};
+
+        uint32_t pos= framestart;
+        while (pos < frameend) {
+            uint32_t offset= 0;
+            uint32_t length= matcher.find(pos, 3, std::min(uint32_t(LZX_MAXMATCH), frameend-pos), offset);
+            if (length==0) {
+                matcher.insert(pos);
+                mainfreq[in[pos]]++;
+                tokens.push_back(token{in[pos], -1, 0, 0});
+                pos++;
+                continue;
+            }
+            for (uint32_t i=0 ; i<length ; i++)
+                matcher.insert(pos+i);
+            pos += length;
+
+            token t;
+            t.lengthsym= -1;
+            t.extrabits= 0;
+            t.extra= 0;
+            uint32_t slot;
+            if (offset==R0) {
+                slot= 0;
+            }
+            else if (offset==R1) {
+                slot= 1;
+                R1= R0; R0= offset;
+            }
+            else if (offset==R2) {
+                slot= 2;
+                R2= R0; R0= offset;
+            }
+            else {
+                uint32_t formatted= offset+2;
+                slot= tab.slot(formatted);
+                t.extrabits= tab.extrabits[slot];
+                t.extra= formatted - tab.positionbase[slot];
+                R2= R1; R1= R0; R0= offset;
+            }
+            uint32_t lenheader= std::min(length-LZX_MINMATCH, uint32_t(7));
+            if (lenheader==7) {
+                t.lengthsym= length-LZX_MINMATCH-7;
+                lengthfreq[t.lengthsym]++;
+            }
+            t.mainsym= LZX_NUMCHARS + (slot<<3) + lenheader;
+            mainfreq[t.mainsym]++;
+            tokens.push_back(t);
+        }
+
+        uint8_t newmain[LZX_MAINTREE_NSYMBOLS];
+        uint8_t newlength[LZX_LENGTH_NSYMBOLS];
+        uint16_t maincodes[LZX_MAINTREE_NSYMBOLS];
+        uint16_t lengthcodes[LZX_LENGTH_NSYMBOLS];
+        huff_buildlengths(mainfreq, LZX_MAINTREE_NSYMBOLS, 16, newmain);
+        huff_buildlengths(lengthfreq, LZX_LENGTH_NSYMBOLS, 16, newlength);
+        huff_makecodes(newmain, LZX_MAINTREE_NSYMBOLS, maincodes);
+        huff_makecodes(newlength, LZX_LENGTH_NSYMBOLS, lengthcodes);
+
+        bw.write(3, LZX_BLOCKTYPE_VERBATIM);
+        bw.write(24, frameend-framestart);
+        lzx_writelengths(bw, mainlens, newmain, 0, LZX_NUMCHARS);
+        lzx_writelengths(bw, mainlens, newmain, LZX_NUMCHARS, LZX_MAINTREE_NSYMBOLS);
+        lzx_writelengths(bw, lengthlens, newlength, 0, LZX_LENGTH_NSYMBOLS);
+        memcpy(mainlens, newmain, sizeof(mainlens));
+        memcpy(lengthlens, newlength, sizeof(lengthlens));
+
+        for (auto const& t : tokens) {
+            bw.write(mainlens[t.mainsym], maincodes[t.mainsym]);
+            if (t.lengthsym>=0)
+                bw.write(lengthlens[t.lengthsym], lengthcodes[t.lengthsym]);
+            if (t.extrabits)
+                bw.write(t.extrabits, t.extra);
+            if (bw._overflow)
+                return 0xFFFFFFFF;
+        }
+        bw.align();
+        if (bw._overflow)
+            return 0xFFFFFFFF;
+    }
+    lzx_set32(out, bw._outpos);
+    lzx_set32(out+4, insize);
+    return 8+bw._outpos;
+}
+
+#endif
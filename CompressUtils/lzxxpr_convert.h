@@ -5,17 +5,57 @@
 #include <stdlib.h>
 
 #include <util/wintypes.h>
-#if !defined(_WIN32) && !defined(__CYGWIN__)
-#include "dllloader.h"
-#else
-#define NULLMODULE NULL
-#endif
 #include "compress_msgs.h"
 //#include "stringutils.h"
 
 //#define lzxxprtrace(...) fprintf(stderr, __VA_ARGS__)
 #define lzxxprtrace(...)
 
+#ifdef _NATIVE_COMPRESS
+#include "xpr_codec.h"
+#include "xph_codec.h"
+#include "lzx_codec.h"
+
+// native (de)compression, no dlls needed.
+// the codecs are stateless, so one object can be used from several threads.
+class lzxxpr_convert {
+public:
+    lzxxpr_convert()
+    {
+    }
+    void loaddlls()
+    {
+    }
+    // false when the codec for dwType could not be loaded
+    bool available(int dwType) const
+    {
+        return true;
+    }
+
+    // (de)compresses   {data|insize} ->  {out|outlength}, returns resulting size
+    uint32_t DoCompressConvert(int dwType, uint8_t*out, uint32_t outlength, const uint8_t *data, uint32_t insize) const
+    {
+        switch(dwType) {
+        case ITSCOMP_XPR_DECODE: return xpr_decompress(data, insize, out, outlength);
+        case ITSCOMP_XPR_ENCODE: return xpr_compress(data, insize, out, outlength);
+        case ITSCOMP_XPH_DECODE: return xph_decompress(data, insize, out, outlength);
+        case ITSCOMP_XPH_ENCODE: return xph_compress(data, insize, out, outlength);
+        case ITSCOMP_LZX_DECODE: return lzx_decompress(data, insize, out, outlength);
+        case ITSCOMP_LZX_ENCODE: return lzx_compress(data, insize, out, outlength);
+        default:
+            fprintf(stderr,"lzxxprcv: unknown type: %d\n", dwType);
+            return 0xFFFFFFFF;
+        }
+    }
+};
+#else
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include "dllloader.h"
+#else
+#define NULLMODULE NULL
+#endif
+
 class lzxxpr_convert {
 
 // prototypes of cecompr_nt.dll
@@ -107,6 +147,20 @@ public:
         return res;
     }
 
+    // false when the codec for dwType could not be loaded
+    bool available(int dwType) const
+    {
+        switch(dwType) {
+        case ITSCOMP_XPR_DECODE: return XPR_DecompressDecode!=NULL;
+        case ITSCOMP_XPR_ENCODE: return XPR_CompressEncode!=NULL;
+        case ITSCOMP_XPH_DECODE: return XPH_DecompressDecode!=NULL;
+        case ITSCOMP_XPH_ENCODE: return XPH_CompressEncode!=NULL;
+        case ITSCOMP_LZX_DECODE: return LZX_DecompressDecode!=NULL;
+        case ITSCOMP_LZX_ENCODE: return LZX_CompressEncode!=NULL;
+        default: return false;
+        }
+    }
+
     void loaddlls()
     {
         LZX_CompressClose= NULL;
@@ -208,3 +262,4 @@ static void Compress_FreeFunc(void* Address) ALIGN_STACK
 }
 };
 #endif
+#endif
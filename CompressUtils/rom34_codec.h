@@ -0,0 +1,272 @@
+#ifndef __ROM34_CODEC_H__
+#define __ROM34_CODEC_H__
+#include <stdint.h>
+#include <string.h>
+#include "lz_matcher.h"
+#include "lzx_codec.h"
+
+// native implementation of the xip ROM3 and ROM4 formats, as produced by CECompressv3.dll and CECompressv4.dll,
+// with the 4096 byte pagesize used by rom34_convert.
+//
+// both start with a table of 24 bit little endian values:
+//   the uncompressed size, followed by the end offset of each compressed page, counted from the start of the data.
+//   rom3 has size/4096+1 pages, so a multiple of 4096 ends with an empty page.
+//   rom4 has at least one page, and no trailing empty page.
+// the dlls fail for data larger than 0xFFFFFF.
+//
+// a rom3 page is a sequence of flag bytes, each followed by 8 items, the flags are used lsb first.
+//   a clear flag is a literal byte.
+//   a set flag is a match, with 'c' the next byte:
+//     (c&15)==1 : length 2, from offset (c>>4)+2 before the current position.
+//     otherwise : a 16 bit little endian word, copied from position word>>4 in the page,
+//                 length (word&15)+1, or when that is 1, the next byte + 17.
+// there is no stored mode, incompressible pages grow by 1/8th.
+// the v3 dll compresses empty input to nothing, without a table.
+//
+// a rom4 page is:
+//   uint32_t windowbits;   // always 16
+//   uint32_t fullsize;     // size of the page
+// followed by the page in the LZX format of lzx_codec.h, nothing for an empty page.
+//
+// all functions return the resulting size, or 0xFFFFFFFF on error.
+
+enum {
+    ROM34_PAGESIZE= 4096,
+    ROM34_MAXSIZE= 0xFFFFFF,
+
+    ROM3_MAXSHORTOFS= 17,
+    ROM3_MAXMATCH= 255+17,
+};
+
+inline uint32_t rom34_get24(const uint8_t *p)
+{
+    return p[0] | (p[1]<<8) | (p[2]<<16);
+}
+inline void rom34_set24(uint8_t *p, uint32_t v)
+{
+    p[0]= v;
+    p[1]= v>>8;
+    p[2]= v>>16;
+}
+
+inline uint32_t rom3_npages(uint32_t size)
+{
+    return size/ROM34_PAGESIZE+1;
+}
+inline uint32_t rom4_npages(uint32_t size)
+{
+    return size ? (size-1)/ROM34_PAGESIZE+1 : 1;
+}
+
+typedef uint32_t (*rom34_pagecodec)(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
+
+// splits the page table, and decodes each page with 'decodepage'
+inline uint32_t rom34_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize, uint32_t (*npages)(uint32_t), rom34_pagecodec decodepage)
+{
+    if (insize < 3)
+        return 0xFFFFFFFF;
+    uint32_t fullsize= rom34_get24(in);
+    if (fullsize > outsize)
+        return 0xFFFFFFFF;
+    uint32_t n= npages(fullsize);
+    uint32_t start= 3*(n+1);
+    if (start > insize)
+        return 0xFFFFFFFF;
+    for (uint32_t i=0 ; i<n ; i++) {
+        uint32_t end= rom34_get24(in+3+3*i);
+        if (end < start || end > insize)
+            return 0xFFFFFFFF;
+        uint32_t pagesize= fullsize-i*ROM34_PAGESIZE;
+        if (pagesize > ROM34_PAGESIZE)
+            pagesize= ROM34_PAGESIZE;
+        if (decodepage(in+start, end-start, out+i*ROM34_PAGESIZE, pagesize)!=pagesize)
+            return 0xFFFFFFFF;
+        start= end;
+    }
+    return fullsize;
+}
+
+// encodes each page with 'encodepage', and fills in the page table
+inline uint32_t rom34_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize, uint32_t (*npages)(uint32_t), rom34_pagecodec encodepage)
+{
+    if (insize > ROM34_MAXSIZE)
+        return 0xFFFFFFFF;
+    uint32_t n= npages(insize);
+    uint32_t outpos= 3*(n+1);
+    if (outpos > outsize)
+        return 0xFFFFFFFF;
+    rom34_set24(out, insize);
+    for (uint32_t i=0 ; i<n ; i++) {
+        uint32_t pagesize= insize-i*ROM34_PAGESIZE;
+        if (pagesize > ROM34_PAGESIZE)
+            pagesize= ROM34_PAGESIZE;
+        uint32_t res= encodepage(in+i*ROM34_PAGESIZE, pagesize, out+outpos, outsize-outpos);
+        if (res==0xFFFFFFFF)
+            return 0xFFFFFFFF;
+        outpos += res;
+        if (outpos > ROM34_MAXSIZE)
+            return 0xFFFFFFFF;
+        rom34_set24(out+3+3*i, outpos);
+    }
+    return outpos;
+}
+
+inline uint32_t rom3_decompresspage(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t inpos= 0, outpos= 0;
+    uint32_t flags= 0;
+    int flagcount= 0;
+
+    while (outpos < outsize) {
+        if (flagcount==0) {
+            if (inpos >= insize)
+                return 0xFFFFFFFF;
+            flags= in[inpos++];
+            flagcount= 8;
+        }
+        bool ismatch= flags&1;
+        flags >>= 1;
+        flagcount--;
+
+        if (inpos >= insize)
+            return 0xFFFFFFFF;
+        if (!ismatch) {
+            out[outpos++]= in[inpos++];
+            continue;
+        }
+
+        uint32_t src, length;
+        if ((in[inpos]&15)==1) {
+            uint32_t offset= (in[inpos++]>>4)+2;
+            if (offset > outpos)
+                return 0xFFFFFFFF;
+            src= outpos-offset;
+            length= 2;
+        }
+        else {
+            if (inpos+2 > insize)
+                return 0xFFFFFFFF;
+            uint32_t word= in[inpos] | (in[inpos+1]<<8);
+            inpos += 2;
+            src= word>>4;
+            length= (word&15)+1;
+            if (length==1) {
+                if (inpos >= insize)
+                    return 0xFFFFFFFF;
+                length= in[inpos++]+17;
+            }
+            if (src >= outpos)
+                return 0xFFFFFFFF;
+        }
+        if (length > outsize-outpos)
+            return 0xFFFFFFFF;
+        // byte by byte: overlapping copies repeat the pattern
+        for (uint32_t i=0 ; i<length ; i++)
+            out[outpos+i]= out[src+i];
+        outpos += length;
+    }
+    return outpos;
+}
+
+inline uint32_t rom3_compresspage(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    lzmatcher matcher(in, insize, ROM34_PAGESIZE);
+
+    uint32_t flagpos= 0;
+    int flagcount= 8;
+    uint32_t outpos= 0;
+
+    uint32_t pos= 0;
+    while (pos < insize) {
+        // worst case per item: a flag byte + 3 bytes
+        if (outpos+4 > outsize)
+            return 0xFFFFFFFF;
+        if (flagcount==8) {
+            flagpos= outpos++;
+            out[flagpos]= 0;
+            flagcount= 0;
+        }
+
+        uint32_t offset= 0;
+        uint32_t length= matcher.find(pos, 3, ROM3_MAXMATCH, offset);
+        if (!length && pos+2 <= insize) {
+            // 2 byte matches only have the short form
+            for (offset=2 ; offset<=ROM3_MAXSHORTOFS && offset<=pos ; offset++)
+                if (in[pos-offset]==in[pos] && in[pos-offset+1]==in[pos+1]) {
+                    length= 2;
+                    break;
+                }
+        }
+        if (length==2) {
+            out[outpos++]= ((offset-2)<<4) | 1;
+        }
+        else if (length) {
+            // the position is absolute within the page
+            uint32_t word= (pos-offset)<<4;
+            if (length <= 16)
+                word |= length-1;
+            out[outpos++]= word;
+            out[outpos++]= word>>8;
+            if (length > 16)
+                out[outpos++]= length-17;
+        }
+
+        if (length) {
+            out[flagpos] |= 1<<flagcount;
+            for (uint32_t i=0 ; i<length ; i++)
+                matcher.insert(pos+i);
+            pos += length;
+        }
+        else {
+            matcher.insert(pos);
+            out[outpos++]= in[pos++];
+        }
+        flagcount++;
+    }
+    return outpos;
+}
+
+inline uint32_t rom4_decompresspage(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (insize < 8 || lzx_get32(in)!=LZX_WINDOWBITS || lzx_get32(in+4)!=outsize)
+        return 0xFFFFFFFF;
+    return lzx_decompress(in+8, insize-8, out, outsize);
+}
+
+inline uint32_t rom4_compresspage(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (outsize < 8)
+        return 0xFFFFFFFF;
+    lzx_set32(out, LZX_WINDOWBITS);
+    lzx_set32(out+4, insize);
+    uint32_t res= lzx_compress(in, insize, out+8, outsize-8);
+    if (res==0xFFFFFFFF)
+        return 0xFFFFFFFF;
+    return 8+res;
+}
+
+inline uint32_t rom3_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (insize==0)
+        return 0;
+    return rom34_decompress(in, insize, out, outsize, rom3_npages, rom3_decompresspage);
+}
+
+inline uint32_t rom3_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    if (insize==0)
+        return 0;
+    return rom34_compress(in, insize, out, outsize, rom3_npages, rom3_compresspage);
+}
+
+inline uint32_t rom4_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    return rom34_decompress(in, insize, out, outsize, rom4_npages, rom4_decompresspage);
+}
+
+inline uint32_t rom4_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    return rom34_compress(in, insize, out, outsize, rom4_npages, rom4_compresspage);
+}
+
+#endif
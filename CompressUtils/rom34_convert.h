@@ -2,15 +2,50 @@
 #define __ROM34_CONVERT_H__
 #include <stdio.h>
 #include "util/wintypes.h"
-#if !defined(_WIN32) && !defined(__CYGWIN__)
-#include "dllloader.h"
-#endif
 #include "compress_msgs.h"
 //#include "stringutils.h"
 
 //#define rom34trace(...) fprintf(stderr,__VA_ARGS__)
 #define rom34trace(...)
 
+#ifdef _NATIVE_COMPRESS
+#include "rom34_codec.h"
+
+// native (de)compression, no dlls needed.
+// the codecs are stateless, so one object can be used from several threads.
+class rom34_convert {
+public:
+    rom34_convert()
+    {
+    }
+    void loaddlls()
+    {
+    }
+    // false when the codec for dwType could not be loaded
+    bool available(int dwType) const
+    {
+        return true;
+    }
+    // (de)compresses   {data|insize} ->  {out|outlength}, returns resulting size
+    uint32_t DoCompressConvert(int dwType, uint8_t*out, uint32_t outlength, const uint8_t *in, uint32_t insize) const
+    {
+        switch(dwType) {
+        case ITSCOMP_ROM3_DECODE: return rom3_decompress(in, insize, out, outlength);
+        case ITSCOMP_ROM3_ENCODE: return rom3_compress(in, insize, out, outlength);
+        case ITSCOMP_ROM4_DECODE: return rom4_decompress(in, insize, out, outlength);
+        case ITSCOMP_ROM4_ENCODE: return rom4_compress(in, insize, out, outlength);
+        default:
+            fprintf(stderr,"rom34cv: unknown type: %d\n", dwType);
+            return 0xFFFFFFFF;
+        }
+    }
+};
+#else
+
+#if !defined(_WIN32) && !defined(__CYGWIN__)
+#include "dllloader.h"
+#endif
+
 class rom34_convert {
 
 // prototypes of cecompressv3.dll and cecompressv4.dll
@@ -32,6 +67,18 @@ public:
         loaddlls();
     }
 
+    // false when the codec for dwType could not be loaded
+    bool available(int dwType) const
+    {
+        switch(dwType) {
+        case ITSCOMP_ROM3_DECODE: return decompress3!=NULL;
+        case ITSCOMP_ROM3_ENCODE: return compress3!=NULL;
+        case ITSCOMP_ROM4_DECODE: return decompress4!=NULL;
+        case ITSCOMP_ROM4_ENCODE: return compress4!=NULL;
+        default: return false;
+        }
+    }
+
     void loaddlls()
     {
         compress4= NULL;
@@ -110,3 +157,4 @@ public:
     }
 };
 #endif
+#endif
@@ -25,9 +25,9 @@ public:
         _rom34.loaddlls();
     }
 
-    DWORD DoCompressConvert(int dwType, unsigned char*outdata, DWORD outlength, const unsigned char *indata, DWORD insize)
+    uint32_t DoCompressConvert(int dwType, unsigned char*outdata, uint32_t outlength, const unsigned char *indata, uint32_t insize)
     {
-        DWORD resultLen=0xFFFFFFFF;
+        uint32_t resultLen=0xFFFFFFFF;
         switch(dwType)
         {
 case ITSCOMP_XPR_DECODE:
@@ -0,0 +1,283 @@
+#ifndef __XPH_CODEC_H__
+#define __XPH_CODEC_H__
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include "huffman_codes.h"
+#include "lz_matcher.h"
+
+// native implementation of the XPH ( xpress huffman ) format, as produced by cecompr_nt_xphxpr.dll.
+//
+// this is the 'LZ77+Huffman' variant of xpress, see [MS-XCA] section 2.1 and 2.2:
+//   every 64k of output starts with a 256 byte table of 512 4-bit codelengths.
+//   symbols 0..255 are literals, 256..511 encode (offsetbits<<4)|min(length-3,15).
+//   the bitstream consists of 16 bit little endian words, read msb first,
+//   extra length bytes are stored inline at the current input position.
+//
+// both functions return the resulting size, or 0xFFFFFFFF on error.
+
+enum { XPH_NSYMBOLS= 512, XPH_BLOCKSIZE= 0x10000 };
+
+// returns the index of the highest set bit, x must not be 0.
+inline int xph_highbit(uint32_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long ix;
+    _BitScanReverse(&ix, x);
+    return int(ix);
+#elif defined(__GNUC__)
+    return 31-__builtin_clz(x);
+#else
+    int n= 0;
+    while (x>>=1)
+        n++;
+    return n;
+#endif
+}
+
+inline uint32_t xph_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t inpos= 0, outpos= 0;
+    huffdecoder table;
+
+    while (outpos < outsize) {
+        if (inpos+256+4 > insize)
+            return 0xFFFFFFFF;
+        uint8_t lens[XPH_NSYMBOLS];
+        for (int i=0 ; i<256 ; i++) {
+            lens[2*i]= in[inpos+i]&15;
+            lens[2*i+1]= in[inpos+i]>>4;
+        }
+        if (!table.build(lens, XPH_NSYMBOLS))
+            return 0xFFFFFFFF;
+        inpos += 256;
+
+        uint32_t nextbits= (in[inpos] | (in[inpos+1]<<8))<<16;
+        nextbits |= in[inpos+2] | (in[inpos+3]<<8);
+        inpos += 4;
+        int extrabits= 16;
+
+        auto consume= [&](int n) -> bool {
+            if (n==0)
+                return true;
+            nextbits <<= n;
+            extrabits -= n;
+            if (extrabits < 0) {
+                if (inpos+2 > insize)
+                    return false;
+                nextbits |= (in[inpos] | (in[inpos+1]<<8)) << (-extrabits);
+                inpos += 2;
+                extrabits += 16;
+            }
+            return true;
+        };
+
+        uint32_t blockend= outpos + XPH_BLOCKSIZE;
+        while (outpos < blockend && outpos < outsize) {
+            int bitlen;
+            int symbol= table.decode(nextbits>>16, bitlen);
+            if (symbol<0)
+                return 0xFFFFFFFF;
+            if (!consume(bitlen))
+                return 0xFFFFFFFF;
+            if (symbol < 256) {
+                out[outpos++]= symbol;
+                continue;
+            }
+            if (symbol==256 && inpos==insize)
+                return outpos;
+            symbol -= 256;
+            uint32_t length= symbol&15;
+            int offsetbits= symbol>>4;
+            if (length==15) {
+                if (inpos >= insize)
+                    return 0xFFFFFFFF;
+                length= in[inpos++];
+                if (length==255) {
+                    if (inpos+2 > insize)
+                        return 0xFFFFFFFF;
+                    length= in[inpos] | (in[inpos+1]<<8);
+                    inpos += 2;
+                    if (length==0) {
+                        if (inpos+4 > insize)
+                            return 0xFFFFFFFF;
+                        length= in[inpos] | (in[inpos+1]<<8) | (in[inpos+2]<<16) | (uint32_t(in[inpos+3])<<24);
+                        inpos += 4;
+                    }
+                    if (length < 15)
+                        return 0xFFFFFFFF;
+                    length -= 15;
+                }
+                length += 15;
+            }
+            length += 3;
+
+            uint32_t offset= offsetbits ? nextbits>>(32-offsetbits) : 0;
+            offset += 1<<offsetbits;
+            if (!consume(offsetbits))
+                return 0xFFFFFFFF;
+
+            if (offset > outpos)
+                return 0xFFFFFFFF;
+            if (length > outsize-outpos)
+                length= outsize-outpos;
+            const uint8_t *src= out+outpos-offset;
+            uint8_t *dst= out+outpos;
+            for (uint32_t i=0 ; i<length ; i++)
+                dst[i]= src[i];
+            outpos += length;
+        }
+    }
+    return outpos;
+}
+
+// bitwriter following the [MS-XCA] encoder: two 16 bit words are reserved ahead,
+// so inline bytes end up exactly where the decoder reads them.
+class xph_bitwriter {
+    uint8_t *_out;
+    uint32_t _outsize;
+    uint32_t _pos1, _pos2;
+    uint32_t _bits;
+    int _freebits;
+public:
+    uint32_t _outpos;
+    bool _overflow;
+
+    xph_bitwriter(uint8_t *out, uint32_t outsize, uint32_t start)
+        : _out(out), _outsize(outsize), _pos1(start), _pos2(start+2), _bits(0), _freebits(16),
+          _outpos(start+4), _overflow(start+4 > outsize)
+    {
+    }
+    void put16(uint32_t pos, uint32_t value)
+    {
+        if (pos+2 > _outsize) {
+            _overflow= true;
+            return;
+        }
+        _out[pos]= value;
+        _out[pos+1]= value>>8;
+    }
+    void writebits(int n, uint32_t value)
+    {
+        if (n <= _freebits) {
+            _freebits -= n;
+            _bits= (_bits<<n) | value;
+            return;
+        }
+        n -= _freebits;
+        _bits= (_bits<<_freebits) | (value>>n);
+        put16(_pos1, _bits);
+        _pos1= _pos2;
+        _pos2= _outpos;
+        _outpos += 2;
+        _freebits= 16-n;
+        _bits= value & ((1U<<n)-1);
+    }
+    void writebyte(uint8_t b)
+    {
+        if (_outpos+1 > _outsize) {
+            _overflow= true;
+            return;
+        }
+        _out[_outpos++]= b;
+    }
+    void flush()
+    {
+        put16(_pos1, _bits<<_freebits);
+        put16(_pos2, 0);
+    }
+};
+
+inline uint32_t xph_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    lzmatcher matcher(in, insize, 0xFFFF);
+
+    struct token { uint32_t length; uint32_t offset; };   // length==0 : literal in 'offset'
+    std::vector<token> tokens;
+
+    uint32_t outpos= 0;
+    uint32_t blockstart= 0;
+    while (true) {
+        uint32_t blockend= std::min(insize, blockstart+XPH_BLOCKSIZE);
+        bool last= insize < blockstart+XPH_BLOCKSIZE;
+
+        // collect tokens and frequencies for this block
+        tokens.clear();
+        uint32_t freq[XPH_NSYMBOLS]= {0};
+        uint32_t pos= blockstart;
+        while (pos < blockend) {
+            uint32_t offset= 0;
+            uint32_t length= matcher.find(pos, 3, std::min(uint32_t(0xFFFF), blockend-pos), offset);
+            // symbol 256 doubles as the end marker, so never use it for a match
+            if (length==3 && offset==1)
+                length= 0;
+            if (length) {
+                for (uint32_t i=0 ; i<length ; i++)
+                    matcher.insert(pos+i);
+                int offsetbits= xph_highbit(offset);
+                freq[256 + (offsetbits<<4) + std::min(length-3, uint32_t(15))]++;
+                tokens.push_back(token{length, offset});
+                pos += length;
+            }
+            else {
+                matcher.insert(pos);
+                freq[in[pos]]++;
+                tokens.push_back(token{0, in[pos]});
+                pos++;
+            }
+        }
+        if (last)
+            freq[256]++;
+
+        uint8_t lens[XPH_NSYMBOLS];
+        uint16_t codes[XPH_NSYMBOLS];
+        huff_buildlengths(freq, XPH_NSYMBOLS, 15, lens);
+        huff_makecodes(lens, XPH_NSYMBOLS, codes);
+
+        if (outpos+256 > outsize)
+            return 0xFFFFFFFF;
+        for (int i=0 ; i<256 ; i++)
+            out[outpos+i]= lens[2*i] | (lens[2*i+1]<<4);
+
+        xph_bitwriter bw(out, outsize, outpos+256);
+        for (auto const& t : tokens) {
+            if (t.length==0) {
+                bw.writebits(lens[t.offset], codes[t.offset]);
+                continue;
+            }
+            int offsetbits= xph_highbit(t.offset);
+            uint32_t len= t.length-3;
+            int symbol= 256 + (offsetbits<<4) + std::min(len, uint32_t(15));
+            bw.writebits(lens[symbol], codes[symbol]);
+            if (len >= 15) {
+                if (len < 255+15) {
+                    bw.writebyte(len-15);
+                }
+                else {
+                    bw.writebyte(255);
+                    bw.writebyte(len);
+                    bw.writebyte(len>>8);
+                }
+            }
+            bw.writebits(offsetbits, t.offset ^ (1<<offsetbits));
+            if (bw._overflow)
+                return 0xFFFFFFFF;
+        }
+        if (last)
+            bw.writebits(lens[256], codes[256]);
+        bw.flush();
+        if (bw._overflow)
+            return 0xFFFFFFFF;
+        outpos= bw._outpos;
+
+        if (last)
+            break;
+        blockstart= blockend;
+    }
+    return outpos;
+}
+
+#endif
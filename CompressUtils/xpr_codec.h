@@ -0,0 +1,193 @@
+#ifndef __XPR_CODEC_H__
+#define __XPR_CODEC_H__
+#include <stdint.h>
+#include <string.h>
+#include "lz_matcher.h"
+
+// native implementation of the XPR ( xpress ) format, as produced by cecompr_nt.dll.
+//
+// this is the 'plain LZ77' variant of xpress, see [MS-XCA] section 2.3 and 2.4:
+//   a 32 bit flag word precedes each group of 32 items, a set bit means a match.
+//   a match is a 16 bit word: offset-1 in the upper 13 bits, length-3 in the lower 3.
+//   longer lengths continue in a shared nibble, a byte, a word or a dword.
+//
+// both functions return the resulting size, or 0xFFFFFFFF on error.
+
+inline uint32_t xpr_decompress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    uint32_t inpos= 0, outpos= 0;
+    uint32_t flags= 0;
+    int flagcount= 0;
+    uint32_t lasthalfbyte= 0;
+
+    while (outpos < outsize) {
+        if (flagcount==0) {
+            if (inpos+4 > insize)
+                break;
+            flags= in[inpos] | (in[inpos+1]<<8) | (in[inpos+2]<<16) | (uint32_t(in[inpos+3])<<24);
+            inpos += 4;
+            flagcount= 32;
+        }
+        flagcount--;
+        if (inpos == insize)
+            break;
+        if ((flags & (1U<<flagcount))==0) {
+            out[outpos++]= in[inpos++];
+            continue;
+        }
+        if (inpos+2 > insize)
+            return 0xFFFFFFFF;
+        uint32_t matchbytes= in[inpos] | (in[inpos+1]<<8);
+        inpos += 2;
+        uint32_t length= matchbytes&7;
+        uint32_t offset= (matchbytes>>3)+1;
+        if (length==7) {
+            if (lasthalfbyte==0) {
+                if (inpos >= insize)
+                    return 0xFFFFFFFF;
+                length= in[inpos]&15;
+                lasthalfbyte= inpos++;
+            }
+            else {
+                length= in[lasthalfbyte]>>4;
+                lasthalfbyte= 0;
+            }
+            if (length==15) {
+                if (inpos >= insize)
+                    return 0xFFFFFFFF;
+                length= in[inpos++];
+                if (length==255) {
+                    if (inpos+2 > insize)
+                        return 0xFFFFFFFF;
+                    length= in[inpos] | (in[inpos+1]<<8);
+                    inpos += 2;
+                    if (length==0) {
+                        if (inpos+4 > insize)
+                            return 0xFFFFFFFF;
+                        length= in[inpos] | (in[inpos+1]<<8) | (in[inpos+2]<<16) | (uint32_t(in[inpos+3])<<24);
+                        inpos += 4;
+                    }
+                    if (length < 15+7)
+                        return 0xFFFFFFFF;
+                    length -= 15+7;
+                }
+                length += 15;
+            }
+            length += 7;
+        }
+        length += 3;
+
+        if (offset > outpos)
+            return 0xFFFFFFFF;
+        if (length > outsize-outpos)
+            length= outsize-outpos;
+        // byte by byte: overlapping copies repeat the pattern
+        const uint8_t *src= out+outpos-offset;
+        uint8_t *dst= out+outpos;
+        for (uint32_t i=0 ; i<length ; i++)
+            dst[i]= src[i];
+        outpos += length;
+    }
+    return outpos;
+}
+
+inline uint32_t xpr_compress(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize)
+{
+    // worst case per item: 2+1+1+2+4 bytes, plus the next flag word
+    if (outsize < 4)
+        return 0xFFFFFFFF;
+
+    lzmatcher matcher(in, insize, 8192);
+
+    uint32_t flags= 0;
+    int flagcount= 0;
+    uint32_t flagpos= 0;
+    uint32_t outpos= 4;
+    uint32_t lasthalfbyte= 0;
+
+    uint32_t pos= 0;
+    while (pos < insize) {
+        if (outpos+14 > outsize)
+            return 0xFFFFFFFF;
+
+        uint32_t offset= 0;
+        uint32_t length= matcher.find(pos, 3, 0xFFFFFFFF, offset);
+        if (length) {
+            for (uint32_t i=0 ; i<length ; i++)
+                matcher.insert(pos+i);
+            pos += length;
+
+            uint32_t len= length-3;
+            uint32_t word= (offset-1)<<3;
+            if (len < 7) {
+                word |= len;
+                out[outpos++]= word;
+                out[outpos++]= word>>8;
+            }
+            else {
+                word |= 7;
+                out[outpos++]= word;
+                out[outpos++]= word>>8;
+                uint32_t nibble= len < 15+7 ? len-7 : 15;
+                if (lasthalfbyte==0) {
+                    lasthalfbyte= outpos;
+                    out[outpos++]= nibble;
+                }
+                else {
+                    out[lasthalfbyte] |= nibble<<4;
+                    lasthalfbyte= 0;
+                }
+                if (len >= 15+7) {
+                    if (len < 255+15+7) {
+                        out[outpos++]= len-(15+7);
+                    }
+                    else {
+                        out[outpos++]= 255;
+                        if (len < 0x10000) {
+                            out[outpos++]= len;
+                            out[outpos++]= len>>8;
+                        }
+                        else {
+                            out[outpos++]= 0;
+                            out[outpos++]= 0;
+                            out[outpos++]= len;
+                            out[outpos++]= len>>8;
+                            out[outpos++]= len>>16;
+                            out[outpos++]= len>>24;
+                        }
+                    }
+                }
+            }
+            flags= (flags<<1)|1;
+        }
+        else {
+            matcher.insert(pos);
+            out[outpos++]= in[pos++];
+            flags <<= 1;
+        }
+        if (++flagcount==32) {
+            out[flagpos]= flags;
+            out[flagpos+1]= flags>>8;
+            out[flagpos+2]= flags>>16;
+            out[flagpos+3]= flags>>24;
+            flagcount= 0;
+            flagpos= outpos;
+            outpos += 4;
+        }
+    }
+    // the unused flag bits are set, the decoder stops at the first match past the end of the input
+    if (flagcount)
+        flags= (flags<<(32-flagcount)) | ((1U<<(32-flagcount))-1);
+    else
+        flags= 0xFFFFFFFF;
+    if (outpos > outsize)
+        return 0xFFFFFFFF;
+    out[flagpos]= flags;
+    out[flagpos+1]= flags>>8;
+    out[flagpos+2]= flags>>16;
+    out[flagpos+3]= flags>>24;
+
+    return outpos;
+}
+
+#endif
@@ -1,145 +1,347 @@
 #pragma once
-#include <map>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <stdio.h>
 #include <stdint.h>
 
+// keeps track of the used ranges in the xip address space.
+//
+// the used ranges are stored as a flat sorted vector of extents,
+// for 2 consecutive extents the following is always true:
+//     a.end() <= b.ofs
+// adjacent extents are not merged right away, this keeps the vector from being
+// shifted when a gap is filled exactly. 'extents' returns the merged view.
+//
+// two indexes over the gaps between the extents:
+//   - a max-tree by position, for first fit lookups.
+//   - a set ordered by (gapsize, offset), for best fit lookups.
+// inserting or removing an extent shifts the tail of the vector and of the tree,
+// growing or shrinking an existing extent is O(log n).
 class allocmap {
-    // this maps offset -> chunksize
-    // consecutive chunks are merged, such that for 2 consecutive iteraters
-    // the following is always true:
-    //     endofs(i) < i->first
-    typedef std::map<uint32_t,uint32_t> allocmap_t;
+public:
+    struct extent {
+        uint32_t ofs;
+        uint32_t size;
+
+        uint32_t end() const { return ofs+size; }
+        bool operator<(const extent& rhs) const { return ofs<rhs.ofs; }
+    };
+    typedef std::vector<extent> extentlist;
+private:
+    extentlist _ext;
+
+    // _gaptree[1] is the root, leaf k is the gap between _ext[k] and _ext[k+1]
+    std::vector<uint32_t> _gaptree;
+    size_t _gapcap;
+
+    // (gapsize, gapofs) of all non empty gaps
+    typedef std::pair<uint32_t,uint32_t> gapkey;
+    std::set<gapkey> _gapsbysize;
+
+    // used ranges recorded between beginbulk and endbulk
+    extentlist _pending;
+    bool _bulk;
+
+    size_t ngaps() const { return _ext.empty() ? 0 : _ext.size()-1; }
+    uint32_t gap(size_t k) const { return _ext[k+1].ofs-_ext[k].end(); }
+
+    void rebuild()
+    {
+        _gapcap= 1;
+        while (_gapcap<ngaps())
+            _gapcap*=2;
+        _gaptree.assign(2*_gapcap, 0);
+        _gapsbysize.clear();
+        for (size_t k=0 ; k<ngaps() ; k++) {
+            _gaptree[_gapcap+k]= gap(k);
+            addgap(k);
+        }
+        for (size_t i=_gapcap-1 ; i>0 ; i--)
+            _gaptree[i]= std::max(_gaptree[2*i], _gaptree[2*i+1]);
+    }
+    // recalc the tree leaves [first, last) and their parents
+    void updatetree(size_t first, size_t last)
+    {
+        if (ngaps()>_gapcap) {
+            rebuild();
+            return;
+        }
+        last= std::min(last, _gapcap);
+        if (first>=last)
+            return;
+        for (size_t k=first ; k<last ; k++)
+            _gaptree[_gapcap+k]= k<ngaps() ? gap(k) : 0;
+        first += _gapcap;
+        last += _gapcap-1;
+        while (first>1) {
+            first/=2;
+            last/=2;
+            for (size_t i=first ; i<=last ; i++)
+                _gaptree[i]= std::max(_gaptree[2*i], _gaptree[2*i+1]);
+        }
+    }
+    void addgap(size_t k)
+    {
+        if (k<ngaps() && gap(k))
+            _gapsbysize.insert(gapkey(gap(k), _ext[k].end()));
+    }
+    void removegap(size_t k)
+    {
+        if (k<ngaps() && gap(k))
+            _gapsbysize.erase(gapkey(gap(k), _ext[k].end()));
+    }
 
-    allocmap_t _m;
+    // all changes to _ext go through these three
+    void setextent(size_t ix, const extent& e)
+    {
+        if (ix)
+            removegap(ix-1);
+        removegap(ix);
+        _ext[ix]= e;
+        if (ix)
+            addgap(ix-1);
+        addgap(ix);
+        updatetree(ix ? ix-1 : 0, ix+1);
+    }
+    void insertextent(size_t ix, const extent& e)
+    {
+        if (ix)
+            removegap(ix-1);
+        size_t oldgaps= ngaps();
+        _ext.insert(_ext.begin()+ix, e);
+        if (ix)
+            addgap(ix-1);
+        addgap(ix);
+        updatetree(ix ? ix-1 : 0, std::max(oldgaps, ngaps()));
+    }
+    void eraseextent(size_t ix)
+    {
+        if (ix)
+            removegap(ix-1);
+        removegap(ix);
+        size_t oldgaps= ngaps();
+        _ext.erase(_ext.begin()+ix);
+        if (ix)
+            addgap(ix-1);
+        updatetree(ix ? ix-1 : 0, oldgaps);
+    }
+
+    // first gap at or after 'from' of at least 'size' bytes, or -1
+    int64_t findgap(size_t from, uint32_t size, size_t node, size_t lo, size_t hi) const
+    {
+        if (hi<=from || lo>=ngaps() || _gaptree[node]<size)
+            return -1;
+        if (hi-lo==1)
+            return lo;
+        size_t mid= (lo+hi)/2;
+        int64_t k= findgap(from, size, 2*node, lo, mid);
+        if (k>=0)
+            return k;
+        return findgap(from, size, 2*node+1, mid, hi);
+    }
+    int64_t findgap(size_t from, uint32_t size) const
+    {
+        return findgap(from, size, 1, 0, _gapcap);
+    }
+    // index of the last extent starting at or before ofs, or -1
+    int64_t findextent(uint32_t ofs) const
+    {
+        auto p= std::upper_bound(_ext.begin(), _ext.end(), extent{ofs, 0});
+        return (p-_ext.begin())-1;
+    }
+    static void reportoverlap(uint32_t ofs, uint32_t end, const extent& e, const char *tag)
+    {
+        printf("overlap: mark(%08x-%08x) %s / i=%08x-%08x\n", ofs, end, tag, e.ofs, e.end());
+    }
 public:
+    allocmap()
+        : _gapcap(1), _bulk(false)
+    {
+        rebuild();
+    }
+    // the used ranges, with adjacent extents merged
+    extentlist extents() const
+    {
+        extentlist l;
+        for (auto const& e : _ext) {
+            if (!l.empty() && l.back().end()==e.ofs)
+                l.back().size += e.size;
+            else
+                l.push_back(e);
+        }
+        return l;
+    }
     void printallocmap() const
     {
-        for (auto i= _m.begin() ; i!=_m.end() ; ++i)
-            printf("%08x-%08x: %8x\n", i->first, endofs(i), i->second);
+        for (auto const& e : extents())
+            printf("%08x-%08x: %8x\n", e.ofs, e.end(), e.size);
+    }
+
+    // while in bulk mode, markused only records the ranges,
+    // endbulk then sorts and merges them in one pass.
+    void beginbulk()
+    {
+        _bulk= true;
     }
-    static uint32_t endofs(allocmap_t::iterator i) { return i->first+i->second; }
-    static uint32_t endofs(allocmap_t::const_iterator i) { return i->first+i->second; }
+    void endbulk()
+    {
+        _bulk= false;
+        if (_pending.empty())
+            return;
+        _pending.insert(_pending.end(), _ext.begin(), _ext.end());
+        std::stable_sort(_pending.begin(), _pending.end());
+
+        _ext.clear();
+        for (auto const& e : _pending) {
+            if (!_ext.empty() && _ext.back().end() >= e.ofs) {
+                if (_ext.back().end() > e.ofs)
+                    reportoverlap(e.ofs, e.end(), _ext.back(), "bulk");
+                if (e.end() > _ext.back().end())
+                    _ext.back().size= e.end()-_ext.back().ofs;
+            }
+            else {
+                _ext.push_back(e);
+            }
+        }
+        _pending.clear();
+        rebuild();
+    }
+
     void markused(uint32_t ofs, uint32_t size, const char *tag)
     {
 //        printf("mark %08x-%08x (%8x): %s\n", ofs, ofs+size, size, tag);
         if (size==0)
             return;
-        uint32_t end= ofs+size;
-        //printf("used(%08x-%08x) %s\n", ofs, end, tag);
-
-        auto i= _m.upper_bound(ofs);
-        if (i==_m.begin()) {
-            // first item
-            _m.insert(allocmap_t::value_type(ofs, size));
+        if (_bulk) {
+            _pending.push_back(extent{ofs, size});
             return;
         }
-        auto next= i;
-        --i;
-        // now  i->first <= ofs  < (i+1)->first
+        uint32_t end= ofs+size;
 
-        if (endofs(i)==ofs) {
-            //  --------<.......>----------<....>
-            //          i      ie
-            //                 ofs...end
-            if (next!=_m.end() && end > next->first)
-                printf("overlap: mark(%08x-%08x) / i=%08x-%08x, n=%08x-%08x\n", ofs, end, i->first, endofs(i), next->first, endofs(next));
-                //throw "overlap";
-            i->second += size;
-        }
-        else if (endofs(i) > ofs) {
-            //  --------<.......>----------<....>
-            //          i      ie
-            //               ofs...end
-            printf("overlap: mark(%08x-%08x) / i=%08x-%08x, n=%08x-%08x\n", ofs, end, i->first, endofs(i), next->first, endofs(next));
-            //throw "overlap";
+        int64_t prev= findextent(ofs);
+        size_t next= prev+1;
+        bool overlap= (prev>=0 && _ext[prev].end() > ofs) || (next<_ext.size() && _ext[next].ofs < end);
+        if (overlap) {
+            // merge everything overlapping [ofs,end) into one extent
+            size_t first= prev>=0 && _ext[prev].end() > ofs ? prev : next;
+            size_t last= first;
+            while (last<_ext.size() && _ext[last].ofs < end) {
+                reportoverlap(ofs, end, _ext[last], tag);
+                last++;
+            }
+            uint32_t newofs= std::min(ofs, _ext[first].ofs);
+            uint32_t newend= std::max(end, _ext[last-1].end());
+            while (last-1 > first)
+                eraseextent(--last);
+            setextent(first, extent{newofs, newend-newofs});
         }
-        else {
+        else if (prev>=0 && _ext[prev].end()==ofs) {
             //  --------<.......>----------<....>
-            //          i      ie
-            //                    ofs...end
-            if (next!=_m.end() && end > next->first) {
-                //  --------<.......>----------<......>
-                //          i      ie
-                //                    ofs........end
-                
-                printf("overlap: mark(%08x-%08x) / i=%08x-%08x, n=%08x-%08x\n", ofs, end, i->first, endofs(i), next->first, endofs(next));
-                //throw "overlap";
-            }
-            auto ins= _m.insert(allocmap_t::value_type(ofs, size));
-            if (!ins.second)
-                throw "failed to free";
-            i= ins.first;
-
-            next= i; ++next;
+            //          prev   ofs...end
+            setextent(prev, extent{_ext[prev].ofs, _ext[prev].size+size});
         }
-
-        if (next==_m.end())
-            return;
-
-        // now check if we need to merge with 'next'
-        if (endofs(i) == next->first) {
-            i->second += next->second;
-            _m.erase(next);
+        else if (next<_ext.size() && _ext[next].ofs==end) {
+            //  --------<.......>----------<....>
+            //                     ofs...end
+            setextent(next, extent{ofs, _ext[next].size+size});
         }
-        else if (endofs(i) > next->first) {
-            printf("overlap: mark(%08x-%08x) / i=%08x-%08x, n=%08x-%08x\n", ofs, end, i->first, endofs(i), next->first, endofs(next));
-            //throw "overlap";
+        else {
+            insertextent(next, extent{ofs, size});
         }
     }
     void markfree(uint32_t ofs, uint32_t size)
     {
-        uint32_t  end= ofs+size;
+        if (size==0)
+            return;
+        uint32_t end= ofs+size;
 
-        auto i= _m.upper_bound(ofs);
-        if (i==_m.begin())
+        int64_t found= findextent(ofs);
+        if (found<0)
             throw "nothing to free";
-        --i;
+        size_t ix= found;
 
-        if (end > endofs(i))
+        // merge adjacent extents covering the range
+        while (end > _ext[ix].end() && ix+1<_ext.size() && _ext[ix+1].ofs==_ext[ix].end()) {
+            setextent(ix, extent{_ext[ix].ofs, _ext[ix].size+_ext[ix+1].size});
+            eraseextent(ix+1);
+        }
+        extent e= _ext[ix];
+        if (end > e.end())
             throw "freeing empty";
 
-        if (end == endofs(i)) {
+        if (ofs==e.ofs && end==e.end()) {
+            // -----<.........>-------
+            //      |         |
+            //     ofs       end
+            eraseextent(ix);
+        }
+        else if (end == e.end()) {
             // -----<.........>-------
             //            |   |
             //           ofs  end
-            i->second -= size;
+            setextent(ix, extent{e.ofs, e.size-size});
         }
-        else if (ofs==i->first) {
+        else if (ofs==e.ofs) {
             // -----<.........>-------
             //      |   |
             //     ofs  end
-            auto ins= _m.insert(allocmap_t::value_type(end, endofs(i)-end));
-            if (!ins.second)
-                throw "failed to free";
-            _m.erase(i);
+            setextent(ix, extent{end, e.size-size});
         }
-        else if (ofs>i->first && end<endofs(i)) {
+        else {
             // -----<.........>-------
             //         |   |
             //        ofs  end
-            auto ins= _m.insert(allocmap_t::value_type(end, endofs(i)-end));
-            if (!ins.second)
-                throw "failed to free";
-            i->second= ofs-i->first;
-        }
-        else {
-            throw "markfree: case not implemented";
+            setextent(ix, extent{e.ofs, ofs-e.ofs});
+            insertextent(ix+1, extent{end, e.end()-end});
         }
     }
 
+    // first fit: the lowest gap after the first used range which can hold 'size',
+    // or the end of the last used range.
     uint32_t findfree(uint32_t size)
     {
-        uint32_t ofs= _m.begin()->first;
-        for (auto i=_m.begin() ; i!=_m.end() ; ++i)
-        {
-            if (i->first-ofs >= size) {
-                markused(ofs, size, "findfree");
-                return ofs;
-            }
-
-            ofs= i->first + i->second;
+        uint32_t ofs= 0;
+        if (!_ext.empty()) {
+            if (size==0)
+                return _ext.front().ofs;
+            int64_t k= findgap(0, size);
+            ofs= k>=0 ? _ext[k].end() : _ext.back().end();
         }
-        // allocate new item at end
         markused(ofs, size, "findfree");
         return ofs;
     }
+    // best fit: the smallest gap which can hold 'size', the lowest one when there are several.
+    uint32_t findbestfit(uint32_t size)
+    {
+        uint32_t ofs= 0;
+        if (!_ext.empty()) {
+            if (size==0)
+                return _ext.front().ofs;
+            auto i= _gapsbysize.lower_bound(gapkey(size, 0));
+            ofs= i!=_gapsbysize.end() ? i->second : _ext.back().end();
+        }
+        markused(ofs, size, "findbestfit");
+        return ofs;
+    }
+    // first fit for a range starting at a multiple of 'align'
+    uint32_t findaligned(uint32_t size, uint32_t align)
+    {
+        auto alignup= [align](uint32_t x) { return uint32_t((uint64_t(x)+align-1)/align*align); };
+        uint32_t ofs= 0;
+        if (!_ext.empty()) {
+            if (size==0)
+                return _ext.front().ofs;
+            ofs= alignup(_ext.back().end());
+            for (int64_t k= findgap(0, size) ; k>=0 ; k= findgap(k+1, size)) {
+                uint32_t start= alignup(_ext[k].end());
+                if (start >= _ext[k].end() && uint64_t(start)+size <= _ext[k+1].ofs) {
+                    ofs= start;
+                    break;
+                }
+            }
+        }
+        markused(ofs, size, "findaligned");
+        return ofs;
+    }
 };
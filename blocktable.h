@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <stddef.h>
+
+// sorted, contiguous table of blocks, keyed by their start offset.
+//
+// used instead of a std::map by the block based readers to translate offsets:
+// the keys are kept in their own array, so the binary search touches only a few
+// cachelines, and a cursor remembering the last hit makes sequential access O(1).
+//
+// the cursor is atomic, so lookups may be done from several threads,
+// changing the table is not threadsafe.
+template<typename KEY, typename INFO>
+class blocktable {
+    std::vector<KEY> _keys;
+    std::vector<INFO> _items;
+    mutable std::atomic<size_t> _cursor;
+
+public:
+    static constexpr size_t npos= ~size_t(0);
+
+    typedef typename std::vector<INFO>::iterator iterator;
+    typedef typename std::vector<INFO>::const_iterator const_iterator;
+
+    blocktable() : _cursor(0) { }
+
+    size_t size() const { return _keys.size(); }
+    bool empty() const { return _keys.empty(); }
+
+    KEY key(size_t ix) const { return _keys[ix]; }
+    INFO& operator[](size_t ix) { return _items[ix]; }
+    const INFO& operator[](size_t ix) const { return _items[ix]; }
+    INFO& back() { return _items.back(); }
+    const INFO& back() const { return _items.back(); }
+
+    iterator begin() { return _items.begin(); }
+    iterator end() { return _items.end(); }
+    const_iterator begin() const { return _items.begin(); }
+    const_iterator end() const { return _items.end(); }
+
+    // adds the block, or replaces an existing block with the same key.
+    // returns the index of the block.
+    size_t set(KEY key, const INFO& info)
+    {
+        size_t ix= std::lower_bound(_keys.begin(), _keys.end(), key)-_keys.begin();
+        if (ix<_keys.size() && _keys[ix]==key) {
+            _items[ix]= info;
+        }
+        else {
+            _keys.insert(_keys.begin()+ix, key);
+            _items.insert(_items.begin()+ix, info);
+        }
+        return ix;
+    }
+    // adds the block, an existing block with the same key is kept.
+    // returns false when the key was already present.
+    bool insert(KEY key, const INFO& info)
+    {
+        size_t ix= std::lower_bound(_keys.begin(), _keys.end(), key)-_keys.begin();
+        if (ix<_keys.size() && _keys[ix]==key)
+            return false;
+        _keys.insert(_keys.begin()+ix, key);
+        _items.insert(_items.begin()+ix, info);
+        return true;
+    }
+
+    // returns the index of the block starting at 'key', or npos
+    size_t find(KEY key) const
+    {
+        size_t ix= std::lower_bound(_keys.begin(), _keys.end(), key)-_keys.begin();
+        if (ix<_keys.size() && _keys[ix]==key)
+            return ix;
+        return npos;
+    }
+
+    // returns the index of the last block starting at or before 'key', or npos
+    size_t floor(KEY key) const
+    {
+        size_t n= _keys.size();
+        size_t cur= _cursor.load(std::memory_order_relaxed);
+
+        // first try the last hit, and the block after it
+        if (cur<n && _keys[cur]<=key) {
+            if (cur+1==n || key<_keys[cur+1])
+                return cur;
+            if (cur+2==n || key<_keys[cur+2]) {
+                _cursor.store(cur+1, std::memory_order_relaxed);
+                return cur+1;
+            }
+        }
+
+        size_t ix= std::upper_bound(_keys.begin(), _keys.end(), key)-_keys.begin();
+        if (ix==0)
+            return npos;
+        _cursor.store(ix-1, std::memory_order_relaxed);
+        return ix-1;
+    }
+};
@@ -0,0 +1,39 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+#include <emmintrin.h>
+#define BYTESUM_SSE2
+#endif
+
+// sum of all bytes modulo 2^32, as used for the B000FF block checksums.
+//
+// uses psadbw against zero to add 16 or 32 bytes at a time,
+// the tail and non-x86 builds use the plain loop.
+inline uint32_t bytesum(const uint8_t *p, size_t n)
+{
+    uint64_t sum= 0;
+#if defined(__AVX2__)
+    __m256i acc256= _mm256_setzero_si256();
+    for ( ; n>=32 ; p+=32, n-=32)
+        acc256= _mm256_add_epi64(acc256, _mm256_sad_epu8(_mm256_loadu_si256((const __m256i*)p), _mm256_setzero_si256()));
+    uint64_t lanes256[4];
+    _mm256_storeu_si256((__m256i*)lanes256, acc256);
+    sum += lanes256[0]+lanes256[1]+lanes256[2]+lanes256[3];
+#endif
+#if defined(BYTESUM_SSE2)
+    __m128i acc= _mm_setzero_si128();
+    for ( ; n>=16 ; p+=16, n-=16)
+        acc= _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)p), _mm_setzero_si128()));
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    sum += lanes[0]+lanes[1];
+#endif
+    while (n--)
+        sum += *p++;
+    return uint32_t(sum);
+}
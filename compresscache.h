@@ -0,0 +1,262 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <openssl/sha.h>
+#ifdef _WIN32
+#include <process.h>
+#define compresscache_getpid _getpid
+#else
+#include <unistd.h>
+#define compresscache_getpid getpid
+#endif
+
+extern int g_verbose;
+
+// persistent cache of compressor output, enabled with -compcache CACHEFILE.
+//
+// entries are keyed by the codec id, the input size and a sha1 of the input,
+// so identical blocks in other images, or in a later run, are not compressed again.
+//
+// each run has a sequence number, entries remember the last run which used them.
+// when the cache grows past its maximum size, the least recently used entries are dropped.
+//
+// the cache is loaded at startup and written on exit, when new entries were added.
+// before writing, entries added to the file by concurrent runs are merged in.
+class compresscache {
+    enum { VERSION= 1, MAGIC= 0x48434345 };    // 'ECCH'
+public:
+    // returned by the compress function when the data could not be compressed
+    static constexpr uint32_t INCOMPRESSIBLE= 0xFFFFFFFF;
+    // returned by the compress function when the codec failed, or is not available.
+    // this result is not cached, compress() returns INCOMPRESSIBLE for it.
+    static constexpr uint32_t CODECERROR= 0xFFFFFFFE;
+private:
+    struct entry {
+        uint32_t lastrun;
+        uint32_t compsize;
+        std::vector<uint8_t> data;
+    };
+    // key: codec, fullsize, sha1 of the data
+    typedef std::map<std::string,entry> entrymap_t;
+
+    bool _enabled;
+    std::string _filename;
+    uint64_t _maxsize;
+    uint32_t _run;
+
+    std::mutex _lock;
+    entrymap_t _entries;
+    uint64_t _totalsize;
+    bool _modified;
+    uint64_t _hits;
+    uint64_t _misses;
+
+    static std::string makekey(uint32_t codec, const uint8_t *data, size_t size)
+    {
+        uint8_t key[8+SHA_DIGEST_LENGTH];
+        for (int i=0 ; i<4 ; i++) {
+            key[i]= uint8_t(codec>>(8*i));
+            key[4+i]= uint8_t(uint32_t(size)>>(8*i));
+        }
+        SHA1(data, size, key+8);
+        return std::string((const char*)key, sizeof(key));
+    }
+    static size_t entrysize(const std::string& key, const entry& e)
+    {
+        return key.size()+12+e.data.size();
+    }
+
+    static uint32_t get32(const uint8_t *p)
+    {
+        return p[0] | (p[1]<<8) | (p[2]<<16) | (uint32_t(p[3])<<24);
+    }
+    static void put32(std::vector<uint8_t>& v, uint32_t x)
+    {
+        for (int i=0 ; i<4 ; i++)
+            v.push_back(uint8_t(x>>(8*i)));
+    }
+
+    // reads the cachefile, entries already in memory are kept.
+    // returns the run number stored in the file
+    uint32_t loadfile()
+    {
+        FILE *f= fopen(_filename.c_str(), "rb");
+        if (!f)
+            return 0;
+        std::vector<uint8_t> data;
+        uint8_t buf[0x10000];
+        size_t n;
+        while ((n= fread(buf, 1, sizeof(buf), f))>0)
+            data.insert(data.end(), buf, buf+n);
+        fclose(f);
+
+        const uint8_t *p= data.data();
+        const uint8_t *end= p+data.size();
+        if (end-p<12 || get32(p)!=MAGIC || get32(p+4)!=VERSION) {
+            printf("ignoring compression cache %s: invalid header\n", _filename.c_str());
+            return 0;
+        }
+        uint32_t run= get32(p+8);
+        p += 12;
+        const size_t keysize= 8+SHA_DIGEST_LENGTH;
+        while (p<end) {
+            if (size_t(end-p) < keysize+12)
+                break;
+            std::string key((const char*)p, keysize);   p += keysize;
+            entry e;
+            e.lastrun= get32(p);                        p += 4;
+            e.compsize= get32(p);                       p += 4;
+            uint32_t datasize= get32(p);                p += 4;
+            if (size_t(end-p) < datasize)
+                break;
+            e.data.assign(p, p+datasize);               p += datasize;
+
+            auto i= _entries.find(key);
+            if (i==_entries.end()) {
+                _totalsize += entrysize(key, e);
+                _entries.insert(entrymap_t::value_type(key, e));
+            }
+            else {
+                i->second.lastrun= std::max(i->second.lastrun, e.lastrun);
+            }
+        }
+        if (p<end)
+            printf("compression cache %s is truncated\n", _filename.c_str());
+        return run;
+    }
+    // drops the least recently used entries, until the cache fits in _maxsize
+    void evict()
+    {
+        if (_totalsize<=_maxsize)
+            return;
+        std::vector<std::pair<uint32_t,entrymap_t::iterator> > byage;
+        for (auto i= _entries.begin() ; i!=_entries.end() ; ++i)
+            byage.push_back(std::make_pair(i->second.lastrun, i));
+        std::sort(byage.begin(), byage.end(), [](const std::pair<uint32_t,entrymap_t::iterator>& a, const std::pair<uint32_t,entrymap_t::iterator>& b) {
+            return a.first < b.first;
+        });
+        size_t dropped= 0;
+        for (auto const& a : byage) {
+            if (_totalsize<=_maxsize)
+                break;
+            _totalsize -= entrysize(a.second->first, a.second->second);
+            _entries.erase(a.second);
+            dropped++;
+        }
+        if (g_verbose)
+            printf("compression cache: dropped %d old entries\n", int(dropped));
+    }
+public:
+    compresscache()
+        : _enabled(false), _maxsize(256<<20), _run(0), _totalsize(0), _modified(false), _hits(0), _misses(0)
+    {
+    }
+    bool enabled() const { return _enabled; }
+
+    void open(const std::string& filename, uint64_t maxsize)
+    {
+        _filename= filename;
+        _maxsize= maxsize;
+        _enabled= true;
+        _run= loadfile()+1;
+        if (g_verbose)
+            printf("compression cache %s: %d entries, %lld bytes\n", _filename.c_str(), int(_entries.size()), (long long)_totalsize);
+    }
+
+    // returns the cached result for 'data', or calls 'fn' to compress it, and stores the result.
+    // 'fn' writes to 'compdata' and returns the compressed size, INCOMPRESSIBLE or CODECERROR.
+    // can be called from several threads.
+    template<typename COMPRESSFN>
+    uint32_t compress(uint32_t codec, const uint8_t *data, size_t size, uint8_t *compdata, COMPRESSFN fn)
+    {
+        if (!_enabled) {
+            uint32_t compsize= fn();
+            return compsize==CODECERROR ? INCOMPRESSIBLE : compsize;
+        }
+        std::string key= makekey(codec, data, size);
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            auto i= _entries.find(key);
+            if (i!=_entries.end()) {
+                entry& e= i->second;
+                if (e.lastrun!=_run) {
+                    e.lastrun= _run;
+                    _modified= true;
+                }
+                std::copy(e.data.begin(), e.data.end(), compdata);
+                _hits++;
+                return e.compsize;
+            }
+            _misses++;
+        }
+
+        uint32_t compsize= fn();
+        if (compsize==CODECERROR)
+            return INCOMPRESSIBLE;
+
+        entry e;
+        e.lastrun= _run;
+        e.compsize= compsize;
+        if (compsize!=INCOMPRESSIBLE)
+            e.data.assign(compdata, compdata+compsize);
+
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_entries.insert(entrymap_t::value_type(key, e)).second) {
+            _totalsize += entrysize(key, e);
+            _modified= true;
+        }
+        return compsize;
+    }
+
+    // call on exit
+    void save()
+    {
+        if (!_enabled)
+            return;
+        if (g_verbose)
+            printf("compression cache: %lld hits, %lld misses\n", (long long)_hits, (long long)_misses);
+        if (!_modified)
+            return;
+
+        // merge entries written by other runs since we loaded the file
+        _run= std::max(_run, loadfile());
+        evict();
+
+        std::vector<uint8_t> data;
+        put32(data, MAGIC);
+        put32(data, VERSION);
+        put32(data, _run);
+        for (auto const& kv : _entries) {
+            data.insert(data.end(), kv.first.begin(), kv.first.end());
+            put32(data, kv.second.lastrun);
+            put32(data, kv.second.compsize);
+            put32(data, uint32_t(kv.second.data.size()));
+            data.insert(data.end(), kv.second.data.begin(), kv.second.data.end());
+        }
+
+        // a per process tmpfile, so concurrent runs don't write to the same file
+        char pidstr[32];
+        snprintf(pidstr, sizeof(pidstr), ".%d.tmp", int(compresscache_getpid()));
+        std::string tmpname= _filename+pidstr;
+        FILE *f= fopen(tmpname.c_str(), "wb");
+        if (!f) {
+            printf("could not create compression cache %s\n", _filename.c_str());
+            return;
+        }
+        bool ok= fwrite(data.data(), 1, data.size(), f)==data.size();
+        ok= fclose(f)==0 && ok;
+#ifdef _WIN32
+        remove(_filename.c_str());
+#endif
+        if (!ok || rename(tmpname.c_str(), _filename.c_str())) {
+            printf("error writing compression cache %s\n", _filename.c_str());
+            remove(tmpname.c_str());
+        }
+    }
+};
@@ -3,16 +3,20 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <set>
 #include <functional>
 #include <algorithm>  // max_element
 #include <numeric>    // accumulate
 #include <sys/stat.h>
 #include <ctime>
+#include <chrono>
 
 #include "err/posix.h"
 #include "stringutils.h"
 #include "FileFunctions.h"
 #include <memory>
+#include <mutex>
 
 #ifndef _NO_COMPRESS
 #include "lzxxpr_convert.h"
@@ -21,14 +25,24 @@
 #endif
 #ifdef _WIN32
 #include <io.h>
+#include <windows.h>
+#endif
+#if !defined(_WIN32) && !defined(_NO_MMAP)
+#include <sys/mman.h>
+#endif
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 #ifndef _WIN32
 #define _strtoi64 strtoll
 #endif
 #include <openssl/rsa.h>
 #include <openssl/sha.h>
+#include <openssl/evp.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
+#include <openssl/x509.h>
 
 #include "util/ReadWriter.h"
 #include "util/endianutil.h"
@@ -40,6 +54,12 @@
 #include "util/rw/ByteVectorWriter.h"
 #include "util/rw/ByteVectorReader.h"
 #include "allocmap.h"
+#include "freerunmap.h"
+#include "blocktable.h"
+#include "bytesum.h"
+#include "threadpool.h"
+#include "imageindex.h"
+#include "compresscache.h"
 #include "args.h"
 
 
@@ -95,7 +115,7 @@ typedef uint16_t WCHAR;
 // NOT DONE LIKE THIS: fully qualified filepath:  nbh:htcimg:OS:fffb:xip23:boot.hv
 // usually it is sufficient to just specify the last part of a path
 //
-// todo: create new imgfs filesystem
+// new imgfs filesystems are created with: -create imgfs SRC...
 //
 // notation:  "htcimage:{ devname='PB92', OS:{ bs=0x800, fffb:{ptab:{ updxip=<xip>, bootxip=<xip>, imgfs:{ comp='XPR', files=@filelist, mods=@modlist } } } } }"
 //
@@ -112,6 +132,23 @@ typedef uint16_t WCHAR;
 
 int g_verbose= 0;
 
+// number of worker threads, set with -j
+int g_threads= 1;
+
+// serializes access to the image reader stack.
+// readers keep a current position, and some layers keep internal state,
+// so concurrent tasks must hold this lock around each setpos+read.
+std::mutex g_imagelock;
+
+// cached scan results, enabled with -index
+imageindex g_index;
+
+// share identical data chunks between imgfs files, set with -dedup
+bool g_dedup= false;
+
+// cached compressor output, enabled with -compcache
+compresscache g_compcache;
+
 
 uint32_t roundsize(uint32_t x, uint32_t round)
 {
@@ -120,6 +157,281 @@ uint32_t roundsize(uint32_t x, uint32_t round)
     return ((x-1)|(round-1))+1;
 }
 
+// optional interface for readers which can return a pointer into the mapped image,
+// instead of copying through read().
+class SpanSource {
+public:
+    virtual ~SpanSource() { }
+
+    // returns a pointer to [ofs, ofs+size), or NULL when this range is not
+    // contiguous in memory. the pointer stays valid as long as the reader.
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)= 0;
+};
+
+const uint8_t* getspan(ReadWriter_ptr r, uint64_t ofs, uint64_t size)
+{
+    SpanSource *s= dynamic_cast<SpanSource*>(r.get());
+    return s ? s->span(ofs, size) : NULL;
+}
+
+#ifndef _NO_MMAP
+// MmapReader with spans: keeps a second, readonly, shared mapping of the file,
+// so spans see all writes done through the MmapReader.
+class SpanMmapReader : public MmapReader, public SpanSource {
+    const uint8_t *_base;
+    uint64_t _mapsize;
+public:
+    SpanMmapReader(const std::string& filename, int mode, uint64_t size=0)
+        : MmapReader(filename, mode, size), _base(NULL), _mapsize(0)
+    {
+#ifndef _WIN32
+        int fd= open(filename.c_str(), O_RDONLY);
+        if (fd==-1)
+            return;
+        struct stat st;
+        if (fstat(fd, &st)==0 && st.st_size>0) {
+            void *p= mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p!=MAP_FAILED) {
+                _base= (const uint8_t*)p;
+                _mapsize= st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+    virtual ~SpanMmapReader()
+    {
+#ifndef _WIN32
+        if (_base)
+            munmap((void*)_base, _mapsize);
+#endif
+    }
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)
+    {
+        if (_base==NULL || ofs>_mapsize || size>_mapsize-ofs)
+            return NULL;
+        return _base+ofs;
+    }
+};
+#endif
+
+// copy-on-write layer over the readonly image, used with -atomic.
+//
+// modified pages are kept in memory, the image itself is not written to.
+// commit() writes the whole image with the modified pages, in offset order, to a new file,
+// and renames that over the original. so when eimgfs fails, the image is left untouched.
+class OverlayReader : public ReadWriter, public SpanSource {
+    enum { PAGESIZE= 0x10000, COPYSIZE= 0x100000 };
+
+    ReadWriter_ptr _base;
+    std::string _filename;
+    uint64_t _basesize;     // nr of bytes still visible from _base
+    uint64_t _size;
+    uint64_t _pos;
+
+    typedef std::map<uint64_t, ByteVector> pagemap_t;   // pagenr -> page contents
+    pagemap_t _pages;
+    bool _modified;
+
+    // returns the page for modification, it is copied from the image on first use.
+    ByteVector& dirtypage(uint64_t pagenr)
+    {
+        auto i= _pages.find(pagenr);
+        if (i!=_pages.end())
+            return i->second;
+
+        ByteVector& page= _pages[pagenr];
+        page.resize(PAGESIZE);
+        uint64_t ofs= pagenr*PAGESIZE;
+        if (ofs<_basesize) {
+            _base->setpos(ofs);
+            _base->read(&page[0], size_t(std::min(uint64_t(PAGESIZE), _basesize-ofs)));
+        }
+        return page;
+    }
+    void readat(uint64_t ofs, uint8_t *p, size_t n)
+    {
+        while (n) {
+            size_t pofs= size_t(ofs%PAGESIZE);
+            size_t want= std::min(n, size_t(PAGESIZE-pofs));
+
+            auto i= _pages.find(ofs/PAGESIZE);
+            if (i!=_pages.end()) {
+                std::copy(&i->second[pofs], &i->second[pofs]+want, p);
+            }
+            else {
+                size_t fromimage= ofs<_basesize ? size_t(std::min(uint64_t(want), _basesize-ofs)) : 0;
+                if (fromimage) {
+                    _base->setpos(ofs);
+                    _base->read(p, fromimage);
+                }
+                std::fill(p+fromimage, p+want, uint8_t(0));
+            }
+            ofs += want;
+            p += want;
+            n -= want;
+        }
+    }
+public:
+    OverlayReader(ReadWriter_ptr base, const std::string& filename, uint64_t size)
+        : _base(base), _filename(filename), _basesize(base->size()), _size(std::max(base->size(), size)), _pos(0), _modified(size>base->size())
+    {
+    }
+    virtual size_t read(uint8_t *p, size_t n)
+    {
+        if (_pos>=_size)
+            return 0;
+        size_t want= size_t(std::min(uint64_t(n), _size-_pos));
+        readat(_pos, p, want);
+        _pos += want;
+        return want;
+    }
+    virtual void write(const uint8_t *p, size_t n)
+    {
+        if (n)
+            _modified= true;
+        while (n) {
+            size_t pofs= size_t(_pos%PAGESIZE);
+            size_t want= std::min(n, size_t(PAGESIZE-pofs));
+
+            ByteVector& page= dirtypage(_pos/PAGESIZE);
+            std::copy(p, p+want, &page[pofs]);
+
+            _pos += want;
+            p += want;
+            n -= want;
+        }
+        _size= std::max(_size, _pos);
+    }
+    virtual void setpos(uint64_t off)
+    {
+        _pos= off;
+    }
+    virtual void truncate(uint64_t off)
+    {
+        _modified= true;
+        if (off<_size) {
+            // drop the pages past the end, and clear the tail of the last page
+            _pages.erase(_pages.lower_bound((off+PAGESIZE-1)/PAGESIZE), _pages.end());
+            auto i= _pages.find(off/PAGESIZE);
+            if (i!=_pages.end())
+                std::fill(&i->second[off%PAGESIZE], &i->second[0]+PAGESIZE, uint8_t(0));
+            _basesize= std::min(_basesize, off);
+        }
+        _size= off;
+    }
+    virtual uint64_t size()
+    {
+        return _size;
+    }
+    virtual uint64_t getpos() const
+    {
+        return _pos;
+    }
+    virtual bool eof()
+    {
+        return _pos>=_size;
+    }
+    // spans come from a single modified page, or from the image when no page in the range was modified
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)
+    {
+        if (size==0 || ofs>_size || size>_size-ofs)
+            return NULL;
+        uint64_t first= ofs/PAGESIZE;
+        uint64_t last= (ofs+size-1)/PAGESIZE;
+        auto i= _pages.lower_bound(first);
+        if (i==_pages.end() || i->first>last)
+            return ofs+size<=_basesize ? getspan(_base, ofs, size) : NULL;
+        if (first==last)
+            return &i->second[ofs%PAGESIZE];
+        return NULL;
+    }
+
+#ifndef _WIN32
+    // makes the rename durable
+    static void syncdir(const std::string& filename)
+    {
+        size_t lastslash= filename.find_last_of('/');
+        std::string dirname= lastslash==std::string::npos ? "." : lastslash==0 ? "/" : filename.substr(0, lastslash);
+        int fd= open(dirname.c_str(), O_RDONLY);
+        if (fd<0)
+            return;
+        if (fsync(fd))
+            printf("WARNING: could not sync %s\n", dirname.c_str());
+        close(fd);
+    }
+#endif
+    // returns false when the image could not be replaced
+    bool commit()
+    {
+        if (!_modified)
+            return true;
+
+        std::string tmpname= _filename+".tmp";
+        FILE *f= fopen(tmpname.c_str(), "wb");
+        if (!f) {
+            printf("could not create %s, image not modified\n", tmpname.c_str());
+            return false;
+        }
+        ByteVector buf(COPYSIZE);
+        bool ok= true;
+        for (uint64_t ofs= 0 ; ok && ofs<_size ; ofs+=COPYSIZE) {
+            size_t n= size_t(std::min(uint64_t(COPYSIZE), _size-ofs));
+            readat(ofs, &buf[0], n);
+            ok= fwrite(&buf[0], 1, n, f)==n;
+        }
+        // the new contents must be on disk before the rename makes them the image
+        ok= ok && fflush(f)==0;
+#ifdef _WIN32
+        ok= ok && _commit(_fileno(f))==0;
+#else
+        ok= ok && fsync(fileno(f))==0;
+#endif
+        ok= fclose(f)==0 && ok;
+#ifndef _WIN32
+        struct stat st;
+        if (ok && stat(_filename.c_str(), &st)==0)
+            chmod(tmpname.c_str(), st.st_mode&07777);
+#endif
+
+        // release the image before replacing it
+        _base.reset();
+#ifdef _WIN32
+        ok= ok && MoveFileExA(tmpname.c_str(), _filename.c_str(), MOVEFILE_REPLACE_EXISTING|MOVEFILE_WRITE_THROUGH);
+#else
+        ok= ok && rename(tmpname.c_str(), _filename.c_str())==0;
+        if (ok)
+            syncdir(_filename);
+#endif
+        if (!ok) {
+            printf("error writing %s, image not modified\n", tmpname.c_str());
+            remove(tmpname.c_str());
+            return false;
+        }
+        if (g_verbose)
+            printf("committed %d modified pages to %s\n", int(_pages.size()), _filename.c_str());
+        return true;
+    }
+};
+
+// OffsetReader which passes spans on to the underlying reader
+class SpanOffsetReader : public OffsetReader, public SpanSource {
+    ReadWriter_ptr _base;
+    uint64_t _baseofs;
+    uint64_t _basesize;
+public:
+    SpanOffsetReader(ReadWriter_ptr r, uint64_t ofs, uint64_t size)
+        : OffsetReader(r, ofs, size), _base(r), _baseofs(ofs), _basesize(size)
+    {
+    }
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)
+    {
+        if (ofs>_basesize || size>_basesize-ofs)
+            return NULL;
+        return getspan(_base, _baseofs+ofs, size);
+    }
+};
+
 // char magic[7] "B000FF\n"
 // uint32_t fileoffset;
 // uint32_t filesize;
@@ -156,9 +468,12 @@ class B000FFReadWriter : public ReadWriter {
         uint32_t blockofs;   // offset into this
         uint32_t size;
         bool modified;
+        bool newblock;      // allocated in this session, the checksum is calculated on close
+        bool sumverified;   // the stored checksum matched the contents when opened
+        uint32_t sum;       // checksum, kept up to date by write() when verified
 
         blockinfo(uint64_t fileofs, uint32_t blockofs, uint32_t size)
-            : fileofs(fileofs), blockofs(blockofs), size(size), modified(false)
+            : fileofs(fileofs), blockofs(blockofs), size(size), modified(false), newblock(false), sumverified(false), sum(0)
         {
         }
 
@@ -188,17 +503,19 @@ class B000FFReadWriter : public ReadWriter {
     };
 
     // maps blockofs -> blockinfo
-    typedef std::map<uint32_t, blockinfo> blockmap_t;
+    typedef blocktable<uint32_t, blockinfo> blockmap_t;
     blockmap_t _blockmap;
 
-    blockmap_t::iterator _curblk;
+    size_t _curblk;     // index in _blockmap, npos at the end
 
     uint32_t _blocksize;
     uint64_t _allocpos;
     bool _extended;
     void allocblock(uint32_t bofs, uint32_t size)
     {
-        _blockmap.insert(blockmap_t::value_type(bofs, blockinfo(_allocpos+12, bofs, size)));
+        blockinfo bi(_allocpos+12, bofs, size);
+        bi.newblock= true;
+        _blockmap.insert(bofs, bi);
 
         if (g_verbose>1)
             printf("updating b00 blk header at %08llx: %08x %08x %08x\n", _allocpos, bofs, size, 0);
@@ -221,7 +538,7 @@ public:
         return magic=="B000FF\n";
     }
     B000FFReadWriter(ReadWriter_ptr r)
-        : _r(r), _bpos(0), _curblk(_blockmap.end()), _blocksize(0), _allocpos(0), _extended(false)
+        : _r(r), _bpos(0), _curblk(blockmap_t::npos), _blocksize(0), _allocpos(0), _extended(false)
     {
         if (_r->isreadonly()) setreadonly();
 
@@ -244,7 +561,7 @@ public:
             }
             uint64_t ofs= _r->getpos();
 
-            _blockmap.insert(blockmap_t::value_type(blockoffset, blockinfo(ofs, blockoffset, blocksize)));
+            _blockmap.insert(blockoffset, blockinfo(ofs, blockoffset, blocksize));
 
             _r->setpos(ofs+blocksize);
         }
@@ -252,8 +569,8 @@ public:
         setpos(_binstart);
 
         std::map<uint32_t, int> bsstats;
-        std::for_each(_blockmap.begin(), _blockmap.end(), [&bsstats](const blockmap_t::value_type& vt) {
-            bsstats[vt.second.size]++;
+        std::for_each(_blockmap.begin(), _blockmap.end(), [&bsstats](const blockinfo& bi) {
+            bsstats[bi.size]++;
         });
 
         auto imax= std::max_element(bsstats.begin(), bsstats.end(), [](const std::pair<uint32_t, int>& lhs, const std::pair<uint32_t, int>& rhs) {
@@ -267,18 +584,31 @@ public:
 
             dumpblocks();
 
-            bool checkok= true;
-            std::for_each(_blockmap.begin(), _blockmap.end(), [this, &checkok](const blockmap_t::value_type& vt) {
-                const blockinfo& bi= vt.second;
-                _r->setpos(bi.fileofs-4);
-                uint32_t storedsum= _r->read32le(); 
-                uint32_t bytesum= calcbytesum(bi.size);
+            // the sums are calculated on the -j N workers, and reported in block order
+            std::vector<uint32_t> storedsums(_blockmap.size());
+            std::vector<uint32_t> calcsums(_blockmap.size());
+            threadpool pool(g_threads);
+            for (size_t i= 0 ; i<_blockmap.size() ; i++)
+                pool.add([this, i, &storedsums, &calcsums]() {
+                    const blockinfo& bi= _blockmap[i];
+                    uint8_t hdr[4];
+                    readat(bi.fileofs-4, hdr, 4);
+                    storedsums[i]= get32le(hdr);
+                    calcsums[i]= calcbytesum(bi.fileofs, bi.size);
+                });
+            pool.wait();
 
-                if (storedsum!=bytesum) {
-                    printf("checksum error for B:%08x  F:[%08llx], size=%08x -> file:%08x calc:%08x\n", bi.blockofs, bi.fileofs, bi.size, storedsum, bytesum);
+            bool checkok= true;
+            for (size_t i= 0 ; i<_blockmap.size() ; i++) {
+                blockinfo& bi= _blockmap[i];
+                // a verified sum can be updated on write, without reading the block again
+                bi.sum= storedsums[i];
+                bi.sumverified= storedsums[i]==calcsums[i];
+                if (!bi.sumverified) {
+                    printf("checksum error for B:%08x  F:[%08llx], size=%08x -> file:%08x calc:%08x\n", bi.blockofs, bi.fileofs, bi.size, storedsums[i], calcsums[i]);
                     checkok= false;
                 }
-            });
+            }
 
             if (checkok)
                 printf("block checksums ok\n");
@@ -288,8 +618,7 @@ public:
     {
         uint32_t curofs=_binstart;
         uint32_t startofs=0xFFFFFFFF;
-        std::for_each(_blockmap.begin(), _blockmap.end(), [&curofs, &startofs](const blockmap_t::value_type& vt) {
-            const blockinfo& bi= vt.second;
+        std::for_each(_blockmap.begin(), _blockmap.end(), [&curofs, &startofs](const blockinfo& bi) {
             if (bi.blockofs>curofs) {
                 if (startofs==0xFFFFFFFF) {
                     printf("                            gap: %08x-%08x\n", curofs, bi.blockofs);
@@ -314,16 +643,14 @@ public:
     virtual ~B000FFReadWriter()
     {
     // update checksum of modified blocks
-        std::for_each(_blockmap.begin(), _blockmap.end(), [this](const blockmap_t::value_type& vt) {
-            const blockinfo& bi= vt.second;
+        std::for_each(_blockmap.begin(), _blockmap.end(), [this](const blockinfo& bi) {
             if (bi.modified) {
-                _r->setpos(bi.fileofs);
-                uint32_t bytesum= calcbytesum(bi.size);
+                uint32_t sum= bi.sumverified ? bi.sum : calcbytesum(bi.fileofs, bi.size);
 
                 _r->setpos(bi.fileofs-4);
-                _r->write32le(bytesum);
+                _r->write32le(sum);
                 if (g_verbose>1)
-                    printf("checksum for B:%08x  F:[%08llx], size=%08x -> %08x\n", bi.blockofs, bi.fileofs, bi.size, bytesum);
+                    printf("checksum for B:%08x  F:[%08llx], size=%08x -> %08x\n", bi.blockofs, bi.fileofs, bi.size, sum);
             }
         });
 
@@ -337,66 +664,84 @@ public:
         }
     }
 
-    // calculate the byte sum of <size> bytes, starting
-    // at the current position
-    uint32_t calcbytesum(size_t size)
+    // positional read, safe to use from multiple threads
+    void readat(uint64_t ofs, uint8_t *p, size_t n)
+    {
+        std::lock_guard<std::mutex> lock(g_imagelock);
+        _r->setpos(ofs);
+        _r->read(p, n);
+    }
+    // calculate the byte sum of <size> bytes at <ofs>,
+    // directly from the mapped image when possible.
+    uint32_t calcbytesum(uint64_t ofs, size_t size)
     {
+        if (const uint8_t *p= getspan(_r, ofs, size))
+            return bytesum(p, size);
+
         uint32_t sum= 0;
-        ByteVector buf(_blocksize);
+        ByteVector buf(std::max(_blocksize, uint32_t(0x10000)));
         while (size)
         {
-            uint32_t want= std::min(buf.size(), size);
-            size_t nr= _r->read(&buf[0], want);
-            if (nr==0)
-                break;
-            
-            sum += calcbuffersum(&buf[0], nr);
-            size -= nr;
+            size_t want= std::min(buf.size(), size);
+            readat(ofs, &buf[0], want);
+            sum += bytesum(&buf[0], want);
+            ofs += want;
+            size -= want;
         }
 
         return sum;
     }
-    uint32_t calcbuffersum(const uint8_t *buf, size_t size)
+    // updates the block checksum with the difference between the new data,
+    // and the bytes it replaces, so unchanged data is not read again on close.
+    // only for blocks where the stored checksum was verified when opening:
+    // for the others, and for new blocks, the sum is calculated on close.
+    void updatesum(blockinfo& bi, uint64_t ofs, const uint8_t *p, size_t n)
     {
-        //uint32_t sum= 0;
-        //std::for_each(buf, buf+size, [&sum](uint8_t b) { sum+=b; });
-        //return sum;
-        return std::accumulate(buf, buf+size, 0);
+        if (!bi.sumverified)
+            return;
+        ByteVector buf;
+        const uint8_t *old= getspan(_r, ofs, n);
+        if (!old) {
+            buf.resize(n);
+            readat(ofs, &buf[0], n);
+            old= &buf[0];
+        }
+        bi.sum += bytesum(p, n) - bytesum(old, n);
     }
 
     virtual size_t read(uint8_t *p, size_t n)
     {
 #define b00printf(...)
         b00printf("rd[%08x], %zx\n", _bpos, n);
-        if (_curblk==_blockmap.end()) {
+        if (_curblk==blockmap_t::npos) {
             b00printf("  -> EOF\n");
             return 0;
         }
 
-        b00printf("cur: %08llx-%08llx > %08x-%08x\n", _curblk->second.fileofs, _curblk->second.endfileofs(), _curblk->second.blockofs, _curblk->second.endblkofs());
+        b00printf("cur: %08llx-%08llx > %08x-%08x\n", _blockmap[_curblk].fileofs, _blockmap[_curblk].endfileofs(), _blockmap[_curblk].blockofs, _blockmap[_curblk].endblkofs());
         // cur pos is after cur block -> move to next
-        if (_bpos >= _curblk->second.endblkofs()) {
+        if (_bpos >= _blockmap[_curblk].endblkofs()) {
             setpos(_bpos);
 
-            if (_curblk==_blockmap.end()) {
+            if (_curblk==blockmap_t::npos) {
                 b00printf("-> nextblk=EOF\n");
                 return 0;
             }
-            b00printf("newcur: %08llx-%08llx > %08x-%08x\n", _curblk->second.fileofs, _curblk->second.endfileofs(), _curblk->second.blockofs, _curblk->second.endblkofs());
+            b00printf("newcur: %08llx-%08llx > %08x-%08x\n", _blockmap[_curblk].fileofs, _blockmap[_curblk].endfileofs(), _blockmap[_curblk].blockofs, _blockmap[_curblk].endblkofs());
         }
 
         // cur pos is before current block ( and after prev block )
-        if (_bpos < _curblk->second.blockofs) {
-            size_t want= std::min(n, size_t(_curblk->second.blockofs-_bpos));
+        if (_bpos < _blockmap[_curblk].blockofs) {
+            size_t want= std::min(n, size_t(_blockmap[_curblk].blockofs-_bpos));
             std::fill(p, p+want, 0);
             b00printf("in gap: size=%zx\n", want);
             _bpos += want;
             return want;
         }
 
-        size_t want= std::min(n, _curblk->second.size-size_t(_bpos-_curblk->second.blockofs));
+        size_t want= std::min(n, _blockmap[_curblk].size-size_t(_bpos-_blockmap[_curblk].blockofs));
 
-        _r->setpos(_curblk->second.block2file(_bpos));
+        _r->setpos(_blockmap[_curblk].block2file(_bpos));
         _r->read(p, want);
 
         b00printf("got data: size=%zx\n", want);
@@ -407,29 +752,29 @@ public:
     virtual void write(const uint8_t *p, size_t n)
     {
         while (n) {
-            if (_curblk==_blockmap.end())
+            if (_curblk==blockmap_t::npos)
                 throw "b000ff: out of space";
 
             // cur pos is after cur block -> move to next
-            if (_bpos >= _curblk->second.endblkofs()) {
+            if (_bpos >= _blockmap[_curblk].endblkofs()) {
                 setpos(_bpos);
 
-                if (_curblk==_blockmap.end())
+                if (_curblk==blockmap_t::npos)
                     throw "b000ff: out of space";
             }
 
             // cur pos is before current block ( and after prev block )
-            if (_bpos < _curblk->second.blockofs) {
-                uint32_t nextstart= _curblk->second.blockofs;
+            if (_bpos < _blockmap[_curblk].blockofs) {
+                uint32_t nextstart= _blockmap[_curblk].blockofs;
 
                 if (g_verbose>1)
-                    printf("attempted write in b00 gap: %08x [ nextbk=%08x-%08x]\n", _bpos, nextstart, _curblk->second.endblkofs());
+                    printf("attempted write in b00 gap: %08x [ nextbk=%08x-%08x]\n", _bpos, nextstart, _blockmap[_curblk].endblkofs());
 
-                if (_curblk==_blockmap.begin())
+                if (_curblk==0)
                     throw "b000ff: can't write before first block";
 
                 _curblk--;
-                uint32_t prevend= _curblk->second.endblkofs();
+                uint32_t prevend= _blockmap[_curblk].endblkofs();
                 int n= (_bpos-prevend)/_blocksize;
     
 //              printf("alloccing b00 block: prev=%08x, next=%08x -> n=%d: ofs=%08x, size=%08x\n", 
@@ -438,11 +783,14 @@ public:
                 setpos(_bpos);
             }
 
-            _curblk->second.modified= true;
+            blockinfo& bi= _blockmap[_curblk];
+            bi.modified= true;
+
+            size_t want= std::min(n, bi.size-size_t(_bpos-bi.blockofs));
 
-            size_t want= std::min(n, _curblk->second.size-size_t(_bpos-_curblk->second.blockofs));
+            updatesum(bi, bi.block2file(_bpos), p, want);
 
-            _r->setpos(_curblk->second.block2file(_bpos));
+            _r->setpos(bi.block2file(_bpos));
             _r->write(p, want);
 
             _bpos += want;
@@ -453,18 +801,17 @@ public:
     {
         _bpos= off;
         
-        auto i= _blockmap.upper_bound(off);
-        if (i==_blockmap.begin()) i= _blockmap.end(); else i--;
+        size_t i= _blockmap.floor(off);
 
-        if (i==_blockmap.end()) {
+        if (i==blockmap_t::npos) {
             printf("map=%d, off=%08llx\n", (int)_blockmap.size(), off);
             throw "b000ff before start of map";
         }
 
-        if (off >= i->second.endblkofs()) {
+        if (off >= _blockmap[i].endblkofs()) {
             i++;
 
-            if (i==_blockmap.end()) {
+            if (i==_blockmap.size()) {
                 printf("map=%d, off=%08llx\n", (int)_blockmap.size(), off);
                 throw "beyond end of map";
             }
@@ -485,7 +832,7 @@ public:
     }
     virtual bool eof()
     {
-        return _curblk==_blockmap.end();
+        return _curblk==blockmap_t::npos;
     }
 };
 
@@ -672,11 +1019,15 @@ private:
 note: partitiontable offsets refer to fffbfffd offsets
 
 */
-class FFFBFFFDReader : public ReadWriter {
+class FFFBFFFDReader : public ReadWriter, public SpanSource {
     ReadWriter_ptr  _r;
     uint32_t _blocksize;
     uint64_t _pos;
 
+    // whole block writes are staged with their footers, upto this size
+    enum { STAGINGSIZE= 0x100000 };
+    ByteVector _staging;
+
     // for calculating fileoffset from fffbfffd blocknr
     struct areainfo {
         uint32_t blocksize;
@@ -702,8 +1053,8 @@ class FFFBFFFDReader : public ReadWriter {
     };
 
     // maps logical blocknr -> areainfo,  where blocknr is firstblock of area
-    typedef std::map<uint32_t, areainfo> areamap_t;
-    typedef std::map<uint64_t, areainfo> filemap_t;
+    typedef blocktable<uint32_t, areainfo> areamap_t;
+    typedef blocktable<uint64_t, areainfo> filemap_t;
 
     areamap_t _areamap;
     filemap_t _filemap;
@@ -711,9 +1062,8 @@ class FFFBFFFDReader : public ReadWriter {
     void dumpareas()
     {
         printf("by fileofs\n");
-        std::for_each(_filemap.begin(), _filemap.end(), [](const filemap_t::value_type& vt) {
-            const areainfo& bi= vt.second;
-            printf("%08llx: ", vt.first);
+        std::for_each(_filemap.begin(), _filemap.end(), [](const areainfo& bi) {
+            printf("%08llx: ", bi.fileoffset);
             if (hasblocknr(bi.firstblock, bi.tag)) {
                 if (bi.nblocks)  {
                     printf("area %08llx-%08llx/%8x: %08llx-%08llx/%3x: %05x-%05x[..%05x]/%3x..%3x  %08x\n",
@@ -742,15 +1092,18 @@ class FFFBFFFDReader : public ReadWriter {
 public:
     static uint32_t findblocksize(ReadWriter_ptr rd)
     {
+        ByteVector hdr(0x1010);
+        rd->setpos(0);
+        rd->read(&hdr[0], hdr.size());
+
         DwordVector blocks;
         DwordVector magic;
         for (unsigned i= 0 ; i<=0x1000 ; i+=0x200)
         {
-            rd->setpos(i);
-            blocks.push_back(rd->read32le());
-            magic.push_back(rd->read32le());
-            blocks.push_back(rd->read32le());
-            magic.push_back(rd->read32le());
+            blocks.push_back(get32le(&hdr[i]));
+            magic.push_back(get32le(&hdr[i+4]));
+            blocks.push_back(get32le(&hdr[i+8]));
+            magic.push_back(get32le(&hdr[i+12]));
         }
         if (blocks[2]==0 && magic[2]==0xfffbfffd)
         {
@@ -788,9 +1141,9 @@ public:
 
     void registerarea(const areainfo& bi)
     {
-        _filemap[bi.fileoffset]= bi;
+        _filemap.set(bi.fileoffset, bi);
         if (hasblocknr(bi.firstblock, bi.tag))
-            _areamap[bi.firstblock]= bi;
+            _areamap.set(bi.firstblock, bi);
     }
     static bool hasblocknr(uint32_t snr, uint32_t tag)
     {
@@ -801,15 +1154,58 @@ public:
         return tag!=0xFFFFFFFF && tag!=0;
     }
 
+    // extracts the snr+tag footers of blocks [first, last) into 'footers'
+    void read_footers(size_t first, size_t last, uint32_t *footers)
+    {
+        uint64_t stride= _blocksize+8;
+        const uint8_t *p= getspan(_r, first*stride, (last-first)*stride);
+        if (p) {
+            for (size_t i= first ; i<last ; i++, p+=stride) {
+                footers[2*i]= get32le(p+_blocksize);
+                footers[2*i+1]= get32le(p+_blocksize+4);
+            }
+            return;
+        }
+        // read in windows of whole blocks
+        size_t perwindow= std::max(size_t(1), size_t(0x100000/stride));
+        ByteVector buf(perwindow*stride);
+        for (size_t i= first ; i<last ; ) {
+            size_t n= std::min(perwindow, last-i);
+            {
+                std::lock_guard<std::mutex> lock(g_imagelock);
+                _r->setpos(i*stride);
+                _r->read(&buf[0], n*stride);
+            }
+            for (size_t j= 0 ; j<n ; j++, i++) {
+                footers[2*i]= get32le(&buf[j*stride+_blocksize]);
+                footers[2*i+1]= get32le(&buf[j*stride+_blocksize+4]);
+            }
+        }
+    }
     void scan_fffbd_blocks()
     {
+        size_t nblocks= size_t(_r->size()/(_blocksize+8));
+
+        // the footers are gathered in one pass, split over the -j N workers when mapped,
+        // then merged into areas.
+        DwordVector footers(2*nblocks);
+        if (nblocks) {
+            threadpool pool(getspan(_r, 0, nblocks*uint64_t(_blocksize+8)) ? g_threads : 1);
+            size_t perchunk= (nblocks+pool.size()-1)/pool.size();
+            for (size_t first= 0 ; first<nblocks ; first+=perchunk) {
+                size_t last= std::min(nblocks, first+perchunk);
+                pool.add([this, first, last, &footers]() { read_footers(first, last, &footers[0]); });
+            }
+            pool.wait();
+        }
+
         areainfo bi;
 
-        for (uint64_t ofs= 0 ; ofs+_blocksize+8 <= _r->size() ; ofs+=_blocksize+8)
+        for (size_t i= 0 ; i<nblocks ; i++)
         {
-            _r->setpos(ofs+_blocksize);
-            uint32_t snr= _r->read32le();
-            uint32_t tag= _r->read32le();
+            uint64_t ofs= i*uint64_t(_blocksize+8);
+            uint32_t snr= footers[2*i];
+            uint32_t tag= footers[2*i+1];
 //          printf("read[%08x|%08x],  curarea: %08llx-?  %08x-%08x[l=%04x] hs=%d  |%08x : %s\n",
 //                  snr, tag, bi.fileoffset, bi.firstblock, uint32_t(bi.firstblock+bi.usedblocks), 
 //                  (int)bi.usedblocks, hasblocknr(snr, tag), bi.tag, vhexdump(data).c_str());
@@ -841,13 +1237,13 @@ public:
     }
     void process_partitions()
     {
-        auto a0= _areamap.find(0);
-        if (a0==_areamap.end()) {
+        size_t a0= _areamap.find(0);
+        if (a0==areamap_t::npos) {
             printf("ptablescan could not find block0\n");
             return;
         }
         ByteVector sec0(512);
-        _r->setpos(a0->second.fileoffset);
+        _r->setpos(_areamap[a0].fileoffset);
         _r->read(&sec0[0], sec0.size());
 
         PartitionTable ptab(sec0, _blocksize);
@@ -859,13 +1255,12 @@ public:
         {
             const PartitionTable::Entry& ent= ptab.entry(i);
             uint32_t blocknr= i==0 ? 0 : size_t(ent.start()/_blocksize);
-            auto pi= _areamap.upper_bound(blocknr);
-            if (pi==_areamap.begin()) {
+            size_t pi= _areamap.floor(blocknr);
+            if (pi==areamap_t::npos) {
                 printf("ptablescan: no areas [%05x]\n", blocknr);
                 continue;
             }
-            pi--;
-            areainfo &bi= pi->second;
+            areainfo &bi= _areamap[pi];
             if (blocknr < bi.firstblock) {
                 printf("ptablescan - UNEXPECTED: ub(%05x) = %05x\n", blocknr, bi.firstblock);
                 continue;
@@ -875,19 +1270,65 @@ public:
                 continue;
             }
 
-            _filemap[bi.fileoffset].nblocks = 
+            _filemap[_filemap.find(bi.fileoffset)].nblocks = 
               bi.nblocks= size_t(ent.size()/_blocksize + (i==0 ? 2 : 0))+blocknr-bi.firstblock;
         }
     }
-    FFFBFFFDReader(ReadWriter_ptr rw, uint32_t blocksize)
+    // the area list is restored from the image index, instead of scanning all block footers.
+    bool loadindex(const std::string& idxname)
+    {
+        if (idxname.empty())
+            return false;
+        auto blob= g_index.find(idxname);
+        if (!blob)
+            return false;
+        indexreader r(*blob);
+        uint32_t n= r.get32();
+        while (n--) {
+            areainfo bi;
+            bi.blocksize= r.get32();
+            bi.fileoffset= r.get64();
+            bi.firstblock= r.get32();
+            bi.tag= r.get32();
+            bi.usedblocks= r.get64();
+            bi.nblocks= r.get64();
+            registerarea(bi);
+        }
+        return true;
+    }
+    void saveindex(const std::string& idxname)
+    {
+        std::vector<uint8_t> blob;
+        indexwriter w(blob);
+        w.put32(uint32_t(_filemap.size()));
+        for (const areainfo& bi : _filemap) {
+            w.put32(bi.blocksize);
+            w.put64(bi.fileoffset);
+            w.put32(bi.firstblock);
+            w.put32(bi.tag);
+            w.put64(bi.usedblocks);
+            w.put64(bi.nblocks);
+        }
+        if (!idxname.empty())
+            g_index.store(idxname, blob);
+    }
+    // 'readerpath' names this reader in the image, see readercollection::path,
+    // the scan results are only kept in the index when it is set.
+    FFFBFFFDReader(ReadWriter_ptr rw, uint32_t blocksize, const std::string& readerpath= "")
         : _r(rw), _blocksize(blocksize), _pos(0)
     {
         if (_r->isreadonly()) setreadonly();
 
         if (g_verbose)
             printf("FFFBFFFD wrapper with blocksize %08x\n", _blocksize);
-        scan_fffbd_blocks();
-        process_partitions();
+        std::string idxname;
+        if (!readerpath.empty())
+            idxname= stringformat("fffbfffd/%s/%x/%llx", readerpath.c_str(), _blocksize, uint64_t(_r->size()));
+        if (!loadindex(idxname)) {
+            scan_fffbd_blocks();
+            process_partitions();
+            saveindex(idxname);
+        }
         if (g_verbose)
             dumpareas();
     }
@@ -948,27 +1389,51 @@ public:
     }
     virtual void write(const uint8_t *p, size_t n)
     {
-        size_t total= 0;
         while (n)
         {
-            size_t want= (size_t)std::min(uint64_t(n), 0x800-_pos%0x800);
-
-            _r->setpos(realpos(_pos));
-//          printf("fffbfffd: vpos=%08x(%x*0800+%x), rpos=%08x(%x*0808+%x), writing %x\n", 
-//                  int(_pos), int(_pos/0x800), int(_pos%0x800),
-//                  int(realpos(_pos)), int(realpos(_pos)/0x808), int(realpos(_pos)%0x808), int(want));
-
-            _r->write(p, want);
+            size_t c0= size_t(_pos%_blocksize);
+            size_t want;
+            if (c0 || n<_blocksize) {
+                // partial block, written in place
+                want= std::min(n, size_t(_blocksize)-c0);
+                _r->setpos(realpos(_pos));
+                _r->write(p, want);
+            }
+            else {
+                want= writeblocks(p, n/_blocksize)*_blocksize;
+            }
 
             _pos += want;
             p += want;
             n -= want;
-            total += want;
+        }
+    }
+    // writes a run of whole blocks from one area as a single write,
+    // with the snr+tag footers interleaved in a staging buffer.
+    // returns the nr of blocks written.
+    size_t writeblocks(const uint8_t *p, size_t nblocks)
+    {
+        uint32_t blocknr= uint32_t(_pos/_blocksize);
+        uint64_t ofs= realpos(_pos);    // checks the area, and allocates upto blocknr
 
-            //if ((_pos%0x800)==0)
-            //   todo: optionally i can write the footer here, so writing will happen more in file position order
-            //         in that case, i would have to write the final footer in the destructor, since we may not yet have reached it.
+        areainfo& bi= _areamap[_areamap.floor(blocknr)];
+        size_t areaend= bi.firstblock+std::max(bi.usedblocks, bi.nblocks);
+        nblocks= std::min(nblocks, areaend-blocknr);
+        nblocks= std::min(nblocks, std::max(size_t(1), size_t(STAGINGSIZE/(_blocksize+8))));
+
+        _staging.resize(nblocks*(_blocksize+8));
+        uint8_t *q= &_staging[0];
+        for (size_t i= 0 ; i<nblocks ; i++) {
+            memcpy(q, p+i*_blocksize, _blocksize);
+            set32le(q+_blocksize, uint32_t(blocknr+i));
+            set32le(q+_blocksize+4, bi.tag);
+            q += _blocksize+8;
         }
+        _r->setpos(ofs);
+        _r->write(&_staging[0], _staging.size());
+
+        bi.usedblocks= std::max(bi.usedblocks, size_t(blocknr+nblocks-bi.firstblock));
+        return nblocks;
     }
     virtual void setpos(uint64_t off)
     {
@@ -984,7 +1449,7 @@ public:
             printf("note: fffbfffd filesize not yet accurately known\n");
             return (_r->size()/(_blocksize+8))*_blocksize;
         }
-        auto lastblock= _areamap.rbegin()->second;
+        const areainfo& lastblock= _areamap.back();
         return ((_r->size()-lastblock.fileoffset)/(_blocksize+8)+lastblock.firstblock)*_blocksize;
     }
     virtual uint64_t getpos() const
@@ -997,19 +1462,34 @@ public:
     }
 
     size_t blocksize() const { return _blocksize; }
+
+    // only ranges within one block are contiguous in the underlying reader.
+    // unlike realpos, this never allocates blocks: unused blocks have no span.
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)
+    {
+        if ((ofs%_blocksize)+size > _blocksize)
+            return NULL;
+        size_t blocknr= size_t(ofs/_blocksize);
+        size_t i= _areamap.floor(blocknr);
+        if (i==areamap_t::npos)
+            return NULL;
+        const areainfo& bi= _areamap[i];
+        if (blocknr>=bi.firstblock+bi.usedblocks)
+            return NULL;
+        return getspan(_r, bi.block2ofs(blocknr)+(ofs%_blocksize), size);
+    }
 private:
     uint64_t realpos(uint64_t pos)
     {
         size_t blocknr= size_t(pos/_blocksize);
 
-        auto i= _areamap.upper_bound(blocknr);
-        if (i==_areamap.begin()) i= _areamap.end(); else i--;
+        size_t i= _areamap.floor(blocknr);
 
-        if (i==_areamap.end()) {
+        if (i==areamap_t::npos) {
             printf("ERROR: searched block %05x in %d areas\n", int(blocknr), int(_areamap.size()));
             throw "fffbfffd areamap empty";
         }
-        areainfo& bi= i->second;
+        areainfo& bi= _areamap[i];
         if ( blocknr>=bi.firstblock+bi.usedblocks) {
             if (bi.usedblocks>=bi.nblocks)
                 throw "ffb area full";
@@ -1027,7 +1507,7 @@ private:
                 _r->write32le(bi.tag);
             }
 
-            bi.usedblocks= blocknr-bi.firstblock;
+            bi.usedblocks= blocknr-bi.firstblock+1;
         }
 
         return bi.block2ofs(blocknr)+(pos%_blocksize);
@@ -1332,10 +1812,62 @@ public:
             throw sslerror("RSA_sign");
     }
 };
-// todo: decode, with or without rsa sig checking
+// checks signatures with a public key, or with the key from a certificate.
+class rsaverifier {
+    RSA *_rsa;
+public:
+    rsaverifier(const std::string& filename)
+        : _rsa(NULL)
+    {
+        FILE *f= fopen(filename.c_str(), "r");
+        if (f==NULL)
+            throw stringformat("can't open %s", filename.c_str());
+        _rsa= PEM_read_RSA_PUBKEY(f, NULL, 0, 0);
+        if (_rsa==NULL) {
+            rewind(f);
+            _rsa= PEM_read_RSAPublicKey(f, NULL, 0, 0);
+        }
+        if (_rsa==NULL) {
+            rewind(f);
+            X509 *cert= PEM_read_X509(f, NULL, 0, 0);
+            if (cert) {
+                EVP_PKEY *key= X509_get_pubkey(cert);
+                if (key) {
+                    _rsa= EVP_PKEY_get1_RSA(key);
+                    EVP_PKEY_free(key);
+                }
+                X509_free(cert);
+            }
+        }
+        if (_rsa==NULL) {
+            // a private key file also contains the public key
+            rewind(f);
+            _rsa= PEM_read_RSAPrivateKey(f, NULL, 0, 0);
+        }
+        fclose(f);
+        if (_rsa==NULL)
+            throw rsasigner::sslerror("PEM_read_RSA_PUBKEY");
+    }
+    ~rsaverifier()
+    {
+        if (_rsa)
+            RSA_free(_rsa);
+    }
+    size_t signaturesize()
+    {
+        return RSA_size(_rsa);
+    }
+    bool verify(const uint8_t *p, size_t n, const uint8_t*signature)
+    {
+        ByteVector decoded(RSA_size(_rsa));
+        int len= RSA_public_decrypt(RSA_size(_rsa), signature, &decoded[0], _rsa, RSA_PKCS1_PADDING);
+        return len==int(n) && memcmp(&decoded[0], p, n)==0;
+    }
+};
+// todo: decode
 // todo: encode: keep track of changed blocks, when closing
 // recalc only those the block signatures
-class NbhReadWriter : public ReadWriter {
+class NbhReadWriter : public ReadWriter, public SpanSource {
     ReadWriter_ptr _r;
     struct blockinfo {
         blockinfo() : ix(0), fileoffset(0), datasize(0), sigsize(0), flag(0), modified(false) { }
@@ -1363,7 +1895,7 @@ class NbhReadWriter : public ReadWriter {
         size_t headersize() const { return 9; }
         size_t physicalsize() const { return headersize() + datasize + sigsize; }
     };
-    typedef std::map<uint64_t,blockinfo> blockmap_t;
+    typedef blocktable<uint64_t,blockinfo> blockmap_t;
     blockmap_t _blocks;
 
     uint64_t _logicalpos;
@@ -1398,44 +1930,110 @@ public:
             return;
         }
         rsasigner rsa(_keyfile);
-        std::for_each(_blocks.begin(), _blocks.end(), [this,&rsa](blockmap_t::value_type& item)
-            {
-                blockinfo& bi= item.second;
-                if (!_resign && !bi.modified)
-                    return;
-                if (rsa.signaturesize()!=bi.sigsize)
-                    throw "keyfile has different keysize than nbh";
-
-                SHA_CTX sha1;
-                SHA1_Init(&sha1);
-                if (bi.datasize) {
-                    ByteVector datablock(bi.datasize);
-                    _r->setpos(bi.fileoffset+9);
-                    _r->read(&datablock[0], datablock.size());
-                    SHA1_Update(&sha1, &datablock[0], datablock.size());
-                }
 
-                ByteVector zeros(12);
-                SHA1_Update(&sha1, &zeros[0], zeros.size());
-                SHA1_Update(&sha1, &bi.flag, 1);
-                SHA1_Update(&sha1, &_guid[0], _guid.size());
-                ByteVector seqnr(4);
-                set32le(&seqnr[0], bi.ix);
-                SHA1_Update(&sha1, &seqnr[0], seqnr.size());
+        std::vector<blockinfo*> tosign;
+        for (blockinfo& bi : _blocks) {
+            if (!_resign && !bi.modified)
+                continue;
+            if (rsa.signaturesize()!=bi.sigsize)
+                throw "keyfile has different keysize than nbh";
+            tosign.push_back(&bi);
+        }
+
+        // hash + sign on the worker pool, then write the signatures back in block order
+        std::vector<ByteVector> signatures(tosign.size());
+        threadpool pool(g_threads);
+        for (size_t i= 0 ; i<tosign.size() ; i++)
+            pool.add([this, &rsa, &tosign, &signatures, i]() {
+                uint8_t hash[SHA_DIGEST_LENGTH];
+                blockhash(*tosign[i], hash);
+                signatures[i].resize(tosign[i]->sigsize);
+                rsa.sign(hash, sizeof(hash), &signatures[i][0]);
+            });
+        pool.wait();
+
+        for (size_t i= 0 ; i<tosign.size() ; i++) {
+            blockinfo& bi= *tosign[i];
+            _r->setpos(bi.fileoffset+bi.headersize()+bi.datasize);
+            _r->write(&signatures[i][0], signatures[i].size());
 
-                ByteVector hash(SHA_DIGEST_LENGTH);
-                SHA1_Final(&hash[0], &sha1);
+            bi.modified= false;
+        }
+    }
+    // checks all block signatures, using the -j N worker pool.
+    // returns the index of the first bad block, or -1 when all are ok.
+    int verify(const std::string& keyfile)
+    {
+        rsaverifier rsa(keyfile);
 
-                ByteVector signature(bi.sigsize);
-                rsa.sign(&hash[0], hash.size(), &signature[0]);
+        std::vector<const blockinfo*> blocks;
+        for (const blockinfo& bi : _blocks)
+            blocks.push_back(&bi);
 
-                _r->setpos(bi.fileoffset+9+bi.datasize);
-                _r->write(&signature[0], signature.size());
+        std::vector<uint8_t> ok(blocks.size());
+        threadpool pool(g_threads);
+        for (size_t i= 0 ; i<blocks.size() ; i++)
+            pool.add([this, &rsa, &blocks, &ok, i]() {
+                const blockinfo& bi= *blocks[i];
+                if (bi.sigsize!=rsa.signaturesize()) {
+                    ok[i]= false;
+                    return;
+                }
+                uint8_t hash[SHA_DIGEST_LENGTH];
+                blockhash(bi, hash);
+
+                uint64_t ofs= bi.fileoffset+bi.headersize()+bi.datasize;
+                const uint8_t *sig= getspan(_r, ofs, bi.sigsize);
+                ByteVector sigbuf;
+                if (!sig) {
+                    sigbuf.resize(bi.sigsize);
+                    std::lock_guard<std::mutex> lock(g_imagelock);
+                    _r->setpos(ofs);
+                    _r->read(&sigbuf[0], sigbuf.size());
+                    sig= &sigbuf[0];
+                }
+                ok[i]= rsa.verify(hash, sizeof(hash), sig);
+            });
+        pool.wait();
 
-                bi.modified= false;
+        for (size_t i= 0 ; i<blocks.size() ; i++)
+            if (!ok[i])
+                return blocks[i]->ix;
+        return -1;
+    }
+    size_t blockcount() const { return _blocks.size(); }
+private:
+    // the hash is fed directly from the mapped image when possible.
+    void blockhash(const blockinfo& bi, uint8_t hash[SHA_DIGEST_LENGTH])
+    {
+        std::unique_ptr<EVP_MD_CTX, void(*)(EVP_MD_CTX*)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+        if (!ctx || !EVP_DigestInit_ex(ctx.get(), EVP_sha1(), NULL))
+            throw rsasigner::sslerror("EVP_DigestInit");
+        if (bi.datasize) {
+            uint64_t ofs= bi.fileoffset+bi.headersize();
+            const uint8_t *p= getspan(_r, ofs, bi.datasize);
+            ByteVector datablock;
+            if (!p) {
+                datablock.resize(bi.datasize);
+                std::lock_guard<std::mutex> lock(g_imagelock);
+                _r->setpos(ofs);
+                _r->read(&datablock[0], datablock.size());
+                p= &datablock[0];
             }
-        );
+            EVP_DigestUpdate(ctx.get(), p, bi.datasize);
+        }
+
+        uint8_t trailer[12+1+16+4];
+        memset(trailer, 0, 12);
+        trailer[12]= bi.flag;
+        memcpy(trailer+13, &_guid[0], _guid.size());
+        set32le(trailer+29, bi.ix);
+        EVP_DigestUpdate(ctx.get(), trailer, sizeof(trailer));
+
+        if (!EVP_DigestFinal_ex(ctx.get(), hash, NULL))
+            throw rsasigner::sslerror("EVP_DigestFinal");
     }
+public:
     void scanfile()
     {
         typedef std::map<uint32_t,int> i32map_t;
@@ -1461,7 +2059,7 @@ public:
                 ss_stats[blk.sigsize]++;
             }
 
-            _blocks[logicalpos]= blk;
+            _blocks.set(logicalpos, blk);
 
             filepos+= blk.physicalsize();
             logicalpos+= blk.datasize;
@@ -1488,13 +2086,11 @@ public:
     }
     blockinfo& findblock(uint64_t logpos)
     {
-        auto i= _blocks.upper_bound(logpos);
-        if (i==_blocks.begin()) i= _blocks.end(); else i--;
-
-        if (i==_blocks.end()) {
+        size_t i= _blocks.floor(logpos);
+        if (i==blockmap_t::npos) {
             throw "nbh blockmap empty";
         }
-        blockinfo& bi= i->second;
+        blockinfo& bi= _blocks[i];
         if (bi.datasize && (logpos < bi.logicaloffset || logpos >= bi.logicaloffset+bi.datasize))
         {
             printf("ERROR: in L[%08llx-%08llx] F[%08llx-%08llx] :  found %08llx\n",
@@ -1505,6 +2101,14 @@ public:
         }
         return bi;
     }
+    // only ranges within one nbh block are contiguous in the underlying reader
+    virtual const uint8_t* span(uint64_t ofs, uint64_t size)
+    {
+        blockinfo& bi= findblock(ofs);
+        if (size > bi.remaining(ofs))
+            return NULL;
+        return getspan(_r, bi.logical2file(ofs), size);
+    }
     virtual size_t read(uint8_t *p, size_t n)
     {
         size_t total= 0;
@@ -1566,7 +2170,7 @@ public:
         if (_blocks.empty()) 
             return 0;
 
-        return _blocks.rbegin()->second.logicaloffset;
+        return _blocks.back().logicaloffset;
     }
     virtual uint64_t getpos() const
     {
@@ -2671,9 +3275,101 @@ public:
 
     typedef std::function<void(const std::string& romname)> namefn;
     virtual void filename_enumerator(namefn fn)= 0;
+
+    // true when extractfile may be called from several threads at once
+    virtual bool parallel_extract() const { return false; }
+
+    // returns a reader for the file contents, or an empty ptr when not supported
+    virtual ReadWriter_ptr openfile(const std::string&romname) { return ReadWriter_ptr(); }
 };
 typedef std::shared_ptr<FileContainer> FileContainer_ptr;
 
+typedef std::shared_ptr<const ByteVector> ConstByteVector_ptr;
+
+// size bounded LRU cache of decompressed chunks, keyed by chunk offset.
+// can be used from several threads.
+class chunkcache {
+    typedef std::pair<uint32_t,ConstByteVector_ptr> entry_t;
+    typedef std::list<entry_t> lrulist_t;
+    lrulist_t _lru;     // most recently used at the front
+    typedef std::map<uint32_t,lrulist_t::iterator> index_t;
+    index_t _index;
+
+    size_t _maxbytes;
+    size_t _bytes;
+
+    uint64_t _hits;
+    uint64_t _misses;
+    uint64_t _evictions;
+
+    std::mutex _lock;
+public:
+    explicit chunkcache(size_t maxbytes)
+        : _maxbytes(maxbytes), _bytes(0), _hits(0), _misses(0), _evictions(0)
+    {
+    }
+
+    // returns an empty ptr when not cached
+    ConstByteVector_ptr find(uint32_t ofs)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto i= _index.find(ofs);
+        if (i==_index.end()) {
+            _misses++;
+            return ConstByteVector_ptr();
+        }
+        _hits++;
+        _lru.splice(_lru.begin(), _lru, i->second);
+        return i->second->second;
+    }
+    // checks presence, without updating the lru order or statistics
+    bool contains(uint32_t ofs)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        return _index.find(ofs)!=_index.end();
+    }
+    void insert(uint32_t ofs, ConstByteVector_ptr data)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        invalidaterange(ofs, 1);
+
+        _lru.push_front(entry_t(ofs, data));
+        _index[ofs]= _lru.begin();
+        _bytes += data->size();
+
+        // always keep the entry just inserted
+        while (_bytes>_maxbytes && _lru.size()>1) {
+            _bytes -= _lru.back().second->size();
+            _index.erase(_lru.back().first);
+            _lru.pop_back();
+            _evictions++;
+        }
+    }
+    // drop all chunks starting in the range [ofs, ofs+size)
+    void invalidate(uint64_t ofs, uint64_t size)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        invalidaterange(ofs, size);
+    }
+private:
+    void invalidaterange(uint64_t ofs, uint64_t size)
+    {
+        auto i= _index.lower_bound(ofs);
+        while (i!=_index.end() && i->first < ofs+size) {
+            _bytes -= i->second->second->size();
+            _lru.erase(i->second);
+            i= _index.erase(i);
+        }
+    }
+public:
+    std::string statistics() const
+    {
+        return stringformat("%lld hits, %lld misses, %lld evictions, %d chunks cached",
+                _hits, _misses, _evictions, (int)_lru.size());
+    }
+    bool used() const { return _hits || _misses; }
+};
+
 class ImgfsFile : public FileContainer {
     ReadWriter_ptr _rd;
 
@@ -2799,23 +3495,16 @@ public:
                     size_t blockpos= _pos-a.fileofs;
                     size_t want= std::min(a.fullsize-blockpos, n-total);
 
-                    ByteVector compdata(a.compsize);
-                    _imgfs.rd()->setpos(a.dataofs);
-                    _imgfs.rd()->read(&compdata[0], compdata.size());
-                    ByteVector fulldata(a.fullsize);
-
-                    if (a.compsize<a.fullsize) {
-                        _imgfs.decompress(&compdata[0], a.compsize, &fulldata[0], a.fullsize);
-                    }
-                    else if (a.compsize==a.fullsize) {
-                        std::copy(&compdata[0], &compdata[a.compsize], &fulldata[0]);
+                    // uncompressed chunks are copied straight from the mapped image
+                    const uint8_t *raw= a.compsize==a.fullsize ? getspan(_imgfs.rd(), a.dataofs, a.compsize) : NULL;
+                    if (raw) {
+                        std::copy(raw+blockpos, raw+blockpos+want, p);
                     }
                     else {
-                        printf("ERROR: @%08x, comp=%08x, full=%08x\n", a.dataofs, int(a.compsize), int(a.fullsize));
-                        throw "index error: fullsize < compsize";
-                    }
+                        ConstByteVector_ptr fulldata= _imgfs.loadchunk(a.dataofs, a.compsize, a.fullsize);
 
-                    std::copy(&fulldata[blockpos], &fulldata[blockpos+want], p);
+                        std::copy(&(*fulldata)[blockpos], &(*fulldata)[blockpos+want], p);
+                    }
 
                     total += want;
                     p += want;
@@ -2906,17 +3595,43 @@ public:
 
 
 
+        // one entry of the data index, by position in the file
+        struct indexentry {
+            uint16_t compsize;
+            uint16_t fullsize;
+            uint32_t ptr;
+            bool freed;         // set by fromstream when the chunk was released
+        };
+        typedef std::vector<indexentry> indexlist_t;
+
+        void readindex(ImgfsFile& imgfs, indexlist_t& index)
+        {
+            index.clear();
+            if (_indexptr==0 || _indexsize==0)
+                return;
+            ByteVector buf;
+            const uint8_t *ixblock= imgfs.readspan(_indexptr, _indexsize, buf);
+            for (const uint8_t *i= ixblock ; i+8<=ixblock+_indexsize ; i+=8)
+            {
+                indexentry e;
+                e.compsize= get16le(i);
+                e.fullsize= get16le(i+2);
+                e.ptr= get32le(i+4);
+                e.freed= false;
+                index.push_back(e);
+            }
+        }
+
         template<typename datablockfn>
         void datatable_enumerator(ImgfsFile& imgfs, datablockfn fn)
         {
             if (_indexptr==0 || _indexsize==0)
                 return;
-            ByteVector ixblock(_indexsize);
-            imgfs.rd()->setpos(_indexptr);
-            imgfs.rd()->read(&ixblock[0], ixblock.size());
+            ByteVector buf;
+            const uint8_t *ixblock= imgfs.readspan(_indexptr, _indexsize, buf);
 
             uint32_t total= 0;
-            for (ByteVector::iterator i= ixblock.begin() ; i+8<=ixblock.end() ; )
+            for (const uint8_t *i= ixblock ; i+8<=ixblock+_indexsize ; )
             {
                 uint16_t compsize=get16le(i); i+=2;
                 uint16_t fullsize=get16le(i); i+=2;
@@ -2930,12 +3645,20 @@ public:
                 printf("WARNING: %08llx[%08x] : indextotal= %08x, ent.size=%08x\n", _ofs, _magic, total, _size);
         }
 
-        void deletedirent(ImgfsFile& imgfs)
+        // when 'index' is passed, the data chunks listed there are freed, instead of those in the image.
+        void deletedirent(ImgfsFile& imgfs, const indexlist_t* index= NULL)
         {
-            datatable_enumerator(imgfs, [&imgfs](uint64_t ofs, size_t compsize, size_t /*fullsize*/) {
-                    imgfs.freechunk(ofs, compsize);
-                }
-            );
+            if (index) {
+                for (auto const& e : *index)
+                    if (e.compsize && e.fullsize && e.ptr)
+                        imgfs.freechunk(e.ptr, e.compsize);
+            }
+            else {
+                datatable_enumerator(imgfs, [&imgfs](uint64_t ofs, size_t compsize, size_t /*fullsize*/) {
+                        imgfs.freechunk(ofs, compsize);
+                    }
+                );
+            }
             if (_indexptr)
                 imgfs.freechunk(_indexptr, _indexsize);
 
@@ -2944,18 +3667,17 @@ public:
         void savedirent(ImgfsFile& imgfs, ReadWriter_ptr w)
         {
             datatable_enumerator(imgfs, [&imgfs, w](uint64_t ofs, size_t compsize, size_t fullsize) {
-                    ByteVector compdata(compsize);
-                    imgfs.rd()->setpos(ofs);
-                    imgfs.rd()->read(&compdata[0], compsize);
+                    ByteVector buf;
+                    const uint8_t *compdata= imgfs.readspan(ofs, compsize, buf);
 
                     if (fullsize>compsize) {
                         ByteVector fulldata(fullsize);
-                        imgfs.decompress(&compdata[0], compsize, &fulldata[0], fullsize);
+                        imgfs.decompress(compdata, compsize, &fulldata[0], fullsize);
                         w->write(&fulldata[0], fullsize);
                     }
                     else if (fullsize==compsize) {
                         // compsize == fullsize -> not compressed
-                        w->write(&compdata[0], compsize);
+                        w->write(compdata, compsize);
                     }
                     else {
                         printf("ERROR: @%08llx, comp=%08x, full=%08x\n", ofs, int(compsize), int(fullsize));
@@ -3150,12 +3872,12 @@ public:
             if (_name.empty()) {
                 if (_flags&2) {
                     ByteVector entdata(imgfs.direntsize());
-                    imgfs.rd()->setpos(_ptr);
-                    imgfs.rd()->read(&entdata[0], entdata.size());
+                    imgfs.readat(_ptr, &entdata[0], entdata.size());
                     NameEntry ent(_ptr, &entdata[0], _length);
                     _name= ent.name();
                 }
                 else {
+                    std::lock_guard<std::mutex> lock(g_imagelock);
                     imgfs.rd()->setpos(_ptr);
 
                     std::Wstring wstr;
@@ -3339,59 +4061,170 @@ public:
             while (ofs)
             {
                 ByteVector entdat(imgfs.direntsize());
-                imgfs.rd()->setpos(ofs);
-                imgfs.rd()->read(&entdat[0], entdat.size());
+                imgfs.readat(ofs, &entdat[0], entdat.size());
                 SectionEntry_ptr ent(new SectionEntry(ofs, &entdat[0]));
 
                 fn(ent);
                 ofs= ent->nextsection();
             }
         }
+        // one 4k block of file data, on its way from the reader to the image
+        struct pendingchunk {
+            ByteVector fulldata;
+            ByteVector compdata;
+            size_t fullsize;
+            size_t compsize;
+            const indexentry *reuse;    // unchanged chunk of the replaced file
+        };
         void fromstream(ImgfsFile& imgfs, ReadWriter_ptr r)
+        {
+            indexlist_t noindex;
+            fromstream(imgfs, r, noindex);
+        }
+        // the data is processed in windows of blocks:
+        //   read a window, compress all blocks on the compression pool,
+        //   then allocate and write the chunks in file order.
+        // so the chunk layout and the index are the same as with a single thread.
+        //
+        // 'oldindex' is the index of the file being replaced: blocks with the same contents
+        // as the old chunk at the same position keep that chunk, and are not compressed again.
+        // the other old chunks are freed before the new chunks are allocated, so replacing
+        // a file does not need room for both.
+        // the ptr of reused and freed entries is cleared, freed entries are marked as such.
+        void fromstream(ImgfsFile& imgfs, ReadWriter_ptr r, indexlist_t& oldindex)
         {
             //printf("fromstream\n");
+            threadpool& pool= imgfs.compresspool();
+            std::vector<pendingchunk> window(pool.size()*8);
+
             ByteVector indexdata;
-            ByteVector buf(4096);
             uint64_t ofs=0;
-            while (true)
+            size_t blocknr= 0;
+            size_t nreused= 0;
+            size_t nshared= 0;
+            bool eof= false;
+            while (!eof)
             {
-                size_t fullsize= r->read(&buf[0], buf.size());
-                if (fullsize>=0x10000)
-                    throw "uncompressed data way too large (>=64k)";
-
-                ByteVector compdata(4096);
-                size_t compsize= imgfs.compress(&buf[0], fullsize, &compdata[0]);
-                if (compsize==size_t(-1)) {
-                    compsize= fullsize;
-                    std::copy(&buf[0], &buf[fullsize], &compdata[0]);
+                size_t n= 0;
+                while (n<window.size() && !eof) {
+                    pendingchunk& c= window[n++];
+                    eof= readchunk(r, c);
+
+                    if (blocknr<oldindex.size()) {
+                        const indexentry& e= oldindex[blocknr];
+                        if (e.ptr && e.compsize && e.fullsize==c.fullsize)
+                            c.reuse= &e;
+                    }
+                    blocknr++;
                 }
-                else if (compsize>=0x10000) {
-                    throw "compressed data way too large (>=64k)";
+
+                for (size_t i=0 ; i<n ; i++) {
+                    pendingchunk *c= &window[i];
+                    pool.add([&imgfs,c]() { compresschunk(imgfs, *c); });
+                }
+                pool.wait();
+
+                for (size_t i=0 ; i<n ; i++) {
+                    pendingchunk& c= window[i];
+                    size_t oldix= blocknr-n+i;
+                    if (!c.reuse && oldix<oldindex.size())
+                        freeoldchunk(imgfs, oldindex[oldix]);
+                    if (c.reuse) {
+                        indexdata.resize(indexdata.size()+8);
+                        uint8_t *pidx= &indexdata.back()-7;
+                        set16le(pidx+0, c.reuse->compsize);
+                        set16le(pidx+2, c.reuse->fullsize);
+                        set32le(pidx+4, c.reuse->ptr);
+                        // keep this chunk, when the old file is deleted
+                        const_cast<indexentry*>(c.reuse)->ptr= 0;
+                        nreused++;
+                    }
+                    else if (commitchunk(imgfs, c, indexdata)) {
+                        nshared++;
+                    }
+                    ofs += c.fullsize;
                 }
+            }
+            if (g_verbose && !oldindex.empty())
+                printf("kept %d of %d chunks of the replaced file\n", int(nreused), int(blocknr));
+            if (g_verbose && nshared)
+                printf("shared %d of %d chunks with other files\n", int(nshared), int(blocknr));
+            // the replaced file was longer
+            for (size_t i= blocknr ; i<oldindex.size() ; i++)
+                freeoldchunk(imgfs, oldindex[i]);
+
+            commitindex(imgfs, ofs, indexdata);
+        }
+
+        // the steps of fromstream, also used by ImgfsFile::addfiles.
+
+        // reads the next block from 'r', returns true at the end of the data
+        static bool readchunk(ReadWriter_ptr r, pendingchunk& c)
+        {
+            c.fulldata.resize(4096);
+            c.fullsize= r->read(&c.fulldata[0], c.fulldata.size());
+            if (c.fullsize>=0x10000)
+                throw "uncompressed data way too large (>=64k)";
+            c.reuse= NULL;
+            return c.fullsize<c.fulldata.size();
+        }
+        // runs on the compression pool.
+        // a reused chunk is kept when unchanged, otherwise the block is compressed.
+        static void compresschunk(ImgfsFile& imgfs, pendingchunk& c)
+        {
+            if (c.reuse) {
+                ConstByteVector_ptr olddata= imgfs.loadchunk(c.reuse->ptr, c.reuse->compsize, c.reuse->fullsize);
+                if (std::equal(olddata->begin(), olddata->end(), c.fulldata.begin()))
+                    return;
+                c.reuse= NULL;
+            }
+            // note: the nul bytes past compsize are used as padding
+            c.compdata.assign(4096, 0);
+            c.compsize= imgfs.compress(&c.fulldata[0], c.fullsize, &c.compdata[0]);
+            if (c.compsize==size_t(-1)) {
+                c.compsize= c.fullsize;
+                std::copy(&c.fulldata[0], &c.fulldata[c.fullsize], &c.compdata[0]);
+            }
+        }
+        // allocates and writes a compressed block, and adds it to 'indexdata'.
+        // returns true when an identical chunk was shared.
+        static bool commitchunk(ImgfsFile& imgfs, const pendingchunk& c, ByteVector& indexdata)
+        {
+            if (c.compsize>=0x10000)
+                throw "compressed data way too large (>=64k)";
 
-                size_t allocsize= imgfs.roundtochunk(compsize);
-                uint32_t chunkofs= imgfs.allocchunk(allocsize, FILEDATACHUNK);
+            uint32_t chunkofs= 0;
+            if (g_dedup && c.compsize)
+                chunkofs= imgfs.sharechunk(&c.compdata[0], c.compsize, c.fullsize);
+            bool shared= chunkofs!=0;
+            if (!shared) {
+                size_t allocsize= imgfs.roundtochunk(c.compsize);
+                chunkofs= imgfs.allocchunk(allocsize, FILEDATACHUNK);
 
                 imgfs.rd()->setpos(chunkofs);
 
                 // note: allocsize can be > compsize, but will be <= compdata.size()
                 // taking advantage of the empty space left in compdata to auto pad
                 // with nul
-                imgfs.rd()->write(&compdata[0], allocsize);
+                imgfs.rd()->write(&c.compdata[0], allocsize);
 
-                indexdata.resize(indexdata.size()+8);
-                uint8_t *pidx= &indexdata.back()-7;
-                set16le(pidx+0, uint16_t(compsize));
-                set16le(pidx+2, uint16_t(fullsize));
-                set32le(pidx+4, chunkofs);
-
-                ofs += fullsize;
-                if (fullsize<buf.size())
-                    break;
+                if (g_dedup && c.compsize)
+                    imgfs.registerchunk(chunkofs, &c.compdata[0], c.compsize, c.fullsize);
             }
-            if (ofs>>32)
+
+            indexdata.resize(indexdata.size()+8);
+            uint8_t *pidx= &indexdata.back()-7;
+            set16le(pidx+0, uint16_t(c.compsize));
+            set16le(pidx+2, uint16_t(c.fullsize));
+            set32le(pidx+4, chunkofs);
+            return shared;
+        }
+        // writes the index, after all data of the file was committed
+        void commitindex(ImgfsFile& imgfs, uint64_t size, ByteVector& indexdata)
+        {
+            if (size>>32)
                 throw "fileentry data > 4G";
-            _size= uint32_t(ofs);
+            _size= uint32_t(size);
             _indexsize= imgfs.roundtochunk(indexdata.size());
             _indexptr= imgfs.allocchunk(_indexsize, FILEINDEXCHUNK);
             imgfs.rd()->setpos(_indexptr);
@@ -3399,6 +4232,14 @@ public:
             indexdata.resize(_indexsize);
             imgfs.rd()->write(&indexdata[0], _indexsize);
         }
+        static void freeoldchunk(ImgfsFile& imgfs, indexentry& e)
+        {
+            if (e.compsize && e.fullsize && e.ptr) {
+                imgfs.freechunk(e.ptr, e.compsize);
+                e.ptr= 0;
+                e.freed= true;
+            }
+        }
         void tostream(ImgfsFile& imgfs, ReadWriter_ptr w)
         {
             if (_sectionlist)
@@ -3406,7 +4247,7 @@ public:
             else
                 savedirent(imgfs, w);
         }
-        void deletefile(ImgfsFile& imgfs)
+        void deletefile(ImgfsFile& imgfs, const indexlist_t* index= NULL)
         {
             section_enumerator(imgfs,
                 // todo: why is a [imgfs] capture -> const, and [&imgfs] not const ?
@@ -3415,8 +4256,9 @@ public:
                 }
             );
             _name.deletename(imgfs);
-            deletedirent(imgfs);
+            deletedirent(imgfs, index);
         }
+        bool hassections() const { return _sectionlist!=0; }
 
         void listentry(ImgfsFile& imgfs)
         {
@@ -3527,11 +4369,32 @@ public:
     typedef std::vector<chunktype_t> chunkmap_t;
     chunkmap_t _chunkmap;
 
+    // index of the FREECHUNK runs in _chunkmap, kept up to date by markchunk
+    freerunmap _freechunks;
+
+    // data chunks used by more than one index entry, written with -dedup.
+    // maps chunkofs => number of extra references, freechunk drops a reference
+    // as long as there are any, and only then frees the chunk.
+    typedef std::map<uint32_t,unsigned> sharedchunkmap_t;
+    sharedchunkmap_t _sharedchunks;
+
+    // content index of the file data chunks, for -dedup.
+    // maps sha1+sizes of the stored chunk => chunkofs, built on first use.
+    typedef std::map<std::string,uint32_t> chunkhashmap_t;
+    chunkhashmap_t _chunkhashes;
+    std::map<uint32_t,std::string> _chunkhashofs;
+    bool _chunkhashesbuilt;
+
     // keeps track of what direntries are used for.
     // indexed by direntryid ( = offset/entsize )
     typedef std::vector<entrytype_t> entrymap_t;
     entrymap_t _entrymap;
 
+    // bitmap of the FREEENTRY items in _entrymap, kept up to date by markent.
+    // all words before _firstfreeword are known to be zero.
+    std::vector<uint64_t> _freeentbits;
+    size_t _firstfreeword;
+
     // fileblocknr = offset_of_dir_entry / blocksize
     // dirblocknr = direntrynr / entriesperblock
     //
@@ -3550,6 +4413,10 @@ public:
     bool _broken;
     int _cputype;
 
+    // decompressed data chunks, shared by all DirEntryReaders
+    enum { CHUNKCACHE_SIZE= 0x400000 };
+    chunkcache _cache;
+
     enum {
         IMGFSCOMPRESS_XPR= 0x525058,
         IMGFSCOMPRESS_LZX= 0x585a4c,
@@ -3574,12 +4441,22 @@ public:
     }
 #endif
 
-    ImgfsFile(ReadWriter_ptr rd)
-        : _rd(rd), _hdr(rd), _broken(false), _cputype(IMAGE_FILE_MACHINE_ARM)
+    // 'readerpath' names the reader in the image, see readercollection::path,
+    // the scan results are only kept in the index when it is set.
+    ImgfsFile(ReadWriter_ptr rd, const std::string& readerpath= "")
+        : _rd(rd), _hdr(rd), _chunkhashesbuilt(false), _firstfreeword(0), _broken(false), _cputype(IMAGE_FILE_MACHINE_ARM), _cache(CHUNKCACHE_SIZE)
     {
         if (_hdr.compressiontype!=IMGFSCOMPRESS_XPR && _hdr.compressiontype!=IMGFSCOMPRESS_LZX && _hdr.compressiontype!=IMGFSCOMPRESS_XPH)
             throw stringformat("unsupported compression: %08x", _hdr.compressiontype);
 
+        _freechunks.setblocksize(_hdr.chunksperblock);
+
+        std::string idxname;
+        if (!readerpath.empty())
+            idxname= stringformat("imgfs/%s/%llx", readerpath.c_str(), uint64_t(_rd->size()));
+        if (loadindex(idxname))
+            return;
+
         markchunk(0, _hdr.bytesperblock, IMGFSHEADER);
         if (!dirblock_enumerator(
             [&](uint64_t ofs) {
@@ -3593,7 +4470,7 @@ public:
             return;
 
         // initialize entry map
-        _entrymap.resize(_dir2file.size()*_hdr.entriesperblock, FREEENTRY);
+        growentrymap(_dir2file.size()*_hdr.entriesperblock);
 
         direntry_enumerator(
             [&](FileEntry_ptr file) {
@@ -3617,7 +4494,7 @@ public:
                             [t2](uint64_t ofs, size_t size) { t2->markchunk(ofs, size, ImgfsFile::NAMECHUNK); }
                         );
                         section->datatable_enumerator( *t2,
-                            [t2](uint64_t ofs, size_t compsize, size_t /*fullsize*/) { t2->markchunk(ofs, compsize, ImgfsFile::SECTIONDATACHUNK); }
+                            [t2](uint64_t ofs, size_t compsize, size_t /*fullsize*/) { t2->markdatachunk(ofs, compsize, ImgfsFile::SECTIONDATACHUNK); }
                         );
                         if (section->indexblock()) {
                             t2->markchunk(section->indexblock(), section->indexsize(), ImgfsFile::SECTIONINDEXCHUNK);
@@ -3629,13 +4506,102 @@ public:
                     [t1](uint64_t ofs, size_t size) { t1->markchunk(ofs, size, ImgfsFile::NAMECHUNK); }
                 );
                 file->datatable_enumerator( *this,
-                    [t1](uint64_t ofs, size_t compsize, size_t /*fullsize*/) { t1->markchunk(ofs, compsize, ImgfsFile::FILEDATACHUNK); }
+                    [t1](uint64_t ofs, size_t compsize, size_t /*fullsize*/) { t1->markdatachunk(ofs, compsize, ImgfsFile::FILEDATACHUNK); }
                 );
                 if (file->indexblock()) {
                     t1->markchunk(file->indexblock(), file->indexsize(), ImgfsFile::FILEINDEXCHUNK);
                 }
             }
         );
+        saveindex(idxname);
+    }
+
+    // writes a new imgfs image with 'files' ( srcpath, romname ), in one pass:
+    // all dir blocks are allocated up front, after that each file gets its data chunks,
+    // index and name chunk in sequence, see addfiles.
+    // the image is built in memory, and written to 'imgname' with one sequential write.
+    typedef std::vector<std::pair<std::string,std::string> > createlist_t;
+    static void create(const std::string& imgname, const createlist_t& files)
+    {
+        enum { DIRENTSIZE= 0x34, CHUNKSPERBLOCK= 0x20, BYTESPERBLOCK= 0x800, BYTESPERCHUNK= BYTESPERBLOCK/CHUNKSPERBLOCK };
+        const uint64_t entriesperblock= (BYTESPERBLOCK-8)/DIRENTSIZE;
+        auto roundup= [](uint64_t x, uint64_t round) { return (x+round-1)/round*round; };
+
+        // each file needs a dir entry, names of 5..24 characters also a name entry.
+        // the size is an upper bound, assuming no block compresses.
+        uint64_t nentries= 0;
+        uint64_t totalsize= 0;
+        for (auto const& f : files) {
+            struct stat st;
+            if (stat(f.first.c_str(), &st))
+                throw stringformat("create: can't stat %s", f.first.c_str());
+            uint64_t nblocks= uint64_t(st.st_size)/0x1000+1;
+
+            nentries++;
+            if (nameinfo::nametype(f.second.size())==nameinfo::IN_NAME_ENTRY)
+                nentries++;
+            else if (nameinfo::nametype(f.second.size())==nameinfo::IN_NAME_CHUNK)
+                totalsize += roundup(f.second.size()*sizeof(WCHAR), BYTESPERCHUNK);
+            totalsize += nblocks*0x1000 + roundup(nblocks*8, BYTESPERCHUNK);
+        }
+        uint64_t ndirblocks= std::max(uint64_t(1), (nentries+entriesperblock-1)/entriesperblock);
+        totalsize= roundup(totalsize, BYTESPERBLOCK) + (1+ndirblocks)*BYTESPERBLOCK;
+        if (totalsize>>32)
+            throw "create: image too large";
+
+        // the image starts out empty in memory, 'imgname' is only written by commit(),
+        // so a failed -create leaves an existing file alone.
+        ByteVector empty;
+        ReadWriter_ptr base(new ByteVectorReader(empty));
+        std::shared_ptr<OverlayReader> img(new OverlayReader(base, imgname, totalsize));
+
+        ByteVector block(BYTESPERBLOCK, 0xff);
+        const uint8_t imgfsuuid[16]= {
+            0xf8, 0xac, 0x2c, 0x9d, 0xe3, 0xd4, 0x2b, 0x4d, 0xbd, 0x30, 0x91, 0x6e, 0xd8, 0x4f, 0x31, 0xdc
+        };
+        std::copy(imgfsuuid, imgfsuuid+sizeof(imgfsuuid), &block[0]);
+        set32le(&block[0x10], 1);
+        set32le(&block[0x14], 1);
+        set32le(&block[0x18], 1);
+        set32le(&block[0x1c], DIRENTSIZE);
+        set32le(&block[0x20], CHUNKSPERBLOCK);
+        set32le(&block[0x24], BYTESPERBLOCK);
+        set32le(&block[0x28], 0x1000);
+        set32le(&block[0x2c], IMGFSCOMPRESS_XPR);
+        set32le(&block[0x30], 0);
+        set32le(&block[0x34], 0x40);
+        img->setpos(0);
+        img->write(&block[0], block.size());
+
+        // the dir blocks directly follow the header, chained in order
+        for (uint64_t i= 0 ; i<ndirblocks ; i++) {
+            std::fill(block.begin(), block.end(), 0xff);
+            set32le(&block[0], 0x2f5314ce);
+            set32le(&block[4], i+1<ndirblocks ? uint32_t((i+2)*BYTESPERBLOCK) : 0);
+            img->write(&block[0], block.size());
+        }
+
+        uint64_t usedsize;
+        {
+            ImgfsFile imgfs(img);
+            imgfs.addfiles(files);
+            usedsize= imgfs.usedsize();
+        }
+        img->truncate(usedsize);
+        if (!img->commit())
+            throw "create: error writing image";
+        printf("created imgfs %s: %d files, %d dirblocks, 0x%llx bytes\n", imgname.c_str(), int(files.size()), int(ndirblocks), usedsize);
+    }
+    // size up to the last used block
+    uint64_t usedsize() const
+    {
+        return roundsize(uint32_t((_chunkmap.size()-_freechunks.freeatend())*_hdr.bytesperchunk), _hdr.bytesperblock);
+    }
+
+    virtual ~ImgfsFile()
+    {
+        if (g_verbose && _cache.used())
+            printf("imgfs chunkcache: %s\n", _cache.statistics().c_str());
     }
 
     virtual void addfile(const std::string&romname, ReadWriter_ptr r)
@@ -3643,6 +4609,11 @@ public:
         if (_broken)
             throw "can't modify broken imgfs";
 
+        // a replaced plain file is deleted after the new data was written,
+        // so its unchanged chunks can be kept.
+        FileEntry_ptr oldfile;
+        DirEntry::indexlist_t oldindex;
+
         filemap_t::iterator fi= _files.find(romname);
         if (fi!=_files.end())
         {
@@ -3651,7 +4622,11 @@ public:
                 (*fi).second->listentry(*this);
             }
 
-            (*fi).second->deletefile(*this);
+            oldfile= (*fi).second;
+            if (!oldfile->hassections())
+                oldfile->readindex(*this, oldindex);
+            else
+                oldfile->deletefile(*this);
 
             _files.erase(fi);
         }
@@ -3667,8 +4642,104 @@ public:
                 printf("imgfs.add: error setting filetime\n");
             }
         }
-        dstfile->fromstream(*this, r);
+        try {
+            dstfile->fromstream(*this, r, oldindex);
+        }
+        catch(...)
+        {
+            // keep the old file, unless some of its chunks were already released
+            if (oldfile && !oldfile->hassections()) {
+                if (std::none_of(oldindex.begin(), oldindex.end(), [](const DirEntry::indexentry& e) { return e.freed; }))
+                    _files[romname]= oldfile;
+                else
+                    oldfile->deletefile(*this, &oldindex);
+            }
+            throw;
+        }
+        if (oldfile && !oldfile->hassections())
+            oldfile->deletefile(*this, &oldindex);
         dstfile->save(*this);
+
+        _files[romname]= dstfile;
+    }
+    // adds new files ( srcpath, romname ), with the same layout as a series of addfile calls.
+    // the blocks of consecutive files share one window on the compression pool,
+    // so many small files still keep all workers busy.
+    void addfiles(const createlist_t& files)
+    {
+        if (_broken)
+            throw "can't modify broken imgfs";
+
+        // the file each block belongs to, the last block of a file completes it.
+        struct pendingfile {
+            FileEntry_ptr file;
+            ByteVector indexdata;
+            uint64_t size;
+        };
+        std::vector<pendingfile> pending(files.size());
+
+        std::set<std::string,caseinsensitive> names;
+        for (auto const& f : files)
+            if (!names.insert(f.second).second || _files.find(f.second)!=_files.end())
+                throw stringformat("duplicate name %s", f.second.c_str());
+
+        threadpool& pool= compresspool();
+        std::vector<FileEntry::pendingchunk> window(pool.size()*8);
+        std::vector<size_t> owner(window.size());
+        std::vector<bool> last(window.size());
+
+        size_t readix= 0;       // file being read
+        ReadWriter_ptr r;
+        while (readix<files.size())
+        {
+            size_t n= 0;
+            while (n<window.size() && readix<files.size()) {
+                if (!r) {
+                    const std::string& romname= files[readix].second;
+                    if (g_verbose > 1)
+                        printf("adding imgfs:%s from %s\n", romname.c_str(), files[readix].first.c_str());
+                    std::shared_ptr<FileReader> srcfile(new FileReader(files[readix].first, FileReader::readonly));
+                    r= srcfile;
+                    pendingfile& f= pending[readix];
+                    f.file.reset(new FileEntry(romname));
+                    f.size= 0;
+                    try {
+                    f.file->setunixtime(srcfile->getunixtime());
+                    }
+                    catch(...)
+                    {
+                        printf("imgfs.add: error setting filetime\n");
+                    }
+                }
+                owner[n]= readix;
+                last[n]= FileEntry::readchunk(r, window[n]);
+                if (last[n]) {
+                    r.reset();
+                    readix++;
+                }
+                n++;
+            }
+
+            for (size_t i=0 ; i<n ; i++) {
+                FileEntry::pendingchunk *c= &window[i];
+                pool.add([this,c]() { FileEntry::compresschunk(*this, *c); });
+            }
+            pool.wait();
+
+            for (size_t i=0 ; i<n ; i++) {
+                pendingfile& f= pending[owner[i]];
+                FileEntry::commitchunk(*this, window[i], f.indexdata);
+                f.size += window[i].fullsize;
+                if (!last[i])
+                    continue;
+                f.file->commitindex(*this, f.size, f.indexdata);
+                f.file->save(*this);
+                _files[files[owner[i]].second]= f.file;
+
+                f.file.reset();
+                ByteVector().swap(f.indexdata);
+            }
+        }
     }
     virtual void renamefile(const std::string&romname, const std::string&newname)
     {
@@ -3780,6 +4851,15 @@ public:
         }
         return true;
     }
+    // all image reads go through readat or loadchunk
+    virtual bool parallel_extract() const { return true; }
+    virtual ReadWriter_ptr openfile(const std::string&romname)
+    {
+        filemap_t::iterator fi= _files.find(romname);
+        if (fi==_files.end())
+            return ReadWriter_ptr();
+        return (*fi).second->getdatareader(*this);
+    }
     virtual void listfiles()
     {
         for (auto i=_files.begin() ; i!=_files.end() ; i++)
@@ -3837,21 +4917,106 @@ public:
         // iterate over all dir blocks
         for (file2dirmap_t::iterator i= _file2dir.begin() ; i!=_file2dir.end() ; i++)
         {
-            ByteVector dirblock(_hdr.bytesperblock-8);
+            ByteVector buf;
+            size_t blocksize= _hdr.bytesperblock-8;
             uint64_t dirblockoffset= uint64_t((*i).first)*_hdr.bytesperblock+8;
-            _rd->setpos(dirblockoffset);
-            _rd->read(&dirblock[0], dirblock.size());
+            const uint8_t *dirblock= readspan(dirblockoffset, blocksize, buf);
 
             // iterate over entries within block
-            for (unsigned entofs= 0 ; entofs<dirblock.size() ; entofs+=_hdr.direntsize)
+            for (unsigned entofs= 0 ; entofs+_hdr.direntsize<=blocksize ; entofs+=_hdr.direntsize)
             {
-                uint32_t magic= get32le(&dirblock[entofs]);
+                uint32_t magic= get32le(dirblock+entofs);
                 if (magic==0xfffffefe || magic==0xfffff6fe)
-                    fn(FileEntry_ptr(new FileEntry(dirblockoffset+entofs, &dirblock[entofs])));
+                    fn(FileEntry_ptr(new FileEntry(dirblockoffset+entofs, dirblock+entofs)));
             }
         }
     }
 
+    // the chunk map, entry map, dir blocks and file entries are restored from the image index,
+    // instead of walking all dir entries, name chains and data tables.
+    bool loadindex(const std::string& idxname)
+    {
+        if (idxname.empty())
+            return false;
+        auto blob= g_index.find(idxname);
+        if (!blob)
+            return false;
+        indexreader r(*blob);
+
+        size_t n;
+        const uint8_t *p= r.getbytes(n);
+        _chunkmap.assign((const chunktype_t*)p, (const chunktype_t*)p+n);
+        _freechunks.resize(n);
+        for (size_t ix= 0, run= 0 ; ix<=n ; ix++) {
+            if (ix<n && _chunkmap[ix]!=FREECHUNK) {
+                run++;
+            }
+            else if (run) {
+                _freechunks.mark(ix-run, run, false);
+                run= 0;
+            }
+        }
+
+        uint32_t ndirblocks= r.get32();
+        while (ndirblocks--)
+            registerdirblock(uint64_t(r.get32())*_hdr.bytesperblock);
+
+        p= r.getbytes(n);
+        growentrymap(n);
+        for (size_t ix= 0 ; ix<n ; ix++) {
+            _entrymap[ix]= entrytype_t(p[ix]);
+            if (_entrymap[ix]!=FREEENTRY)
+                setentfree(ix, false);
+        }
+
+        uint32_t nfiles= r.get32();
+        while (nfiles--) {
+            uint64_t ofs= r.get64();
+            std::string name= r.getstr();
+            const uint8_t *ent= r.getbytes(n);
+            if (n!=_hdr.direntsize)
+                throw "index: invalid direntry";
+            FileEntry_ptr file(new FileEntry(ofs, ent));
+            file->ni().setname(name);
+            _files.insert(filemap_t::value_type(name, file));
+        }
+
+        uint32_t nshared= r.get32();
+        while (nshared--) {
+            uint32_t ofs= r.get32();
+            _sharedchunks[ofs]= r.get32();
+        }
+        return true;
+    }
+    void saveindex(const std::string& idxname)
+    {
+        if (_broken)
+            return;
+        std::vector<uint8_t> blob;
+        indexwriter w(blob);
+
+        w.putbytes(_chunkmap.data(), _chunkmap.size());
+        w.put32(uint32_t(_dir2file.size()));
+        for (unsigned blocknr : _dir2file)
+            w.put32(blocknr);
+        w.putbytes(_entrymap.data(), _entrymap.size());
+
+        w.put32(uint32_t(_files.size()));
+        for (auto const& f : _files) {
+            ByteVector buf;
+            w.put64(f.second->offset());
+            w.putstr(f.first);
+            w.putbytes(readspan(f.second->offset(), _hdr.direntsize, buf), _hdr.direntsize);
+        }
+
+        w.put32(uint32_t(_sharedchunks.size()));
+        for (auto const& sc : _sharedchunks) {
+            w.put32(sc.first);
+            w.put32(sc.second);
+        }
+        if (!idxname.empty())
+            g_index.store(idxname, blob);
+    }
 private:
     void registerdirblock(uint64_t ofs)
     {
@@ -3869,6 +5034,43 @@ private:
             printf("entry %08llx (%d) is already %c, marking %c\n", ofs, ix, _entrymap[ix], tag);
         }
         _entrymap[ix]= tag;
+        setentfree(ix, tag==FREEENTRY);
+    }
+    void setentfree(size_t ix, bool isfree)
+    {
+        size_t word= ix/64;
+        uint64_t bit= uint64_t(1)<<(ix%64);
+        if (word>=_freeentbits.size())
+            _freeentbits.resize(word+1, 0);
+        if (isfree) {
+            _freeentbits[word] |= bit;
+            _firstfreeword= std::min(_firstfreeword, word);
+        }
+        else {
+            _freeentbits[word] &= ~bit;
+        }
+    }
+    void growentrymap(size_t n)
+    {
+        size_t oldsize= _entrymap.size();
+        _entrymap.resize(n, FREEENTRY);
+        for (size_t ix= oldsize ; ix<n ; ix++)
+            setentfree(ix, true);
+    }
+    // returns the index of the first free entry, or _entrymap.size() when full
+    size_t findfreeent()
+    {
+        while (_firstfreeword<_freeentbits.size() && _freeentbits[_firstfreeword]==0)
+            _firstfreeword++;
+        if (_firstfreeword==_freeentbits.size())
+            return _entrymap.size();
+        uint64_t w= _freeentbits[_firstfreeword];
+        size_t ix= _firstfreeword*64;
+        while ((w&1)==0) {
+            w>>=1;
+            ix++;
+        }
+        return ix;
     }
     void freeent(uint64_t ofs)
     {
@@ -3881,16 +5083,15 @@ private:
     }
     uint64_t allocent(entrytype_t tag)
     {
-        // NOTE: performance warning - linear search
-        entrymap_t::iterator i= std::find(_entrymap.begin(), _entrymap.end(), FREEENTRY);
-        if (i==_entrymap.end()) {
+        size_t ix= findfreeent();
+        if (ix==_entrymap.size()) {
             unsigned prevblockofs= _dir2file.empty() ? 0 : _dir2file.back()*_hdr.bytesperblock;
             uint32_t newdirblockofs= allocdirblock();
 
             if (g_verbose)
                 printf("added new dir block [%08x -> %08x]\n", prevblockofs, newdirblockofs);
             registerdirblock(newdirblockofs);
-            _entrymap.resize(_dir2file.size()*_hdr.entriesperblock, FREEENTRY);
+            growentrymap(_dir2file.size()*_hdr.entriesperblock);
             // link to previous block
             _rd->setpos(prevblockofs);
             _rd->write32le(0x2f5314ce);
@@ -3903,14 +5104,12 @@ private:
             _rd->write(&block[0], block.size());
             //printf("write empty dirblock at %08x\n", newdirblockofs);
 
-            i= _entrymap.end()-_hdr.entriesperblock;
-
             uint64_t ofs= newdirblockofs+8;
             markent(ofs, tag);
             return ofs;
         }
-        uint64_t ofs= index2entryofs(i-_entrymap.begin());
-//        printf("allocent(%c) -> %d : %d : %08llx\n", tag, int(i-_entrymap.begin()), *i, ofs);
+        uint64_t ofs= index2entryofs(ix);
+//        printf("allocent(%c) -> %d : %08llx\n", tag, int(ix), ofs);
         markent(ofs, tag);
 
         return ofs;
@@ -3975,38 +5174,63 @@ private:
             //printf("chunk %08llx+%08x is already: '%s'\n", ofs, size, std::string((const char*)&(*begin), n).c_str());
         }
         std::fill_n(begin, n, type);
+        _freechunks.mark(ix, n, type==FREECHUNK);
+    }
+    // data chunks may already be marked by another index entry, when the image was written with -dedup
+    void markdatachunk(uint64_t ofs, unsigned size, chunktype_t type)
+    {
+        uint64_t ix= ofs/_hdr.bytesperchunk;
+        if (ofs%_hdr.bytesperchunk==0 && ix<_chunkmap.size() && _chunkmap[ix]==type) {
+            _sharedchunks[uint32_t(ofs)]++;
+            return;
+        }
+        markchunk(ofs, size, type);
+    }
+    // add free chunks at the end of the chunkmap
+    void growchunkmap(size_t n)
+    {
+        if (n<=_chunkmap.size())
+            return;
+        _chunkmap.resize(n, FREECHUNK);
+        _freechunks.resize(n);
     }
     // finds block aligned block sized sequence of free chunks
     uint32_t allocdirblock()
     {
-        // BUG: sometimes this leads to an infinite loop
-        //     probably when a FREECHUNK is found at a non-block boundary -> ix%cpb!=0
-        //     -> i=search(i)  -> i again
-
-        chunkmap_t::iterator i= _chunkmap.begin();
-        while (i!=_chunkmap.end()) {
-            i= std::search_n(i, _chunkmap.end(), _hdr.chunksperblock, FREECHUNK);
-            if (i==_chunkmap.end()) {
-                // alloc more space from outer layer ( fffbfffd reader )
-                _chunkmap.resize(_chunkmap.size()+_hdr.chunksperblock, FREECHUNK);
+        uint64_t ix;
+        int64_t blk= _freechunks.findblock();
+        if (blk>=0) {
+            ix= uint64_t(blk)*_hdr.chunksperblock;
+        }
+        else {
+            // alloc more space from outer layer ( fffbfffd reader ),
+            // reusing the free chunks at the end from the first block boundary
+            ix= roundsize(_chunkmap.size()-_freechunks.freeatend(), _hdr.chunksperblock);
+            growchunkmap(ix+_hdr.chunksperblock);
 
-//                printf("added %d chunks for dirblock\n", _hdr.chunksperblock);
-                i= _chunkmap.begin()+_chunkmap.size()-_hdr.chunksperblock;
-            }
-            unsigned ix= i-_chunkmap.begin();
-            if ((ix%_hdr.chunksperblock)==0) {
-                uint64_t ofs= ix*_hdr.bytesperchunk;
-                markchunk(ofs, _hdr.bytesperchunk*_hdr.chunksperblock, DIRCHUNK);
-                if (ofs>>32)
-                    throw "allocdirblock: offset too large";
-                return uint32_t(ofs);
-            }
-            ++i;
+//            printf("added chunks for dirblock at %llx\n", ix);
         }
-        throw "could not alloc dirblock";
+        uint64_t ofs= ix*_hdr.bytesperchunk;
+        if (ofs>>32)
+            throw "allocdirblock: offset too large";
+        markchunk(ofs, _hdr.bytesperchunk*_hdr.chunksperblock, DIRCHUNK);
+        return uint32_t(ofs);
     }
     void freechunk(uint64_t ofs, unsigned size)
     {
+        sharedchunkmap_t::iterator si= _sharedchunks.find(uint32_t(ofs));
+        if (si!=_sharedchunks.end()) {
+            if (--si->second==0)
+                _sharedchunks.erase(si);
+            return;
+        }
+        auto hi= _chunkhashofs.find(uint32_t(ofs));
+        if (hi!=_chunkhashofs.end()) {
+            _chunkhashes.erase(hi->second);
+            _chunkhashofs.erase(hi);
+        }
+
+        _cache.invalidate(ofs, size);
         markchunk(ofs, size, FREECHUNK);
         _rd->setpos(ofs);
         ByteVector data(size, 0xff);
@@ -4022,33 +5246,78 @@ private:
             throw "allocchunk: unaligned size";
 
         unsigned n= size/_hdr.bytesperchunk;
-        chunkmap_t::iterator i= std::search_n(_chunkmap.begin(), _chunkmap.end(), n, FREECHUNK);
-        if (i==_chunkmap.end()) {
+        uint64_t ix;
+        int64_t found= _freechunks.findrun(n);
+        if (found>=0) {
+            ix= uint64_t(found);
+        }
+        else {
             // alloc more space from outer layer ( fffbfffd reader )
-            auto last= std::find_if(_chunkmap.rbegin(), _chunkmap.rend(), [](chunktype_t t){ return t!=ImgfsFile::FREECHUNK; });
-            size_t nfreeatend= last-_chunkmap.rbegin();
-            size_t oldsize= _chunkmap.size();
+            ix= _chunkmap.size()-_freechunks.freeatend();
+            growchunkmap(roundsize(ix+n, _hdr.chunksperblock));
 
-            _chunkmap.resize(roundsize(_chunkmap.size()+n-nfreeatend, _hdr.chunksperblock), FREECHUNK);
-
-//            printf("added %d chunks\n", (int)(_chunkmap.size()-oldsize));
-
-            i= _chunkmap.begin()+oldsize-nfreeatend;
+//            printf("added chunks at %llx\n", ix);
         }
 
-        chunkmap_t::iterator end= i+n;
-        std::string str;
-        std::for_each(i, end, [&str](chunktype_t t){ str += (char)t; });
-
-        unsigned ix= i-_chunkmap.begin();
         uint64_t ofs= ix*_hdr.bytesperchunk;
-        //printf("allocchunk(%08x) ->: %06x:%06x:%08llx '%s'\n", size, int(i-_chunkmap.begin()), ix, ofs, str.c_str());
+        //printf("allocchunk(%08x) ->: %06llx:%08llx\n", size, ix, ofs);
+        _cache.invalidate(ofs, size);
         markchunk(ofs, size, tag);
         if (ofs>>32)
             throw "allocchunk: offset too large";
         return (uint32_t)ofs;
     }
 
+    static std::string chunkkey(const uint8_t *compdata, size_t compsize, size_t fullsize)
+    {
+        uint8_t key[4+SHA_DIGEST_LENGTH];
+        set16le(key, uint16_t(compsize));
+        set16le(key+2, uint16_t(fullsize));
+        SHA1(compdata, compsize, key+4);
+        return std::string((const char*)key, sizeof(key));
+    }
+    void addchunkhash(uint32_t ofs, const uint8_t *compdata, size_t compsize, size_t fullsize)
+    {
+        std::string key= chunkkey(compdata, compsize, fullsize);
+        if (_chunkhashes.insert(chunkhashmap_t::value_type(key, ofs)).second)
+            _chunkhashofs[ofs]= key;
+    }
+    void buildchunkhashes()
+    {
+        _chunkhashesbuilt= true;
+        for (auto const& f : _files)
+            f.second->datatable_enumerator(*this, [this](uint64_t ofs, size_t compsize, size_t fullsize) {
+                ByteVector buf;
+                addchunkhash(uint32_t(ofs), readspan(ofs, compsize, buf), compsize, fullsize);
+            });
+        if (g_verbose)
+            printf("dedup: indexed %d data chunks\n", int(_chunkhashes.size()));
+    }
+    // returns the offset of a stored file data chunk with exactly this contents,
+    // and adds a reference to it. returns 0 when there is none.
+    uint32_t sharechunk(const uint8_t *compdata, size_t compsize, size_t fullsize)
+    {
+        if (!_chunkhashesbuilt)
+            buildchunkhashes();
+        chunkhashmap_t::iterator i= _chunkhashes.find(chunkkey(compdata, compsize, fullsize));
+        if (i==_chunkhashes.end())
+            return 0;
+
+        ByteVector buf;
+        const uint8_t *stored= readspan(i->second, compsize, buf);
+        if (!std::equal(stored, stored+compsize, compdata))
+            return 0;
+
+        _sharedchunks[i->second]++;
+        return i->second;
+    }
+    // makes a newly written data chunk available to sharechunk
+    void registerchunk(uint32_t ofs, const uint8_t *compdata, size_t compsize, size_t fullsize)
+    {
+        if (_chunkhashesbuilt)
+            addchunkhash(ofs, compdata, compsize, fullsize);
+    }
+
 public:
     uint32_t roundtochunk(uint32_t x)
     {
@@ -4059,19 +5328,75 @@ public:
     size_t direntsize() const { return _hdr.direntsize; }
     size_t bytesperblock() const { return _hdr.bytesperblock; }
 
+    // can be called from the compression pool
     size_t compress(const uint8_t*data, size_t datasize, uint8_t *compdata)
     {
 #ifndef _NO_COMPRESS
-        return _xpr.DoCompressConvert(compresstype(), compdata, datasize-1, data, datasize);
+        uint32_t rc= g_compcache.compress(compresstype(), data, datasize, compdata, [&]() {
+#ifndef _NATIVE_COMPRESS
+            std::lock_guard<std::mutex> lock(_xprlock);
+#endif
+            uint32_t rc= _xpr.DoCompressConvert(compresstype(), compdata, datasize-1, data, datasize);
+            return rc==0xFFFFFFFF && !_xpr.available(compresstype()) ? compresscache::CODECERROR : rc;
+        });
+        // note: on 64 bit platforms the error value needs to be widened explicitly
+        if (rc==0xFFFFFFFF)
+            return size_t(-1);
+        return rc;
 #else
         std::copy(data, data+datasize, compdata);
         return datasize;
 #endif
     }
+    // returns the decompressed contents of a data chunk, through the chunkcache.
+    ConstByteVector_ptr loadchunk(uint32_t ofs, uint32_t compsize, uint32_t fullsize)
+    {
+        ConstByteVector_ptr cached= _cache.find(ofs);
+        if (cached && cached->size()==fullsize)
+            return cached;
+
+        ByteVector buf;
+        const uint8_t *compdata= readspan(ofs, compsize, buf);
+        std::shared_ptr<ByteVector> fulldata(new ByteVector(fullsize));
+
+        if (compsize<fullsize) {
+            decompress(compdata, compsize, &(*fulldata)[0], fullsize);
+        }
+        else if (compsize==fullsize) {
+            std::copy(compdata, compdata+compsize, fulldata->begin());
+        }
+        else {
+            printf("ERROR: @%08x, comp=%08x, full=%08x\n", ofs, int(compsize), int(fullsize));
+            throw "index error: fullsize < compsize";
+        }
+        _cache.insert(ofs, fulldata);
+        return fulldata;
+    }
+    // positional read, safe to use from multiple threads
+    void readat(uint64_t ofs, uint8_t *p, size_t n)
+    {
+        std::lock_guard<std::mutex> lock(g_imagelock);
+        _rd->setpos(ofs);
+        _rd->read(p, n);
+    }
+    // returns a pointer into the mapped image when possible,
+    // otherwise the data is read into 'buf'.
+    const uint8_t* readspan(uint64_t ofs, size_t n, ByteVector& buf)
+    {
+        if (const uint8_t *p= getspan(_rd, ofs, n))
+            return p;
+        buf.resize(n);
+        readat(ofs, &buf[0], n);
+        return &buf[0];
+    }
     void decompress(const uint8_t*compdata, size_t compsize, uint8_t*data, size_t fullsize)
     {
 #ifndef _NO_COMPRESS
         if (compsize<fullsize) {
+#ifndef _NATIVE_COMPRESS
+            // the compression dll is not reentrant
+            std::lock_guard<std::mutex> lock(_xprlock);
+#endif
             uint32_t rc= _xpr.DoCompressConvert(decompresstype(), data, fullsize, compdata, compsize);
             if (g_verbose>1) {
                 printf("decompress -> %08x\n", rc);
@@ -4090,7 +5415,19 @@ public:
     }
 #ifndef _NO_COMPRESS
     lzxxpr_convert _xpr;
+#ifndef _NATIVE_COMPRESS
+    std::mutex _xprlock;
+#endif
 #endif
+    std::unique_ptr<threadpool> _compresspool;
+
+    // workers used by FileEntry::fromstream, started on first use
+    threadpool& compresspool()
+    {
+        if (!_compresspool)
+            _compresspool.reset(new threadpool(g_threads));
+        return *_compresspool;
+    }
     uint16_t cputype() const
     {
         return _cputype;
@@ -4610,6 +5947,9 @@ public:
     XipFile(ReadWriter_ptr r, uint32_t rvabase)
         : _r(r), _filelistmodified(false), _hdr(r, _mm, rvabase)
     {
+        // the memory map of all entries is sorted and merged once, at the end.
+        _mm.beginbulk();
+
         // create name -> file map
         xipent_enumerator([this](XipEntry_ptr ent) {
                 // note: repeating typedef here for msvc10
@@ -4622,6 +5962,7 @@ public:
 
             ent->recordmemusage(*this, _mm);
         });
+        _mm.endbulk();
 
         if (g_verbose>1) {
             printf("xip memmap\n");
@@ -4891,7 +6232,12 @@ public:
     static size_t compress(const uint8_t*data, size_t datasize, uint8_t *compdata)
     {
 #ifndef _NO_COMPRESS
-        return _rom34.DoCompressConvert(ITSCOMP_ROM4_ENCODE, compdata, datasize-1, data, datasize);
+        // when the rom4 dll failed to load, the failures must not end up in the cache
+        if (!_rom34.available(ITSCOMP_ROM4_ENCODE))
+            return _rom34.DoCompressConvert(ITSCOMP_ROM4_ENCODE, compdata, datasize-1, data, datasize);
+        return g_compcache.compress(ITSCOMP_ROM4_ENCODE, data, datasize, compdata, [&]() {
+            return _rom34.DoCompressConvert(ITSCOMP_ROM4_ENCODE, compdata, datasize-1, data, datasize);
+        });
 #else
         std::copy(data, data+datasize, compdata);
         return datasize;
@@ -4901,7 +6247,11 @@ public:
     {
 #ifndef _NO_COMPRESS
         if (compsize<fullsize) {
-            _rom34.DoCompressConvert(ITSCOMP_ROM4_DECODE, data, fullsize, compdata, compsize);
+            uint32_t rc= _rom34.DoCompressConvert(ITSCOMP_ROM4_DECODE, data, fullsize, compdata, compsize);
+            // corrupt data, or a missing dll, fails. don't return garbage.
+            if (rc==0xFFFFFFFF || rc>fullsize)
+                throw "xip: rom4 decompression failed";
+            std::fill_n(data+rc, fullsize-rc, uint8_t(0));
             if (g_verbose>2) {
                 printf("indata: %s\n", hexdump(compdata, compsize).c_str());
                 printf("outdat: %s\n", hexdump(data, fullsize).c_str());
@@ -4959,10 +6309,21 @@ class CompressedXipReader : public ReadWriter {
 
     uint32_t _pos;
 
-    ByteVector _cache;
-    uint32_t _cachepos; // decompressed offset for contents of _cache
-
-    std::shared_ptr<MemoryReader> _memrd;
+    // decompressed blocks, by blocknr.
+    // when reading sequentially with -j N, the next blocks are decompressed in the background.
+    enum { BLOCKCACHE_SIZE= 0x40000, READAHEAD= 16 };
+    chunkcache _blockcache;
+    ConstByteVector_ptr _cur;   // the block currently read from
+    uint32_t _curblock;
+
+    std::set<uint32_t> _pending;    // blocks queued for read-ahead
+    std::mutex _pendinglock;
+    std::condition_variable _pendingdone;
+
+    // decompressed contents of the modified blocks, by blocknr.
+    // only these are recompressed on close.
+    typedef std::map<uint32_t, ByteVector> dirtymap_t;
+    dirtymap_t _dirty;
 public:
     static bool isCompressedXip(ReadWriter_ptr rd, uint64_t ofs)
     {
@@ -4998,7 +6359,7 @@ public:
         return true;
     }
     CompressedXipReader(ReadWriter_ptr r)
-        : _r(r), _fullblocksize(0), _totalsize(0), _pos(0), _cachepos(0)
+        : _r(r), _fullblocksize(0), _totalsize(0), _pos(0), _blockcache(BLOCKCACHE_SIZE), _curblock(0)
     {
         if (_r->isreadonly()) setreadonly();
 
@@ -5031,42 +6392,70 @@ public:
     }
     virtual ~CompressedXipReader()
     {
-        if (!_memrd)
-            return;
+        if (_readahead)
+            _readahead->wait();
+        if (g_verbose && _blockcache.used())
+            printf("cxip blockcache: %s\n", _blockcache.statistics().c_str());
 
-        // create new compressed data
-        _memrd->setpos(0);
-        ByteVector compdata;
+        if (_dirty.empty())
+            return;
 
-        while (!_memrd->eof()) {
-            ByteVector data(_fullblocksize);
-            size_t n= _memrd->read(&data[0], data.size());
+        // recompress the dirty blocks on the worker pool
+        dirtymap_t newcomp;
+        for (auto const& d : _dirty)
+            newcomp[d.first];
+
+        threadpool pool(g_threads);
+        for (auto const& d : _dirty) {
+            const ByteVector *data= &d.second;
+            ByteVector *comp= &newcomp[d.first];
+            pool.add([this, data, comp]() {
+                comp->resize(_fullblocksize);
+                comp->resize(compress(&(*data)[0], data->size(), &(*comp)[0]));
+            });
+        }
+        pool.wait();
 
-            compdata.resize(compdata.size()+_fullblocksize);
-            size_t c= compress(&data[0], n, &compdata[compdata.size()-_fullblocksize]);
-            compdata.resize(compdata.size()-_fullblocksize+c);
+        // when the nr of blocks is unchanged, all blocks before the first dirty block stay in place.
+        // untouched blocks after it are moved with their existing compressed data.
+        // the original data offset is kept then, it may have padding after the size table.
+        uint32_t nblocks= std::max(uint32_t(_compsizes.size()), _dirty.rbegin()->first+1);
+        uint32_t first= nblocks==_compsizes.size() ? _dirty.begin()->first : 0;
+        uint32_t dataofs= first ? _compptrs[0] : 0x44+2*nblocks;
+        uint32_t startofs= first ? _compptrs[first] : dataofs;
 
-            _compsizes.push_back(c);
+        ByteVector compdata;
+        DwordVector compsizes;
+        for (uint32_t b= first ; b<nblocks ; b++) {
+            auto c= newcomp.find(b);
+            if (c!=newcomp.end()) {
+                compdata.insert(compdata.end(), c->second.begin(), c->second.end());
+                compsizes.push_back(c->second.size());
+            }
+            else {
+                size_t oldsize= compdata.size();
+                compdata.resize(oldsize+_compsizes[b]);
+                _r->setpos(_compptrs[b]);
+                _r->read(&compdata[oldsize], _compsizes[b]);
+                compsizes.push_back(_compsizes[b]);
+            }
         }
-        printf("updated cxip: %d blocks ( full=%x, comp=%x )\n", (int)_compsizes.size(), (int)_memrd->size(), (int)compdata.size());
+        printf("updated cxip: %d blocks, %d recompressed ( full=%x, comp=%x )\n", (int)nblocks, (int)_dirty.size(), (int)(nblocks*_fullblocksize), (int)(startofs-dataofs+compdata.size()));
 
         // write new header
         _r->setpos(0x34);
-        _r->write32le(0x44+2*_compsizes.size());
-        _r->write32le(_compsizes.size());
+        _r->write32le(dataofs);
+        _r->write32le(nblocks);
         _r->write32le(_fullblocksize);
         _r->write32le(0x58505253);
-        std::for_each(_compsizes.begin(), _compsizes.end(), [this](uint32_t c) { _r->write16le(c); });
-        _r->write(&compdata[0], compdata.size());
+        _r->setpos(0x44+2*first);
+        std::for_each(compsizes.begin(), compsizes.end(), [this](uint32_t c) { _r->write16le(c); });
+        _r->setpos(startofs);
+        if (!compdata.empty())
+            _r->write(&compdata[0], compdata.size());
     }
     virtual size_t read(uint8_t *p, size_t n)
     {
-        if (_memrd) {
-            size_t nr= _memrd->read(p, n);
-            _pos += nr;
-            return nr;
-        }
-
         if (_pos>=_totalsize)
             return 0;
         size_t wanttotal= std::min(n, size_t(_totalsize-_pos));
@@ -5084,59 +6473,142 @@ public:
     }
     size_t readcomp(uint8_t *p, size_t n)
     {
-        if (_cachepos>_pos || _pos >= _cachepos+_cache.size()) {
-            _cache.resize(_fullblocksize);
-
-            size_t comppos= _compptrs[_pos/_fullblocksize];
-
-            ByteVector comp(_compsizes[_pos/_fullblocksize]);
+        auto d= _dirty.find(_pos/_fullblocksize);
+        if (d!=_dirty.end()) {
+            size_t bofs= _pos%_fullblocksize;
+            size_t want= std::min(n, _fullblocksize-bofs);
+            std::copy(&d->second[bofs], &d->second[bofs]+want, p);
+            return want;
+        }
+        if (!_cur || _curblock!=_pos/_fullblocksize) {
+            uint32_t blocknr= _pos/_fullblocksize;
+            bool sequential= _cur && blocknr==_curblock+1;
+            _cur= getblock(blocknr);
+            _curblock= blocknr;
+            if (sequential && g_threads>1)
+                readahead(blocknr+1);
+        }
+        size_t bofs= _pos%_fullblocksize;
+        size_t want= std::min(n, _cur->size()-bofs);
+        std::copy(&(*_cur)[bofs], &(*_cur)[bofs]+want, p);
 
-            _r->setpos(comppos);
-            _r->read(&comp[0], comp.size());
+        return want;
+    }
+    // returns a decompressed block through the block cache
+    ConstByteVector_ptr getblock(uint32_t blocknr)
+    {
+        {
+            std::unique_lock<std::mutex> lock(_pendinglock);
+            _pendingdone.wait(lock, [this, blocknr]() { return _pending.find(blocknr)==_pending.end(); });
+        }
+        ConstByteVector_ptr cached= _blockcache.find(blocknr);
+        if (cached)
+            return cached;
 
-            decompress(&comp[0], comp.size(), &_cache[0], _cache.size());
+        std::shared_ptr<ByteVector> data(new ByteVector(_fullblocksize));
+        loadblock(blocknr, &(*data)[0]);
+        _blockcache.insert(blocknr, data);
+        return data;
+    }
+    // queues the blocks following 'blocknr' for decompression on the read-ahead workers.
+    // the compressed data is read here, in one piece, since other users
+    // of the image stack do not take g_imagelock.
+    void readahead(uint32_t blocknr)
+    {
+        uint32_t end= std::min(uint32_t(_compsizes.size()), blocknr+READAHEAD);
+        uint32_t first= blocknr;
+        while (first<end && isavailable(first))
+            first++;
+        // refill when less than half of the window is ready
+        if (first>=end || first-blocknr >= READAHEAD/2)
+            return;
 
-            _cachepos= (_pos/_fullblocksize)*_fullblocksize;
+        ByteVector comp(_compptrs[end-1]+_compsizes[end-1]-_compptrs[first]);
+        _r->setpos(_compptrs[first]);
+        _r->read(&comp[0], comp.size());
 
-            //printf("decomp: %08x %08zx: %s\n", _cachepos, comppos, vhexdump(_cache).c_str());
+        if (!_readahead)
+            _readahead.reset(new threadpool(std::min(g_threads, int(READAHEAD))));
+        for (uint32_t b= first ; b<end ; b++) {
+            if (isavailable(b))
+                continue;
+            std::shared_ptr<ByteVector> compdata(new ByteVector(&comp[_compptrs[b]-_compptrs[first]], &comp[_compptrs[b]-_compptrs[first]]+_compsizes[b]));
+            {
+                std::lock_guard<std::mutex> lock(_pendinglock);
+                _pending.insert(b);
+            }
+            _readahead->add([this, b, compdata]() {
+                std::shared_ptr<ByteVector> data(new ByteVector(_fullblocksize));
+                try {
+                    decompress(&(*compdata)[0], compdata->size(), &(*data)[0], data->size());
+                    _blockcache.insert(b, data);
+                }
+                catch(...) {
+                    // the block is decompressed again when read, and reports the error there
+                }
+                {
+                    std::lock_guard<std::mutex> lock(_pendinglock);
+                    _pending.erase(b);
+                }
+                _pendingdone.notify_all();
+            });
         }
-        size_t want= std::min(n, _cachepos+_cache.size()-_pos);
-        std::copy(&_cache[_pos-_cachepos], &_cache[_pos-_cachepos]+want, p);
-
-        //printf("reading from cache: pos=%08x, cache=%08x  want=%08x\n", _pos, _cachepos, want);
-        return want;
     }
-    void loadmemrd()
+    bool isavailable(uint32_t blocknr)
     {
-        std::shared_ptr<MemoryReader> memrd(new ByteVectorReader());
-        uint64_t savedpos= _pos;
+        {
+            std::lock_guard<std::mutex> lock(_pendinglock);
+            if (_pending.find(blocknr)!=_pending.end())
+                return true;
+        }
+        return _dirty.find(blocknr)!=_dirty.end() || _blockcache.contains(blocknr);
+    }
+    // decompresses block 'blocknr' from the image
+    void loadblock(uint32_t blocknr, uint8_t *data)
+    {
+        ByteVector comp(_compsizes[blocknr]);
+
+        _r->setpos(_compptrs[blocknr]);
+        _r->read(&comp[0], comp.size());
 
-        setpos(0);
-        copyto(memrd);
+        decompress(&comp[0], comp.size(), data, _fullblocksize);
+    }
+    // returns the decompressed contents of a block, for modification.
+    // blocks past the end are added as zeros.
+    ByteVector& dirtyblock(uint32_t blocknr)
+    {
+        auto i= _dirty.find(blocknr);
+        if (i!=_dirty.end())
+            return i->second;
 
-        // from now on all read/writes are done via memrd
-        _memrd= memrd;
-        setpos(savedpos);
+        for (uint32_t b= _compsizes.size() ; b<blocknr ; b++)
+            if (_dirty.find(b)==_dirty.end())
+                _dirty[b].resize(_fullblocksize);
 
-        // discard ptrs into live image
-        _compsizes.clear();
-        _compptrs.clear();
-        _cache.clear();
-        _cachepos= 0;
+        ByteVector& data= _dirty[blocknr];
+        data.resize(_fullblocksize);
+        if (blocknr<_compsizes.size())
+            loadblock(blocknr, &data[0]);
+        _totalsize= std::max(_totalsize, (blocknr+1)*_fullblocksize);
+        return data;
     }
 
     virtual void write(const uint8_t *p, size_t n)
     {
-        if (!_memrd)
-            loadmemrd();
+        while (n) {
+            ByteVector& data= dirtyblock(_pos/_fullblocksize);
+
+            size_t bofs= _pos%_fullblocksize;
+            size_t want= std::min(n, _fullblocksize-bofs);
+            std::copy(p, p+want, &data[bofs]);
 
-        _memrd->write(p, n);
-        _pos += n;
+            _pos += want;
+            p += want;
+            n -= want;
+        }
     }
     virtual void setpos(uint64_t off)
     {
-        if (_memrd)
-            _memrd->setpos(off);
         _pos= off;
     }
     virtual void truncate(uint64_t off)
@@ -5149,24 +6621,28 @@ public:
     }
     virtual uint64_t getpos() const
     {
-        if (_memrd)
-            return _memrd->getpos();
         return _pos;
     }
     virtual bool eof()
     {
-        if (_memrd)
-            return _memrd->eof();
         return _pos>=size();
     }
 private:
+    // can be called from the worker pool
     size_t compress(const uint8_t*data, size_t datasize, uint8_t *compdata)
     {
 #ifndef _NO_COMPRESS
-
         //printf("compress %04zx: %s\n", datasize, hexdump(data, datasize).c_str());
 
-        size_t compsize= _xpr.DoCompressConvert(ITSCOMP_XPR_ENCODE, compdata, datasize-1, data, datasize);
+        uint32_t compsize= g_compcache.compress(ITSCOMP_XPR_ENCODE, data, datasize, compdata, [&]() {
+#ifndef _NATIVE_COMPRESS
+            std::lock_guard<std::mutex> lock(_xprlock);
+#endif
+            uint32_t rc= _xpr.DoCompressConvert(ITSCOMP_XPR_ENCODE, compdata, datasize-1, data, datasize);
+            if (rc==0xFFFFFFFF && !_xpr.available(ITSCOMP_XPR_ENCODE))
+                return compresscache::CODECERROR;
+            return rc<datasize ? rc : compresscache::INCOMPRESSIBLE;
+        });
         //printf("    %c %04zx: %s\n", compsize<datasize ? '<' : '=', compsize, hexdump(compdata, compsize).c_str());
         if (compsize<datasize)
             return compsize;
@@ -5174,11 +6650,19 @@ private:
         std::copy(data, data+datasize, compdata);
         return datasize;
     }
+    // can be called from the read-ahead workers
     void decompress(const uint8_t*compdata, size_t compsize, uint8_t*data, size_t fullsize)
     {
 #ifndef _NO_COMPRESS
         if (compsize<fullsize) {
-            _xpr.DoCompressConvert(ITSCOMP_XPR_DECODE, data, fullsize, compdata, compsize);
+#ifndef _NATIVE_COMPRESS
+            std::lock_guard<std::mutex> lock(_xprlock);
+#endif
+            uint32_t rc= _xpr.DoCompressConvert(ITSCOMP_XPR_DECODE, data, fullsize, compdata, compsize);
+            // all blocks are compressed at full size, a short block is corrupt,
+            // and must not end up in the block cache.
+            if (rc!=fullsize)
+                throw "cxip: xpr decompression failed";
             if (g_verbose>2) {
                 printf("indata: %s\n", hexdump(compdata, compsize).c_str());
                 printf("outdat: %s\n", hexdump(data, fullsize).c_str());
@@ -5194,8 +6678,13 @@ private:
 
 #ifndef _NO_COMPRESS
     lzxxpr_convert _xpr;
+#ifndef _NATIVE_COMPRESS
+    std::mutex _xprlock;
+#endif
 #endif
 
+    // declared last, so the workers are stopped before the members they use are destroyed
+    std::unique_ptr<threadpool> _readahead;
 };
 
 //////////////////////////////////////////////////////////////////////////////
@@ -5269,6 +6758,24 @@ public:
             return ReadWriter_ptr();
         return i->second.r;
     }
+    // the names of 'rd' and its parents, like "file/b00/fffb/part25".
+    // identifies a reader within the image, for the image index.
+    std::string path(ReadWriter_ptr rd) const
+    {
+        auto pi= _rdbyptr.find(rd);
+        if (pi==_rdbyptr.end())
+            return "";
+        std::string path= pi->second.name;
+        std::string parent= pi->second.parent;
+        while (!parent.empty()) {
+            auto i= _rdbyname.find(parent);
+            if (i==_rdbyname.end())
+                break;
+            path= i->second.name+"/"+path;
+            parent= i->second.parent;
+        }
+        return path;
+    }
 };
 class filesystemcollection {
     typedef std::map<std::string, FileContainer_ptr, caseinsensitive> fsmap_t;
@@ -5337,34 +6844,48 @@ struct extract_all : action {
     }
     virtual void perform(filesystemcollection& fslist, readercollection& rdlist)
     {
+        threadpool pool(g_threads);
         if (_fsname.empty())
         {
-            fslist.enumerate_filesystems([this](const std::string& name, FileContainer_ptr fs) {
-                this->extractfs(name, fs);
+            fslist.enumerate_filesystems([this,&pool](const std::string& name, FileContainer_ptr fs) {
+                this->extractfs(pool, name, fs);
             });
         }
         else {
             FileContainer_ptr fs= fslist.getbyname(_fsname);
             if (!fs) throw "extractall: invalid fsname";
-            extractfs(_fsname, fs);
+            extractfs(pool, _fsname, fs);
         }
+        pool.wait();
     }
-    void extractfs(const std::string& name, FileContainer_ptr fs)
+    void extractfs(threadpool& pool, const std::string& name, FileContainer_ptr fs)
     {
         std::string fssavepath= _dstpath+"/"+name;
         CreateDirPath(fssavepath);
+        bool parallel= fs->parallel_extract();
         fs->filename_enumerator(
-            [this,fs,fssavepath](const std::string& romname) {
-                try {
-                    fs->extractfile(romname, fssavepath+"/"+romname, _filter);
-                }
-                catch(const char*msg)
-                {
-                    printf("extractfile: %s: %s\n", romname.c_str(), msg);
-                }
+            [this,fs,fssavepath,parallel,&pool](const std::string& romname) {
+                auto task= [this,fs,fssavepath,romname]() {
+                    try {
+                        fs->extractfile(romname, fssavepath+"/"+romname, _filter);
+                    }
+                    catch(const char*msg)
+                    {
+                        printf("extractfile: %s: %s\n", romname.c_str(), msg);
+                    }
+                    catch(const std::string& msg)
+                    {
+                        printf("extractfile: %s: %s\n", romname.c_str(), msg.c_str());
+                    }
+                };
+                if (parallel)
+                    pool.add(task);
+                else
+                    task();
             }
         );
-
+        // finish this fs before the next one is enumerated
+        pool.wait();
     }
 };
 
@@ -5490,6 +7011,49 @@ struct extract_file : action {
 };
 
 
+// times a sequential pass, and random 4k reads over a file, used by eimgfs_bench
+struct read_test : action {
+    std::string _fsname;
+    std::string _romname;
+    int _count;
+
+    virtual ~read_test() { }
+    read_test(const std::string&fsname, const std::string&romname, int count)
+        : _fsname(fsname), _romname(romname), _count(count)
+    {
+    }
+    virtual void perform(filesystemcollection& fslist, readercollection& rdlist)
+    {
+        FileContainer_ptr fs= fslist.getbyname(_fsname);
+        if (!fs) throw "readtest: invalid fsname";
+        ReadWriter_ptr r= fs->openfile(_romname);
+        if (!r) throw "readtest: file not found";
+
+        uint64_t size= r->size();
+        ByteVector buf(4096);
+
+        auto t0= std::chrono::steady_clock::now();
+        r->setpos(0);
+        uint64_t total= 0;
+        while (size_t n= r->read(&buf[0], buf.size()))
+            total += n;
+        auto t1= std::chrono::steady_clock::now();
+
+        uint32_t seed= 1;
+        for (int i=0 ; i<_count ; i++) {
+            seed= seed*1103515245+12345;
+            r->setpos(size>buf.size() ? (seed>>8)%(size-buf.size()) : 0);
+            r->read(&buf[0], buf.size());
+        }
+        auto t2= std::chrono::steady_clock::now();
+
+        double seqsecs= std::chrono::duration<double>(t1-t0).count();
+        double rndsecs= std::chrono::duration<double>(t2-t1).count();
+        printf("readtest %s: sequential 0x%llx bytes in %.3f sec, %.1f MB/s\n", _romname.c_str(), total, seqsecs, seqsecs>0 ? total/seqsecs/1e6 : 0.0);
+        printf("readtest %s: %d random reads in %.3f sec, %.0f reads/s\n", _romname.c_str(), _count, rndsecs, rndsecs>0 ? _count/rndsecs : 0.0);
+    }
+};
+
 struct dirhexdump : action {
     std::string _fsname;
 
@@ -5602,6 +7166,32 @@ struct saveas_reader : action {
     }
 };
 
+struct verify_nbh : action {
+    std::string _keyfile;
+
+    virtual ~verify_nbh() { }
+    verify_nbh(const std::string& keyfile)
+        : _keyfile(keyfile)
+    {
+    }
+    virtual void perform(filesystemcollection& fslist, readercollection& rdlist)
+    {
+        std::shared_ptr<NbhReadWriter> nbh= std::dynamic_pointer_cast<NbhReadWriter>(rdlist.getbyname("nbh"));
+        if (!nbh)
+            throw "verifynbh: not an nbh image";
+
+        auto t0= std::chrono::steady_clock::now();
+        int badblock= nbh->verify(_keyfile);
+        double secs= std::chrono::duration<double>(std::chrono::steady_clock::now()-t0).count();
+
+        if (badblock>=0)
+            printf("nbh: bad signature in block %d\n", badblock);
+        else
+            printf("nbh: all %d signatures ok\n", int(nbh->blockcount()));
+        printf("verified 0x%llx bytes in %.3f sec, %.1f MB/s\n", nbh->size(), secs, secs>0 ? nbh->size()/secs/1e6 : 0.0);
+    }
+};
+
 struct hexdump_reader : action {
     std::string _readername;
     uint64_t _ofs;
@@ -5716,15 +7306,25 @@ void usage()
     fprintf(stderr, "      -d path                     : where to save extrated files to\n");
     fprintf(stderr, "      -s SIZE                     : specify totalsize ( for motorola FLASH )\n");
     fprintf(stderr, "      -extractall                 : extract all to '-d' path\n");
+    fprintf(stderr, "      -j           N              : use N threads for -extractall, -add and nbh signatures\n");
+    fprintf(stderr, "      -index                      : cache the image structure in IMGFILE.eidx\n");
+    fprintf(stderr, "      -dedup                      : with -add, share identical data chunks between files\n");
+#ifndef _NO_COMPRESS
+    fprintf(stderr, "      -compcache   CacheFile      : reuse compressed blocks from earlier runs\n");
+    fprintf(stderr, "      -compcachemax MB            : max size of the compression cache, default 256\n");
+#endif
+    fprintf(stderr, "      -batch                      : after the commandline, read operations from stdin\n");
+    fprintf(stderr, "      -atomic                     : keep changes in memory, replace the image only when all succeeded\n");
                    //................................................................................
     fprintf(stderr, "      -list                       : list all files\n");
     fprintf(stderr, "      -info                       : list available readers/filesystems\n");
-//  fprintf(stderr, "      -create    -- todo\n");
+    fprintf(stderr, "      -create      imgfs SRC...   : create a new imgfs image from files or directories\n");
 //  fprintf(stderr, "      -addmod    -- todo\n");
     fprintf(stderr, "      -filter      <EXE|SIGNED>   : only exe or signed binaries\n");
     fprintf(stderr, "      -resign                     : update nbh sigs after modifications\n");
     fprintf(stderr, "      -keyfile     KeyFile        : nbh key file\n");
     fprintf(stderr, "      -extractnbh                 : extract SPL/IPL/OS images from nbh\n");
+    fprintf(stderr, "      -verifynbh   KeyFile        : check all nbh signatures with a public key or cert\n");
 
     fprintf(stderr, "READER operations\n");
     fprintf(stderr, "      -rd          RdName         : specify reader to operate upon\n");
@@ -5746,6 +7346,7 @@ void usage()
     fprintf(stderr, "      -extract     RomName=dstfile\n");
     fprintf(stderr, "      -fileinfo    RomName        : print detailed info about file\n");
     fprintf(stderr, "      -dirhexdump                 : for debugging\n");
+    fprintf(stderr, "      -readtest    RomName COUNT  : time sequential and COUNT random reads of a file\n");
 
 }
 template<typename ACTION>
@@ -5818,6 +7419,34 @@ void processargs(int& i, int argc, char**argv, bool mustexist, ACTION act)
         processarg(arg, act, mustexist);
     }
 }
+// splits a line from the -batch input into arguments.
+// arguments are separated by whitespace, "double quotes" group an argument with spaces.
+std::vector<std::string> splitargs(const std::string& line)
+{
+    std::vector<std::string> args;
+    size_t i= 0;
+    while (i<line.size()) {
+        while (i<line.size() && isspace((uint8_t)line[i]))
+            i++;
+        if (i==line.size())
+            break;
+        std::string arg;
+        while (i<line.size() && !isspace((uint8_t)line[i])) {
+            if (line[i]=='"') {
+                size_t end= line.find('"', i+1);
+                if (end==std::string::npos)
+                    throw "unterminated quote";
+                arg += line.substr(i+1, end-i-1);
+                i= end+1;
+            }
+            else {
+                arg += line[i++];
+            }
+        }
+        args.push_back(arg);
+    }
+    return args;
+}
 void processhexdata(int& i, int argc, char**argv, ByteVector& data)
 {
     int datasize= 0;
@@ -5961,11 +7590,21 @@ filetypefilter_ptr makefilter(const std::string& filter)
 
 int main(int argc, char**argv)
 {
+    std::shared_ptr<OverlayReader> overlay;
+    // with -atomic, a failed batch line means the image is not replaced
+    bool batchfailed= false;
+
     try {
 #ifdef _NO_COMPRESS
     printf("(de)compression not supported in this build\n");
 #endif
     bool readonly= false;
+    bool useindex= false;
+    ImgfsFile::createlist_t createfiles;
+    std::string compcachefile;
+    int compcachemax= 256;
+    bool modifying= false;
+    bool atomic= false;
     std::string savedir=".";
     std::string nbh_save_dir;
     std::string imgname;
@@ -5985,12 +7624,26 @@ int main(int argc, char**argv)
     std::string filesystemname;
     std::string readername;
     uint32_t xip_rvabase=0;
+    bool batchmode= false;
 
+    // options which apply to the whole run, or to opening the image.
+    // these can't be changed by a -batch line.
+    static const std::set<std::string> commandlineonly= {
+        "-r", "-o", "-l", "-s", "-R", "-j", "-index", "-dedup", "-atomic", "-batch",
+        "-compcache", "-compcachemax", "-keyfile", "-resign", "-extractnbh", "-create",
+    };
+
+    // parses the arguments from argv[1] into 'actions', also used for the -batch input.
+    // returns 0 when ok, 1 on errors, 2 when done without opening an image.
+    auto parseargs= [&](int argc, char**argv, bool inbatch) -> int {
     int i=1;
     while (i<argc)
     {
         std::string arg= argv[i++];
 
+        if (inbatch && commandlineonly.count(arg))
+            throw stringformat("%s is only supported on the commandline", arg.c_str());
+
         // check for fs or rd presence
         if (arg=="-chexdump" || arg=="-hexdump" || arg=="-hexedit" || arg=="-getbytes" || arg=="-putbytes" || arg=="-saveas") {
             if (readername.empty()) {
@@ -5998,7 +7651,7 @@ int main(int argc, char**argv)
                 printf("defaulting to 'file' for option %s, override with the -rd option\n", arg.c_str());
             }
         }
-        else if (arg=="-add" || arg=="-ren" || arg=="-del" || arg=="-dump" || arg=="-extract" || arg=="-dirhexdump") {
+        else if (arg=="-add" || arg=="-ren" || arg=="-del" || arg=="-dump" || arg=="-extract" || arg=="-dirhexdump" || arg=="-readtest") {
             if (filesystemname.empty()) {
                 printf("option %s must be preceeded by -fs FSNAME\n", arg.c_str());
                 break;
@@ -6055,11 +7708,42 @@ int main(int argc, char**argv)
         }
         else if (arg=="-resign") {
             resignnbh= true;
+            modifying= true;
+        }
+        else if (arg=="-verifynbh") {
+            if (i>=argc) throw "missing arg for -verifynbh";
+            actions.push_back(action_ptr(new verify_nbh(argv[i++])));
+        }
+        else if (arg=="-index") {
+            useindex= true;
+        }
+        else if (arg=="-dedup") {
+            g_dedup= true;
+        }
+        else if (arg=="-compcache") {
+            if (i>=argc) throw "missing arg for -compcache";
+            compcachefile= argv[i++];
+        }
+        else if (arg=="-compcachemax") {
+            if (i>=argc) throw "missing arg for -compcachemax";
+            compcachemax= strtol(argv[i++], 0, 0);
+            if (compcachemax<1) throw "invalid arg for -compcachemax";
+        }
+        else if (arg=="-batch") {
+            batchmode= true;
+        }
+        else if (arg=="-atomic") {
+            atomic= true;
         }
         else if (arg=="-keyfile") {
             if (i>=argc) throw "missing arg for -keyfile";
             keyfile= argv[i++];
         }
+        else if (arg=="-j") {
+            if (i>=argc) throw "missing arg for -j";
+            g_threads= strtol(argv[i++], 0, 0);
+            if (g_threads<1) throw "invalid arg for -j";
+        }
         else if (arg=="-d") {
             if (i>=argc) throw "missing arg for -d";
             savedir= argv[i++];
@@ -6079,7 +7763,20 @@ int main(int argc, char**argv)
 
 //////////////////////////////////////////////////////////////////////////////
 // filesystem ops
+        else if (arg=="-create") {
+            modifying= true;
+            if (i+1>=argc) throw "missing args for -create";
+            std::string fstype= argv[i++];
+            if (fstype!="imgfs")
+                throw "-create: only imgfs is supported";
+            processargs(i, argc, argv, true, [&createfiles](const std::string& srcpath, const std::string& romname)
+                    {
+                        createfiles.push_back(std::make_pair(srcpath, romname));
+                    }
+            );
+        }
         else if (arg=="-add") {
+            modifying= true;
             if (i>=argc) throw "missing arg for -add";
             processargs(i, argc, argv, true, [&actions, filesystemname](const std::string& srcpath, const std::string& romname)
                     {
@@ -6088,6 +7785,7 @@ int main(int argc, char**argv)
             );
         }
         else if (arg=="-ren") {
+            modifying= true;
             if (i>=argc) throw "missing arg for -ren";
             std::string curname= argv[i++];
             size_t ieq= curname.find('=');
@@ -6097,6 +7795,7 @@ int main(int argc, char**argv)
             actions.push_back(action_ptr(new ren_file(filesystemname, curname, newname)));
         }
         else if (arg=="-del") {
+            modifying= true;
             if (i>=argc) throw "missing arg for -del";
             processargs(i, argc, argv, false, [&actions, filesystemname](const std::string& /*srcpath*/, const std::string& romname)
                     {
@@ -6131,6 +7830,12 @@ int main(int argc, char**argv)
         else if (arg=="-dirhexdump") {
             actions.push_back(action_ptr(new dirhexdump(filesystemname)));
         }
+        else if (arg=="-readtest") {
+            if ((i+1)>=argc) throw "missing args for -readtest";
+            std::string romname= argv[i++];
+            int count= strtol(argv[i++], 0, 0);
+            actions.push_back(action_ptr(new read_test(filesystemname, romname, count)));
+        }
 
 //////////////////////////////////////////////////////////////////////////////
 // reader ops
@@ -6169,6 +7874,7 @@ int main(int argc, char**argv)
         }
 #endif
         else if (arg=="-hexedit") {
+            modifying= true;
             if (i>=argc) throw "missing args for -hexedit";
             char*p;
             uint64_t offset= _strtoi64(argv[i++], &p, 0);
@@ -6199,6 +7905,7 @@ int main(int argc, char**argv)
             actions.push_back(action_ptr(new saveas_reader(readername, outname)));
         }
         else if (arg=="-putbytes") {
+            modifying= true;
             if ((i+2)>=argc) throw "missing args for -putbytes";
             char*p;
             uint64_t offset= _strtoi64(argv[i++], &p, 0);
@@ -6217,6 +7924,14 @@ int main(int argc, char**argv)
             return 1;
         }
     }
+    return 0;
+    };
+
+    int rc= parseargs(argc, argv, false);
+    if (rc==2)
+        return 0;
+    if (rc)
+        return 1;
 
     if (imgname.empty()) {
         printf("Missing image name\n");
@@ -6224,6 +7939,13 @@ int main(int argc, char**argv)
         return 1;
     }
 
+    if (useindex)
+        g_index.open(imgname, stringformat("o=%llx l=%llx s=%llx R=%x", imgoffset, imglength, totalsize, xip_rvabase), modifying);
+    if (!compcachefile.empty())
+        g_compcache.open(compcachefile, uint64_t(compcachemax)<<20);
+    if (!createfiles.empty())
+        ImgfsFile::create(imgname, createfiles);
+
     readercollection rdlist;
     filesystemcollection fslist;
 
@@ -6232,19 +7954,24 @@ int main(int argc, char**argv)
     // decode image
     ReadWriter_ptr rd= ReadWriter_ptr
 #ifndef _NO_MMAP
-            (readonly ? new MmapReader(imgname, MmapReader::readonly)
-                     : totalsize ?  new MmapReader(imgname, MmapReader::readwrite, totalsize)
-                         : new MmapReader(imgname, MmapReader::readwrite));
+            (readonly || atomic ? new SpanMmapReader(imgname, MmapReader::readonly)
+                     : totalsize ?  new SpanMmapReader(imgname, MmapReader::readwrite, totalsize)
+                         : new SpanMmapReader(imgname, MmapReader::readwrite));
 #else
-            (readonly ? new FileReader(imgname, FileReader::readonly)
+            (readonly || atomic ? new FileReader(imgname, FileReader::readonly)
                      : new FileReader(imgname, FileReader::readwrite));
 #endif
 
+    if (atomic && !readonly) {
+        overlay.reset(new OverlayReader(rd, imgname, totalsize));
+        rd= overlay;
+    }
+
     rdlist.addreader(rd, "file");
     if (imgoffset) {
         if (imglength==0)
             imglength = rd->size() - imgoffset;
-        rd = ReadWriter_ptr(new OffsetReader(rd, imgoffset, imglength));
+        rd = ReadWriter_ptr(new SpanOffsetReader(rd, imgoffset, imglength));
     }
 
     ByteVector sec0(512);
@@ -6263,7 +7990,7 @@ int main(int argc, char**argv)
         //  todo: fix FFFBFFFDReader to accept an initial block without blkids
         //     -> so i can skip with offset 0x320000
         rdlist.setparent(rd);
-        rd.reset(new FFFBFFFDReader(rd, 0x800));
+        rd.reset(new FFFBFFFDReader(rd, 0x800, rdlist.path(rd)+"/fffb"));
         rdlist.addreader(rd, "fffb");
 
         rd->setpos(0);
@@ -6313,7 +8040,7 @@ int main(int argc, char**argv)
         // note: qualcomm based phones have the diskblocknr+tag after each fileblock
         // -> the fileoffset != diskblocknr*fileblocksize for the imgfs partition
         rdlist.setparent(rd);
-        rd.reset(new FFFBFFFDReader(rd, fffbblocksize));
+        rd.reset(new FFFBFFFDReader(rd, fffbblocksize, rdlist.path(rd)+"/fffb"));
         rdlist.addreader(rd, "fffb");
         rd->setpos(0);
         rd->read(&sec0[0], sec0.size());
@@ -6334,7 +8061,7 @@ int main(int argc, char**argv)
                     return;
 
                 // todo: add option to use CheckedOffsetReader, so we will not crash on truncated files
-                ReadWriter_ptr rp(new OffsetReader(rd, ofs, size));
+                ReadWriter_ptr rp(new SpanOffsetReader(rd, ofs, size));
                 rdlist.setparent(rd);
                 rdlist.addreader(rp, stringformat("part%02x", type));
                 switch(type)
@@ -6358,7 +8085,7 @@ int main(int argc, char**argv)
                 break;
                 case 0x25: // imgfs
                 {
-                    fslist.addfs(FileContainer_ptr(new ImgfsFile(rp)), "imgfs");
+                    fslist.addfs(FileContainer_ptr(new ImgfsFile(rp, rdlist.path(rp))), "imgfs");
                 }
                 break;
                 }
@@ -6391,10 +8118,10 @@ int main(int argc, char**argv)
         printf("imgfs @ %08llx\n", hdrofs);
 
         rdlist.setparent(rd);
-        rd.reset(new OffsetReader(rd, hdrofs, rd->size()-hdrofs));
+        rd.reset(new SpanOffsetReader(rd, hdrofs, rd->size()-hdrofs));
 
         rdlist.addreader(rd, "imgfs");
-        fslist.addfs(FileContainer_ptr(new ImgfsFile(rd)), "imgfs");
+        fslist.addfs(FileContainer_ptr(new ImgfsFile(rd, rdlist.path(rd))), "imgfs");
         }
         catch(const char*msg)
         {
@@ -6420,6 +8147,51 @@ int main(int argc, char**argv)
     for (actionlist::iterator i= actions.begin() ; i!=actions.end() ; i++)
         (*i)->perform(fslist, rdlist);
 
+    //////////////////////////////////////////////////////////////////////////////
+    //  batch mode: read more operations from stdin, one commandline per line,
+    //  while keeping the image open.
+    //  the output of each line is terminated by '@@ OK' or '@@ ERROR: <msg>'
+    if (batchmode) {
+        char line[0x10000];
+        while (fgets(line, sizeof(line), stdin)) {
+            try {
+                std::vector<std::string> args= splitargs(line);
+                if (args.empty())
+                    continue;
+                if (args[0]=="quit")
+                    break;
+                args.insert(args.begin(), argv[0]);
+
+                std::vector<char*> argp;
+                for (auto& a : args)
+                    argp.push_back(&a[0]);
+
+                actions.clear();
+                if (parseargs(int(argp.size()), &argp[0], true))
+                    throw "invalid operation";
+                for (actionlist::iterator i= actions.begin() ; i!=actions.end() ; i++)
+                    (*i)->perform(fslist, rdlist);
+                printf("@@ OK\n");
+            }
+            catch(const char*msg)
+            {
+                printf("@@ ERROR: %s\n", msg);
+                batchfailed= true;
+            }
+            catch(const std::string& msg)
+            {
+                printf("@@ ERROR: %s\n", msg.c_str());
+                batchfailed= true;
+            }
+            catch(...)
+            {
+                printf("@@ ERROR\n");
+                batchfailed= true;
+            }
+            fflush(stdout);
+        }
+    }
+
     }
     catch(const char*msg)
     {
@@ -6436,6 +8208,15 @@ int main(int argc, char**argv)
         printf("EXCEPTION\n");
         return 1;
     }
+    // the image is closed now
+    if (overlay && batchfailed) {
+        printf("batch operations failed, image not modified\n");
+        return 1;
+    }
+    if (overlay && !overlay->commit())
+        return 1;
+    g_index.save();
+    g_compcache.save();
 
     return 0;
 }
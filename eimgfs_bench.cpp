@@ -0,0 +1,553 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <new>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include "bytesum.h"
+#include "freerunmap.h"
+
+// benchmark harness for eimgfs.
+//
+// generates a synthetic imgfs image, optionally wrapped in a FFFBFFFD, B000FF or NBH container,
+// then times the eimgfs commandline on it: open, -list, -extractall, -add, -create and -readtest.
+// for each run the wall time, throughput, cpu time and peak rss of the eimgfs process are reported.
+// the in process allocchunk benchmark also reports the number of heap allocations.
+//
+// xip images are not generated: a valid romhdr with modules needs real pe files.
+//
+// all files are left in the work directory, the logs of each eimgfs run are in WORKDIR/*.log
+
+typedef std::vector<uint8_t> ByteVector;
+
+std::atomic<uint64_t> g_allocations(0);
+void* operator new(size_t n)
+{
+    g_allocations++;
+    void *p= malloc(n ? n : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct benchconfig {
+    std::string eimgfs;
+    std::string workdir;
+    std::string wrap;
+    uint32_t imagesize;
+    int nfiles;
+    uint32_t filesize;
+    int threads;
+
+    benchconfig()
+        : workdir("benchwork"), wrap("raw"), imagesize(64<<20), nfiles(200), filesize(64<<10), threads(1)
+    {
+    }
+};
+
+typedef std::chrono::steady_clock benchclock;
+double secsince(benchclock::time_point t0)
+{
+    return std::chrono::duration<double>(benchclock::now()-t0).count();
+}
+
+void set32le(uint8_t *p, uint32_t x)
+{
+    for (int i=0 ; i<4 ; i++)
+        p[i]= uint8_t(x>>(8*i));
+}
+void put32(ByteVector& v, uint32_t x)
+{
+    uint8_t b[4];
+    set32le(b, x);
+    v.insert(v.end(), b, b+4);
+}
+
+void makedir(const std::string& path)
+{
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0777);
+#endif
+}
+void savefile(const std::string& path, const ByteVector& data)
+{
+    std::ofstream f(path.c_str(), std::ios::binary|std::ios::trunc);
+    f.write((const char*)data.data(), data.size());
+    if (!f)
+        throw "error writing file";
+}
+bool loadfile(const std::string& path, ByteVector& data)
+{
+    std::ifstream f(path.c_str(), std::ios::binary);
+    if (!f)
+        return false;
+    data.assign(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+    return true;
+}
+void copyfile(const std::string& src, const std::string& dst)
+{
+    ByteVector data;
+    if (!loadfile(src, data))
+        throw "error reading file";
+    savefile(dst, data);
+}
+
+// deterministic pseudo random numbers, so every run generates the same images
+struct lcg {
+    uint32_t _state;
+    explicit lcg(uint32_t seed) : _state(seed) { }
+    uint32_t next()
+    {
+        _state= _state*1103515245+12345;
+        return _state>>8;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// image generators
+
+// empty imgfs: header block, one dirblock, and free space filled with 0xff
+ByteVector makeimgfs(uint32_t imagesize)
+{
+    enum { DIRENTSIZE= 0x34, CHUNKSPERBLOCK= 0x20, BYTESPERBLOCK= 0x800 };
+    const uint8_t imgfsuuid[16]= {
+        0xf8, 0xac, 0x2c, 0x9d, 0xe3, 0xd4, 0x2b, 0x4d, 0xbd, 0x30, 0x91, 0x6e, 0xd8, 0x4f, 0x31, 0xdc
+    };
+    imagesize -= imagesize%BYTESPERBLOCK;
+    ByteVector img(imagesize, 0xff);
+
+    uint8_t *hdr= &img[0];
+    memcpy(hdr, imgfsuuid, sizeof(imgfsuuid));
+    set32le(hdr+0x10, 1);
+    set32le(hdr+0x14, 1);
+    set32le(hdr+0x18, 1);
+    set32le(hdr+0x1c, DIRENTSIZE);
+    set32le(hdr+0x20, CHUNKSPERBLOCK);
+    set32le(hdr+0x24, BYTESPERBLOCK);
+    set32le(hdr+0x28, 0x1000);
+    set32le(hdr+0x2c, 0x525058);     // 'XPR'
+    set32le(hdr+0x30, 0);
+    set32le(hdr+0x34, 0x40);
+
+    uint8_t *dir= &img[BYTESPERBLOCK];
+    set32le(dir, 0x2f5314ce);
+    set32le(dir+4, 0);
+
+    return img;
+}
+
+// each 0x800 byte block followed by its blocknr and the 0xfffbfffd tag
+ByteVector wrapfffb(const ByteVector& data)
+{
+    enum { BLOCKSIZE= 0x800 };
+    ByteVector out;
+    out.reserve(data.size()/BLOCKSIZE*(BLOCKSIZE+8)+BLOCKSIZE+8);
+    for (size_t ofs= 0, blocknr= 0 ; ofs<data.size() ; ofs+=BLOCKSIZE, blocknr++) {
+        size_t n= std::min(data.size()-ofs, size_t(BLOCKSIZE));
+        out.insert(out.end(), &data[ofs], &data[ofs]+n);
+        out.resize(out.size()+BLOCKSIZE-n, 0xff);
+        put32(out, uint32_t(blocknr));
+        put32(out, 0xfffbfffd);
+    }
+    return out;
+}
+
+// motorola style: B000FF records around a FFFBFFFD image
+ByteVector wrapb000ff(const ByteVector& data)
+{
+    enum { RECORDSIZE= 0x40000 };
+    const uint32_t start= 0x80000000;
+    ByteVector inner= wrapfffb(data);
+
+    ByteVector out;
+    const char magic[]= "B000FF\n";
+    out.insert(out.end(), magic, magic+7);
+    put32(out, start);
+    put32(out, uint32_t(inner.size()));
+    for (size_t ofs= 0 ; ofs<inner.size() ; ofs+=RECORDSIZE) {
+        uint32_t n= uint32_t(std::min(inner.size()-ofs, size_t(RECORDSIZE)));
+        put32(out, start+uint32_t(ofs));
+        put32(out, n);
+        put32(out, bytesum(&inner[ofs], n));
+        out.insert(out.end(), &inner[ofs], &inner[ofs]+n);
+    }
+    put32(out, 0);
+    put32(out, start);
+    put32(out, 0);
+    return out;
+}
+
+// R000FF header and guid, then blocks of: datasize, sigsize, flag, data, signature.
+// the signatures are left empty, the last block has flag 2.
+ByteVector wrapnbh(const ByteVector& data)
+{
+    enum { BLOCKSIZE= 0x10000, SIGSIZE= 0x80 };
+    ByteVector out;
+    const char magic[]= "R000FF\n";
+    out.insert(out.end(), magic, magic+7);
+    for (int i=0 ; i<16 ; i++)
+        out.push_back(uint8_t(0x10+i));
+    for (size_t ofs= 0 ; ofs<data.size() ; ofs+=BLOCKSIZE) {
+        uint32_t n= uint32_t(std::min(data.size()-ofs, size_t(BLOCKSIZE)));
+        put32(out, n);
+        put32(out, SIGSIZE);
+        out.push_back(ofs+n==data.size() ? 2 : 1);
+        out.insert(out.end(), &data[ofs], &data[ofs]+n);
+        out.resize(out.size()+SIGSIZE, 0);
+    }
+    return out;
+}
+
+// a mix of text like, zero and random data, so compression ratios are realistic
+ByteVector makefiledata(lcg& rng, uint32_t avgsize)
+{
+    static const char *words[]= { "imgfs ", "module ", "section ", "coredll.dll ", "\x00\x00\x00\x00", "HKEY_LOCAL_MACHINE\\", "0123456789 " };
+    uint32_t size= avgsize/4 + rng.next()%(avgsize*3/2+1);
+    ByteVector data;
+    data.reserve(size);
+    while (data.size()<size) {
+        uint32_t kind= rng.next()%8;
+        uint32_t n= 16+rng.next()%512;
+        if (kind<5) {
+            while (n--) {
+                const char *w= words[rng.next()%(sizeof(words)/sizeof(*words))];
+                size_t wl= *w ? strlen(w) : 4;
+                data.insert(data.end(), w, w+wl);
+            }
+        }
+        else if (kind<6) {
+            data.resize(data.size()+n*8, 0);
+        }
+        else {
+            while (n--)
+                data.push_back(uint8_t(rng.next()));
+        }
+    }
+    data.resize(size);
+    return data;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// running eimgfs
+
+struct runresult {
+    bool ok;
+    double secs;
+    double usersecs;
+    double syssecs;
+    long maxrsskb;
+};
+
+// runs eimgfs with 'args', output goes to WORKDIR/NAME.log
+runresult runeimgfs(const benchconfig& cfg, const std::string& name, const std::vector<std::string>& args)
+{
+    std::string logname= cfg.workdir+"/"+name+".log";
+    runresult res= { false, 0, 0, 0, 0 };
+    auto t0= benchclock::now();
+#ifdef _WIN32
+    std::string cmd= "\""+cfg.eimgfs+"\"";
+    for (auto const& a : args)
+        cmd += " \""+a+"\"";
+    cmd += " >\""+logname+"\" 2>&1";
+    res.ok= system(("\""+cmd+"\"").c_str())==0;
+    res.secs= secsince(t0);
+#else
+    pid_t pid= fork();
+    if (pid<0)
+        throw "fork failed";
+    if (pid==0) {
+        int fd= open(logname.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0666);
+        if (fd>=0) {
+            dup2(fd, 1);
+            dup2(fd, 2);
+            close(fd);
+        }
+        std::vector<char*> argv;
+        argv.push_back(const_cast<char*>(cfg.eimgfs.c_str()));
+        for (auto const& a : args)
+            argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(NULL);
+        execv(cfg.eimgfs.c_str(), &argv[0]);
+        _exit(127);
+    }
+    int status= 0;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru)<0)
+        throw "wait4 failed";
+    res.secs= secsince(t0);
+    res.ok= WIFEXITED(status) && WEXITSTATUS(status)==0;
+    res.usersecs= ru.ru_utime.tv_sec+ru.ru_utime.tv_usec/1e6;
+    res.syssecs= ru.ru_stime.tv_sec+ru.ru_stime.tv_usec/1e6;
+    res.maxrsskb= ru.ru_maxrss;
+#if defined(__APPLE__)
+    res.maxrsskb /= 1024;   // bytes on osx
+#endif
+#endif
+    // eimgfs reports most errors on stdout, and still exits with 0
+    ByteVector log;
+    if (loadfile(logname, log)) {
+        std::string text(log.begin(), log.end());
+        if (text.find("EXCEPTION")!=std::string::npos || text.find("ERROR")!=std::string::npos)
+            res.ok= false;
+    }
+    return res;
+}
+
+int g_failures= 0;
+
+void report(const std::string& name, const runresult& r, double mbytes, const char *unit= "MB/s")
+{
+    printf("%-22s %8.3f %10.1f %-8s %8.3f %8.3f %10ld %s\n", name.c_str(), r.secs,
+            r.secs>0 ? mbytes/r.secs : 0.0, unit, r.usersecs, r.syssecs, r.maxrsskb, r.ok ? "" : "FAILED");
+    if (!r.ok)
+        g_failures++;
+}
+void printlog(const benchconfig& cfg, const std::string& name, const char *prefix)
+{
+    ByteVector log;
+    if (!loadfile(cfg.workdir+"/"+name+".log", log))
+        return;
+    std::string text(log.begin(), log.end());
+    size_t pos= 0;
+    while (pos<text.size()) {
+        size_t eol= text.find('\n', pos);
+        if (eol==std::string::npos)
+            eol= text.size();
+        if (text.compare(pos, strlen(prefix), prefix)==0)
+            printf("    %s\n", text.substr(pos, eol-pos).c_str());
+        pos= eol+1;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// in process benchmark of the imgfs chunk allocator
+
+// same allocation pattern as ImgfsFile::allocchunk / freechunk:
+// the lowest free run, growing the map at the end when there is none.
+void benchallocchunk(uint32_t nchunks)
+{
+    enum { CHUNKSPERBLOCK= 0x20 };
+    lcg rng(42);
+    std::vector<std::pair<uint32_t,uint32_t> > used;
+    used.reserve(nchunks);
+
+    uint64_t allocs0= g_allocations;
+    auto t0= benchclock::now();
+
+    freerunmap m;
+    m.setblocksize(CHUNKSPERBLOCK);
+    uint32_t nops= 0;
+    while (m.size()<nchunks) {
+        uint32_t n= 1+rng.next()%16;
+        int64_t found= m.findrun(n);
+        uint32_t ix;
+        if (found>=0) {
+            ix= uint32_t(found);
+        }
+        else {
+            ix= m.size()-m.freeatend();
+            uint32_t newsize= ((ix+n-1)|(CHUNKSPERBLOCK-1))+1;
+            m.resize(newsize);
+        }
+        m.mark(ix, n, false);
+        used.push_back(std::make_pair(ix, n));
+        nops++;
+
+        // free about a third, like replaced files
+        if (rng.next()%3==0) {
+            size_t victim= rng.next()%used.size();
+            m.mark(used[victim].first, used[victim].second, true);
+            used[victim]= used.back();
+            used.pop_back();
+            nops++;
+        }
+    }
+    double secs= secsince(t0);
+    printf("%-22s %8.3f %10.0f %-8s %8s %8s %10s allocations: %llu\n", "allocchunk", secs,
+            secs>0 ? nops/secs : 0.0, "ops/s", "", "", "", (unsigned long long)(g_allocations-allocs0));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void usage()
+{
+    printf("Usage: eimgfs_bench [options]\n");
+    printf("      -eimgfs      PATH     : eimgfs binary to time, default: next to eimgfs_bench\n");
+    printf("      -dir         PATH     : work directory, default 'benchwork'\n");
+    printf("      -size        MB       : imgfs size, default 64\n");
+    printf("      -files       N        : number of files to add, default 200\n");
+    printf("      -filesize    KB       : average file size, default 64\n");
+    printf("      -wrap        TYPE     : raw, fffb, b000ff or nbh, default raw\n");
+    printf("      -j           N        : threads passed to eimgfs\n");
+    printf("      -gen         IMGFILE  : only write an empty image, wrapped as with -wrap\n");
+}
+
+ByteVector wrapimage(const benchconfig& cfg, const ByteVector& raw)
+{
+    if (cfg.wrap=="raw")    return raw;
+    if (cfg.wrap=="fffb")   return wrapfffb(raw);
+    if (cfg.wrap=="b000ff") return wrapb000ff(raw);
+    if (cfg.wrap=="nbh")    return wrapnbh(raw);
+    throw "unknown -wrap type";
+}
+
+std::string defaulteimgfs(const char *argv0)
+{
+    std::string path(argv0);
+    size_t lastslash= path.find_last_of("/\\");
+    std::string dir= lastslash==std::string::npos ? "." : path.substr(0, lastslash);
+#ifdef _WIN32
+    return dir+"/eimgfs.exe";
+#else
+    return dir+"/eimgfs";
+#endif
+}
+
+int main(int argc, char**argv)
+{
+    try {
+    benchconfig cfg;
+    cfg.eimgfs= defaulteimgfs(argv[0]);
+    std::string genname;
+
+    for (int i=1 ; i<argc ; i++) {
+        std::string arg= argv[i];
+        auto needarg= [&]() -> const char* {
+            if (i+1>=argc) throw "missing argument";
+            return argv[++i];
+        };
+        if (arg=="-eimgfs")         cfg.eimgfs= needarg();
+        else if (arg=="-dir")       cfg.workdir= needarg();
+        else if (arg=="-size")      cfg.imagesize= strtoul(needarg(), 0, 0)<<20;
+        else if (arg=="-files")     cfg.nfiles= strtol(needarg(), 0, 0);
+        else if (arg=="-filesize")  cfg.filesize= strtoul(needarg(), 0, 0)<<10;
+        else if (arg=="-wrap")      cfg.wrap= needarg();
+        else if (arg=="-j")         cfg.threads= strtol(needarg(), 0, 0);
+        else if (arg=="-gen")       genname= needarg();
+        else {
+            usage();
+            return 1;
+        }
+    }
+    if (!genname.empty()) {
+        savefile(genname, wrapimage(cfg, makeimgfs(cfg.imagesize)));
+        return 0;
+    }
+
+    std::string jobs= std::to_string(cfg.threads);
+    std::string srcdir= cfg.workdir+"/src";
+    std::string moredir= cfg.workdir+"/more";
+    std::string outdir= cfg.workdir+"/out";
+    std::string rawname= cfg.workdir+"/raw.img";
+    std::string imgname= cfg.workdir+"/bench.img";
+    makedir(cfg.workdir);
+    makedir(srcdir);
+    makedir(moredir);
+    makedir(outdir);
+
+    // source files
+    auto t0= benchclock::now();
+    lcg rng(1);
+    std::vector<std::string> names;
+    uint64_t srcbytes= 0;
+    std::string largest;
+    size_t largestsize= 0;
+    for (int i=0 ; i<cfg.nfiles ; i++) {
+        std::string name= "f"+std::to_string(100000+i).substr(1)+".bin";
+        ByteVector data= makefiledata(rng, cfg.filesize);
+        savefile(srcdir+"/"+name, data);
+        names.push_back(name);
+        srcbytes += data.size();
+        if (data.size()>largestsize) {
+            largestsize= data.size();
+            largest= name;
+        }
+    }
+    uint64_t morebytes= 0;
+    for (int i=0 ; i<std::max(1, cfg.nfiles/10) ; i++) {
+        ByteVector data= makefiledata(rng, cfg.filesize);
+        savefile(moredir+"/g"+std::to_string(100000+i).substr(1)+".bin", data);
+        morebytes += data.size();
+    }
+    savefile(rawname, makeimgfs(cfg.imagesize));
+    printf("generated %d files, %.1f MB, in %.3f sec\n", cfg.nfiles, srcbytes/1e6, secsince(t0));
+    printf("%-22s %8s %10s %-8s %8s %8s %10s\n", "operation", "secs", "rate", "", "user", "sys", "maxrss(KB)");
+
+    double srcmb= srcbytes/1e6;
+
+    // fill the raw imgfs, then wrap it
+    report("add "+std::to_string(cfg.nfiles)+" files", runeimgfs(cfg, "add", { rawname, "-j", jobs, "-fs", "imgfs", "-add", srcdir }), srcmb);
+    {
+        ByteVector raw;
+        if (!loadfile(rawname, raw))
+            throw "error reading raw image";
+        savefile(imgname, wrapimage(cfg, raw));
+    }
+
+    report("create "+std::to_string(cfg.nfiles)+" files", runeimgfs(cfg, "create", { cfg.workdir+"/create.img", "-j", jobs, "-create", "imgfs", srcdir }), srcmb);
+
+    report("open", runeimgfs(cfg, "open", { imgname, "-r" }), srcmb);
+    runeimgfs(cfg, "index", { imgname, "-r", "-index" });
+    report("open -index", runeimgfs(cfg, "openindex", { imgname, "-r", "-index" }), srcmb);
+    report("list", runeimgfs(cfg, "list", { imgname, "-r", "-fs", "imgfs", "-list" }), cfg.nfiles, "files/s");
+    report("extractall", runeimgfs(cfg, "extractall", { imgname, "-r", "-j", jobs, "-d", outdir, "-fs", "imgfs", "-extractall" }), srcmb);
+
+    // the extracted files must be identical to the sources
+    int mismatches= 0;
+    for (auto const& name : names) {
+        ByteVector a, b;
+        if (!loadfile(srcdir+"/"+name, a) || !loadfile(outdir+"/"+name, b) || a!=b)
+            mismatches++;
+    }
+    if (mismatches) {
+        printf("extractall: %d files differ from the source\n", mismatches);
+        g_failures++;
+    }
+
+    report("readtest", runeimgfs(cfg, "readtest", { imgname, "-r", "-fs", "imgfs", "-readtest", largest, "10000" }), largestsize/1e6);
+    printlog(cfg, "readtest", "readtest");
+
+    std::string addname= cfg.workdir+"/add.img";
+    copyfile(imgname, addname);
+    report("add to "+cfg.wrap, runeimgfs(cfg, "addwrapped", { addname, "-j", jobs, "-fs", "imgfs", "-add", moredir }), morebytes/1e6);
+
+    benchallocchunk(cfg.imagesize/0x40);
+
+    if (g_failures) {
+        printf("%d failures, see the logs in %s\n", g_failures, cfg.workdir.c_str());
+        return 1;
+    }
+    }
+    catch(const char*msg)
+    {
+        printf("E: %s\n", msg);
+        return 1;
+    }
+    catch(...)
+    {
+        printf("EXCEPTION\n");
+        return 1;
+    }
+    return 0;
+}
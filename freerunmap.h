@@ -0,0 +1,188 @@
+#pragma once
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <stdint.h>
+
+// index of the free runs in a map of 'size' units.
+//
+// a segment tree keeps for each range: the free prefix, free suffix and longest free run,
+// so the lowest run of n free units is found in O(log size).
+// fully free aligned blocks of 'blocksize' units are kept in a set.
+//
+// units past 'size' count as used.
+class freerunmap {
+    struct node {
+        uint32_t pref;
+        uint32_t suf;
+        uint32_t best;
+        uint32_t len;
+    };
+    std::vector<node> _tree;    // _tree[1] is the root, leaves start at _cap
+    std::vector<bool> _free;
+    std::vector<uint32_t> _blockfree;   // nr of free units per block
+    std::set<uint32_t> _freeblocks;     // blocknr of all fully free blocks
+
+    uint32_t _size;
+    uint32_t _cap;
+    uint32_t _blocksize;
+
+    static node combine(const node& l, const node& r)
+    {
+        node n;
+        n.len= l.len+r.len;
+        n.pref= l.pref==l.len ? l.len+r.pref : l.pref;
+        n.suf= r.suf==r.len ? r.len+l.suf : r.suf;
+        n.best= std::max(std::max(l.best, r.best), l.suf+r.pref);
+        return n;
+    }
+    void setleaf(uint32_t ix, bool isfree)
+    {
+        node& n= _tree[_cap+ix];
+        n.pref= n.suf= n.best= isfree ? 1 : 0;
+    }
+    // recalc all parents of the leaves [first, last)
+    void update(uint32_t first, uint32_t last)
+    {
+        first += _cap;
+        last += _cap-1;
+        while (first>1) {
+            first/=2;
+            last/=2;
+            for (uint32_t i= first ; i<=last ; i++)
+                _tree[i]= combine(_tree[2*i], _tree[2*i+1]);
+        }
+    }
+    void rebuild(uint32_t cap)
+    {
+        _cap= cap;
+        _tree.assign(2*_cap, node{0,0,0,1});
+        for (uint32_t i=0 ; i<_size ; i++)
+            setleaf(i, _free[i]);
+        for (uint32_t i=_cap-1 ; i>0 ; i--)
+            _tree[i]= combine(_tree[2*i], _tree[2*i+1]);
+    }
+    void setblock(uint32_t blk, uint32_t nfree)
+    {
+        _blockfree[blk]= nfree;
+        if (nfree==_blocksize)
+            _freeblocks.insert(blk);
+        else
+            _freeblocks.erase(blk);
+    }
+public:
+    explicit freerunmap(uint32_t blocksize= 1)
+        : _size(0), _cap(0), _blocksize(blocksize)
+    {
+        rebuild(1);
+    }
+    void setblocksize(uint32_t blocksize)
+    {
+        _blocksize= blocksize;
+        _blockfree.clear();
+        _freeblocks.clear();
+        for (uint32_t i=0 ; i<_size ; i++) {
+            if (i%_blocksize==0)
+                _blockfree.push_back(0);
+            if (_free[i])
+                _blockfree[i/_blocksize]++;
+        }
+        for (uint32_t blk=0 ; blk<_blockfree.size() ; blk++)
+            setblock(blk, _blockfree[blk]);
+    }
+    uint32_t size() const { return _size; }
+
+    // grow the map, new units are free
+    void resize(uint32_t newsize)
+    {
+        if (newsize<=_size)
+            return;
+        uint32_t oldsize= _size;
+        _free.resize(newsize, true);
+        _size= newsize;
+        _blockfree.resize((newsize+_blocksize-1)/_blocksize, 0);
+        for (uint32_t blk= oldsize/_blocksize ; blk<_blockfree.size() ; blk++) {
+            uint32_t first= std::max(oldsize, blk*_blocksize);
+            uint32_t last= std::min(newsize, (blk+1)*_blocksize);
+            setblock(blk, _blockfree[blk]+last-first);
+        }
+
+        if (newsize>_cap) {
+            uint32_t cap= _cap;
+            while (cap<newsize)
+                cap*=2;
+            rebuild(cap);
+            return;
+        }
+        for (uint32_t i= oldsize ; i<newsize ; i++)
+            setleaf(i, true);
+        update(oldsize, newsize);
+    }
+    void mark(uint32_t ix, uint32_t n, bool isfree)
+    {
+        if (n==0)
+            return;
+        resize(ix+n);
+        for (uint32_t i= ix ; i<ix+n ; i++) {
+            if (_free[i]==isfree)
+                continue;
+            _free[i]= isfree;
+            setleaf(i, isfree);
+            uint32_t blk= i/_blocksize;
+            setblock(blk, _blockfree[blk] + (isfree ? 1 : -1));
+        }
+        update(ix, ix+n);
+    }
+    bool isfree(uint32_t ix) const { return ix<_size && _free[ix]; }
+
+    // nr of free units at the end of the map
+    uint32_t freeatend() const
+    {
+        // walk the nodes covering [0,_size) from right to left
+        uint32_t n= 0;
+        uint32_t end= _size;
+        while (end>0) {
+            // largest aligned node ending at 'end'
+            uint32_t len= end & (0-end);
+            uint32_t i= (_cap+end-len)/len;
+            n += _tree[i].suf;
+            if (_tree[i].suf<len)
+                break;
+            end -= len;
+        }
+        return n;
+    }
+
+    // lowest index starting a run of n free units, or -1
+    int64_t findrun(uint32_t n) const
+    {
+        if (n==0 || _tree[1].best<n)
+            return -1;
+        uint32_t i= 1;
+        uint32_t start= 0;
+        uint32_t len= _cap;
+        while (i<_cap) {
+            len/=2;
+            const node& l= _tree[2*i];
+            const node& r= _tree[2*i+1];
+            if (l.best>=n) {
+                i= 2*i;
+            }
+            else if (l.suf+r.pref>=n) {
+                return start+len-l.suf;
+            }
+            else {
+                i= 2*i+1;
+                start += len;
+            }
+        }
+        return start;
+    }
+    // lowest fully free block, or -1
+    int64_t findblock() const
+    {
+        if (_freeblocks.empty())
+            return -1;
+        return *_freeblocks.begin();
+    }
+};
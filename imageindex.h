@@ -0,0 +1,269 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <openssl/sha.h>
+
+extern int g_verbose;
+
+// sidecar index file, 'image.eidx', with the structures found while opening an image.
+//
+// readers and filesystems store their scan results as named blobs,
+// on the next run they restore from these instead of scanning the image again.
+//
+// the index is only used for the exact image it was made from:
+// it records the image size, mtime and a sha1 of the first 64k of the image,
+// plus the commandline options which change how the image is decoded.
+//
+// the index is written on exit, only when something new was stored,
+// and the image did not change during the run.
+
+// helpers for building and parsing blobs
+class indexwriter {
+    std::vector<uint8_t>& _v;
+public:
+    explicit indexwriter(std::vector<uint8_t>& v) : _v(v) { }
+    void put32(uint32_t x)
+    {
+        for (int i=0 ; i<4 ; i++)
+            _v.push_back(uint8_t(x>>(8*i)));
+    }
+    void put64(uint64_t x)
+    {
+        put32(uint32_t(x));
+        put32(uint32_t(x>>32));
+    }
+    void putbytes(const void *p, size_t n)
+    {
+        put32(uint32_t(n));
+        _v.insert(_v.end(), (const uint8_t*)p, (const uint8_t*)p+n);
+    }
+    void putstr(const std::string& s)
+    {
+        putbytes(s.data(), s.size());
+    }
+};
+class indexreader {
+    const std::vector<uint8_t>& _v;
+    size_t _pos;
+public:
+    explicit indexreader(const std::vector<uint8_t>& v) : _v(v), _pos(0) { }
+    uint32_t get32()
+    {
+        if (_pos+4 > _v.size())
+            throw "index: truncated";
+        uint32_t x= _v[_pos] | (_v[_pos+1]<<8) | (_v[_pos+2]<<16) | (uint32_t(_v[_pos+3])<<24);
+        _pos += 4;
+        return x;
+    }
+    uint64_t get64()
+    {
+        uint64_t lo= get32();
+        return lo | (uint64_t(get32())<<32);
+    }
+    // returns a pointer to the data, and its size in 'n'
+    const uint8_t* getbytes(size_t& n)
+    {
+        n= get32();
+        if (_pos+n > _v.size())
+            throw "index: truncated";
+        const uint8_t *p= _v.data()+_pos;
+        _pos += n;
+        return p;
+    }
+    std::string getstr()
+    {
+        size_t n;
+        const uint8_t *p= getbytes(n);
+        return std::string((const char*)p, n);
+    }
+    bool eof() const { return _pos==_v.size(); }
+};
+
+class imageindex {
+    enum { VERSION= 2, HASHSIZE= 0x10000 };
+
+    struct imagekey {
+        uint64_t size;
+        int64_t mtime;
+        uint32_t mtimensec;
+        uint8_t hash[SHA_DIGEST_LENGTH];
+        std::string options;
+
+        bool operator==(const imagekey& rhs) const
+        {
+            return size==rhs.size && mtime==rhs.mtime && mtimensec==rhs.mtimensec
+                && memcmp(hash, rhs.hash, sizeof(hash))==0 && options==rhs.options;
+        }
+    };
+    bool _enabled;
+    std::string _imgname;
+    std::string _idxname;
+    imagekey _key;
+
+    typedef std::map<std::string,std::vector<uint8_t> > blobmap_t;
+    blobmap_t _blobs;
+    bool _modified;
+
+    static bool getkey(const std::string& imgname, const std::string& options, imagekey& key)
+    {
+        struct stat st;
+        if (stat(imgname.c_str(), &st))
+            return false;
+        key.size= st.st_size;
+        key.mtime= st.st_mtime;
+#if defined(__APPLE__)
+        key.mtimensec= st.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+        key.mtimensec= 0;
+#else
+        key.mtimensec= st.st_mtim.tv_nsec;
+#endif
+        key.options= options;
+
+        FILE *f= fopen(imgname.c_str(), "rb");
+        if (!f)
+            return false;
+        std::vector<uint8_t> buf(HASHSIZE);
+        size_t n= fread(&buf[0], 1, buf.size(), f);
+        fclose(f);
+        SHA1(&buf[0], n, key.hash);
+        return true;
+    }
+    static void putkey(indexwriter& w, const imagekey& key)
+    {
+        w.put64(key.size);
+        w.put64(uint64_t(key.mtime));
+        w.put32(key.mtimensec);
+        w.putbytes(key.hash, sizeof(key.hash));
+        w.putstr(key.options);
+    }
+    static void getkey(indexreader& r, imagekey& key)
+    {
+        key.size= r.get64();
+        key.mtime= int64_t(r.get64());
+        key.mtimensec= r.get32();
+        size_t n;
+        const uint8_t *p= r.getbytes(n);
+        if (n!=sizeof(key.hash))
+            throw "index: invalid hash";
+        memcpy(key.hash, p, n);
+        key.options= r.getstr();
+    }
+    void load()
+    {
+        FILE *f= fopen(_idxname.c_str(), "rb");
+        if (!f)
+            return;
+        std::vector<uint8_t> data;
+        uint8_t buf[0x10000];
+        size_t n;
+        while ((n= fread(buf, 1, sizeof(buf), f))>0)
+            data.insert(data.end(), buf, buf+n);
+        fclose(f);
+
+        try {
+            indexreader r(data);
+            if (r.get32()!=0x58444945 || r.get32()!=VERSION)   // 'EIDX'
+                return;
+            imagekey key;
+            getkey(r, key);
+            if (!(key==_key)) {
+                if (g_verbose)
+                    printf("index %s is out of date\n", _idxname.c_str());
+                return;
+            }
+            uint32_t count= r.get32();
+            while (count--) {
+                std::string name= r.getstr();
+                size_t size;
+                const uint8_t *p= r.getbytes(size);
+                _blobs[name].assign(p, p+size);
+            }
+            if (g_verbose)
+                printf("using index %s\n", _idxname.c_str());
+        }
+        catch(const char*msg) {
+            printf("ignoring index %s: %s\n", _idxname.c_str(), msg);
+            _blobs.clear();
+        }
+    }
+public:
+    imageindex()
+        : _enabled(false), _modified(false)
+    {
+    }
+    bool enabled() const { return _enabled; }
+
+    // 'options' : describes the commandline options affecting how the image is decoded.
+    // when 'modifying' is set, the existing index is removed, and not used.
+    void open(const std::string& imgname, const std::string& options, bool modifying)
+    {
+        _imgname= imgname;
+        _idxname= imgname+".eidx";
+        if (modifying) {
+            remove(_idxname.c_str());
+            return;
+        }
+        if (!getkey(imgname, options, _key))
+            return;
+        _enabled= true;
+        load();
+    }
+    // returns NULL when 'name' is not in the index
+    const std::vector<uint8_t>* find(const std::string& name) const
+    {
+        if (!_enabled)
+            return NULL;
+        auto i= _blobs.find(name);
+        if (i==_blobs.end())
+            return NULL;
+        return &i->second;
+    }
+    void store(const std::string& name, std::vector<uint8_t>& blob)
+    {
+        if (!_enabled)
+            return;
+        _blobs[name].swap(blob);
+        _modified= true;
+    }
+    // call after the image has been closed
+    void save()
+    {
+        if (!_enabled || !_modified)
+            return;
+        imagekey key;
+        if (!getkey(_imgname, _key.options, key) || !(key==_key)) {
+            printf("image changed, not saving index\n");
+            return;
+        }
+        std::vector<uint8_t> data;
+        indexwriter w(data);
+        w.put32(0x58444945);
+        w.put32(VERSION);
+        putkey(w, _key);
+        w.put32(uint32_t(_blobs.size()));
+        for (auto const& b : _blobs) {
+            w.putstr(b.first);
+            w.putbytes(b.second.data(), b.second.size());
+        }
+
+        std::string tmpname= _idxname+".tmp";
+        FILE *f= fopen(tmpname.c_str(), "wb");
+        if (!f) {
+            printf("could not create index %s\n", _idxname.c_str());
+            return;
+        }
+        bool ok= fwrite(data.data(), 1, data.size(), f)==data.size();
+        ok= fclose(f)==0 && ok;
+        remove(_idxname.c_str());
+        if (!ok || rename(tmpname.c_str(), _idxname.c_str())) {
+            printf("error writing index %s\n", _idxname.c_str());
+            remove(tmpname.c_str());
+        }
+    }
+};
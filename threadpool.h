@@ -0,0 +1,115 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <deque>
+#include <vector>
+
+// fixed size pool of worker threads.
+//
+// with nthreads<=1 no threads are started, and tasks run directly from 'add',
+// so the single threaded behaviour stays exactly the same.
+//
+// the first exception thrown by a task is rethrown from 'wait'.
+class threadpool {
+    typedef std::function<void()> task_t;
+
+    std::vector<std::thread> _workers;
+    std::deque<task_t> _queue;
+
+    std::mutex _lock;
+    std::condition_variable _taskavailable;
+    std::condition_variable _alldone;
+
+    unsigned _busy;
+    unsigned _maxqueue;
+    bool _stopping;
+    std::exception_ptr _error;
+
+    void worker()
+    {
+        while (true) {
+            task_t task;
+            {
+                std::unique_lock<std::mutex> lock(_lock);
+                _taskavailable.wait(lock, [this]() { return _stopping || !_queue.empty(); });
+                if (_queue.empty())
+                    return;
+                task= std::move(_queue.front());
+                _queue.pop_front();
+                _busy++;
+            }
+            // a slot in the queue has become available
+            _alldone.notify_all();
+
+            run(task);
+
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                _busy--;
+            }
+            _alldone.notify_all();
+        }
+    }
+    void run(task_t& task)
+    {
+        try {
+            task();
+        }
+        catch(...) {
+            std::lock_guard<std::mutex> lock(_lock);
+            if (!_error)
+                _error= std::current_exception();
+        }
+    }
+public:
+    explicit threadpool(unsigned nthreads)
+        : _busy(0), _maxqueue(nthreads*4), _stopping(false)
+    {
+        if (nthreads>1)
+            for (unsigned i=0 ; i<nthreads ; i++)
+                _workers.push_back(std::thread([this]() { worker(); }));
+    }
+    ~threadpool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _stopping= true;
+        }
+        _taskavailable.notify_all();
+        for (auto& t : _workers)
+            t.join();
+    }
+    unsigned size() const { return _workers.empty() ? 1 : _workers.size(); }
+
+    // queue a task, blocks while the queue is full
+    void add(task_t task)
+    {
+        if (_workers.empty()) {
+            run(task);
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _alldone.wait(lock, [this]() { return _queue.size() < _maxqueue; });
+            _queue.push_back(std::move(task));
+        }
+        _taskavailable.notify_one();
+    }
+
+    // wait until all queued tasks have finished
+    void wait()
+    {
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _alldone.wait(lock, [this]() { return _queue.empty() && _busy==0; });
+            error= _error;
+            _error= nullptr;
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
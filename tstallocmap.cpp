@@ -1,26 +1,47 @@
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <chrono>
 #include "allocmap.h"
+#include "tstutil.h"
+
+// unit test for allocmap, run with '-bench' for the microbenchmark.
+
+typedef allocmap::extentlist extentlist;
+
+bool sameextents(const allocmap& m, const extentlist& expected)
+{
+    allocmap::extentlist e= m.extents();
+    if (e.size()!=expected.size())
+        return false;
+    for (unsigned i=0 ; i<e.size() ; i++)
+        if (e[i].ofs!=expected[i].ofs || e[i].size!=expected[i].size)
+            return false;
+    return true;
+}
 
 struct maptest_t {
     bool use; uint32_t ofs; uint32_t size;
 };
 maptest_t tests[]= {
-    { 1, 0x80080000, 0x123 }, 
-    { 1, 0x80080124, 0x121 }, 
-    { 1, 0x80001000, 0x2000 }, 
-    { 0, 0x80001200, 0x123 }, 
-    { 0, 0x80002000, 0x120 }, 
-    { 0, 0x80002200, 0x121 }, 
-    { 0, 0x80002400, 0x122 }, 
-    { 0, 0x80002600, 0x123 }, 
-    { 0, 0x80002800, 0x124 }, 
+    { 1, 0x80080000, 0x123 },
+    { 1, 0x80080124, 0x121 },
+    { 1, 0x80001000, 0x2000 },
+    { 0, 0x80001200, 0x123 },
+    { 0, 0x80002000, 0x120 },
+    { 0, 0x80002200, 0x121 },
+    { 0, 0x80002400, 0x122 },
+    { 0, 0x80002600, 0x123 },
+    { 0, 0x80002800, 0x124 },
 };
 void tstamap()
 {
     allocmap m;
-    printf("free of empty map\n");
-    for (unsigned n= 0 ; n<16 ; n++)
-        printf("%04x: %08x\n", n, m.findfree(n));
+    CHECK(m.findfree(0x10)==0);
+    CHECK(sameextents(m, {{0, 0x10}}));
+    m.markfree(0, 0x10);
+    CHECK(m.extents().empty());
 
     for (unsigned i=0 ; i<sizeof(tests)/sizeof(*tests) ; ++i)
     {
@@ -28,49 +49,266 @@ void tstamap()
             m.markused(tests[i].ofs, tests[i].size, "test");
         else
             m.markfree(tests[i].ofs, tests[i].size);
-        printf("exec %s %08x, %x\n", tests[i].use? "use":"free", tests[i].ofs, tests[i].size);
-        m.printallocmap();
     }
+    CHECK(sameextents(m, {
+        {0x80001000, 0x200}, {0x80001323, 0xcdd}, {0x80002120, 0xe0}, {0x80002321, 0xdf},
+        {0x80002522, 0xde}, {0x80002723, 0xdd}, {0x80002924, 0x6dc}, {0x80080000, 0x123},
+        {0x80080124, 0x121} }));
 
-    printf("free\n");
-    for (unsigned n= 0 ; n<0x4000 ; n++)
-        printf("%04x: %08x\n", n, m.findfree(n));
+    // first fit
+    CHECK(m.findfree(0)==0x80001000);
+    CHECK(m.findfree(0x123)==0x80001200);
+    CHECK(m.findfree(0x100)==0x80002000);
+    CHECK(m.findfree(0x20)==0x80002100);
+    CHECK(m.findfree(1)==0x80002200);
+    CHECK(sameextents(m, {
+        {0x80001000, 0x1201}, {0x80002321, 0xdf}, {0x80002522, 0xde}, {0x80002723, 0xdd},
+        {0x80002924, 0x6dc}, {0x80080000, 0x123}, {0x80080124, 0x121} }));
+
+    // best fit: the 0x120 gap at 2201 is smaller than the 0x122, 0x123 and 0x124 gaps
+    CHECK(m.findbestfit(0x44)==0x80002201);
+    // aligned: the gap at 2245 has room for 0x40 bytes, but not at a 0x100 boundary
+    CHECK(m.findaligned(0x10, 0x100)==0x80002300);
+    CHECK(m.findaligned(0x40, 0x100)==0x80002400);
 }
+
 struct maptest2_t {
     int n;
     maptest_t  init[4];
+    extentlist expected;
 };
 maptest2_t tests2[]= {
-    { 2, {{ 1, 0x10000, 0x100}, { 1, 0x10100, 0x100 } }},
-    //{ 2, {{ 1, 0x10000, 0x100}, { 1, 0x100f0, 0x100 } }}, -> overlap
-    //{ 2, {{ 1, 0x10000, 0x100}, { 1, 0x10080, 0x10 }  }}, -> overlap
-    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10080, 0x80 }  }},
-    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10000, 0x80 }  }},
-    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10080, 0x10 }  }},
+    { 2, {{ 1, 0x10000, 0x100}, { 1, 0x10100, 0x100 } }, {{0x10000, 0x200}} },
+    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10080, 0x80 }  }, {{0x10000, 0x80}} },
+    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10000, 0x80 }  }, {{0x10080, 0x80}} },
+    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10080, 0x10 }  }, {{0x10000, 0x80}, {0x10090, 0x70}} },
+    { 2, {{ 1, 0x10000, 0x100}, { 0, 0x10000, 0x100 } }, {} },
+    { 3, {{ 1, 0x10000, 0x100}, { 1, 0x10200, 0x100 }, { 1, 0x10100, 0x100 } }, {{0x10000, 0x300}} },
 };
 void tstamap2()
 {
     for (unsigned i=0 ; i<sizeof(tests2)/sizeof(*tests2) ; ++i)
     {
-        printf("test2: %d\n", i);
         maptest2_t & t= tests2[i];
         allocmap m;
-        for (unsigned j=0 ; j<t.n ; j++) {
+        for (int j=0 ; j<t.n ; j++) {
             maptest_t & I= t.init[j];
             if (I.use)
                 m.markused(I.ofs, I.size, "test2");
             else
                 m.markfree(I.ofs, I.size);
         }
-        m.printallocmap();
+        if (!sameextents(m, t.expected)) {
+            printf("test2: %d\n", i);
+            m.printallocmap();
+            g_failures++;
+        }
+    }
+}
+
+void tsterrors()
+{
+    allocmap m;
+    m.markused(0x1000, 0x100, "err");
+    const char *msg= NULL;
+    try { m.markfree(0x800, 0x10); } catch(const char*e) { msg= e; }
+    CHECK(msg && strcmp(msg, "nothing to free")==0);
+    msg= NULL;
+    try { m.markfree(0x1080, 0x100); } catch(const char*e) { msg= e; }
+    CHECK(msg && strcmp(msg, "freeing empty")==0);
+}
+
+void tstbulk()
+{
+    allocmap a, b;
+    a.markused(0x100, 0x10, "hdr");
+    b.markused(0x100, 0x10, "hdr");
+    b.beginbulk();
+    for (uint32_t i=0 ; i<1000 ; i++) {
+        uint32_t ofs= 0x1000 + ((i*7919)%1000)*0x20;
+        a.markused(ofs, 0x10+(i%3)*0x8, "single");
+        b.markused(ofs, 0x10+(i%3)*0x8, "bulk");
+    }
+    b.endbulk();
+    CHECK(sameextents(b, a.extents()));
+    CHECK(a.findfree(0x18)==b.findfree(0x18));
+}
+
+// compare with a byte per address reference model
+void tstrandom()
+{
+    enum { SPACE= 4096 };
+    srand(1234);
+    for (int round=0 ; round<50 ; round++) {
+        allocmap m;
+        std::vector<bool> used(SPACE+1024, false);
+
+        auto refextents= [&]() {
+            extentlist l;
+            for (uint32_t i=0 ; i<used.size() ; i++) {
+                if (!used[i])
+                    continue;
+                if (!l.empty() && l.back().end()==i)
+                    l.back().size++;
+                else
+                    l.push_back(allocmap::extent{i, 1});
+            }
+            return l;
+        };
+        auto isfree= [&](uint32_t ofs, uint32_t size) {
+            for (uint32_t i=ofs ; i<ofs+size ; i++)
+                if (used[i])
+                    return false;
+            return true;
+        };
+        auto setused= [&](uint32_t ofs, uint32_t size, bool flag) {
+            for (uint32_t i=ofs ; i<ofs+size ; i++)
+                used[i]= flag;
+        };
+
+        for (int step=0 ; step<400 ; step++) {
+            extentlist ref= refextents();
+            uint32_t size= 1+rand()%40;
+            switch(rand()%5) {
+            case 0: {
+                uint32_t ofs= rand()%SPACE;
+                if (isfree(ofs, size)) {
+                    m.markused(ofs, size, "rnd");
+                    setused(ofs, size, true);
+                }
+                break;
+            }
+            case 1:
+                if (!ref.empty()) {
+                    auto const& e= ref[rand()%ref.size()];
+                    uint32_t ofs= e.ofs+rand()%e.size;
+                    uint32_t n= 1+rand()%(e.end()-ofs);
+                    m.markfree(ofs, n);
+                    setused(ofs, n, false);
+                }
+                break;
+            case 2: {
+                uint32_t expected= 0;
+                if (!ref.empty()) {
+                    expected= ref.back().end();
+                    for (unsigned k=0 ; k+1<ref.size() ; k++)
+                        if (ref[k+1].ofs-ref[k].end() >= size) {
+                            expected= ref[k].end();
+                            break;
+                        }
+                }
+                if (expected+size > used.size())
+                    break;
+                CHECK(m.findfree(size)==expected);
+                setused(expected, size, true);
+                break;
+            }
+            case 3: {
+                uint32_t expected= 0;
+                if (!ref.empty()) {
+                    expected= ref.back().end();
+                    uint32_t bestgap= 0;
+                    for (unsigned k=0 ; k+1<ref.size() ; k++) {
+                        uint32_t gap= ref[k+1].ofs-ref[k].end();
+                        if (gap>=size && (bestgap==0 || gap<bestgap)) {
+                            bestgap= gap;
+                            expected= ref[k].end();
+                        }
+                    }
+                }
+                if (expected+size > used.size())
+                    break;
+                CHECK(m.findbestfit(size)==expected);
+                setused(expected, size, true);
+                break;
+            }
+            case 4: {
+                uint32_t align= 1<<(rand()%6);
+                auto alignup= [align](uint32_t x) { return (x+align-1)/align*align; };
+                uint32_t expected= 0;
+                if (!ref.empty()) {
+                    expected= alignup(ref.back().end());
+                    for (unsigned k=0 ; k+1<ref.size() ; k++)
+                        if (alignup(ref[k].end())+size <= ref[k+1].ofs) {
+                            expected= alignup(ref[k].end());
+                            break;
+                        }
+                }
+                if (expected+size > used.size())
+                    break;
+                CHECK(m.findaligned(size, align)==expected);
+                setused(expected, size, true);
+                break;
+            }
+            }
+            if (!sameextents(m, refextents())) {
+                printf("random: round %d, step %d: mismatch\n", round, step);
+                g_failures++;
+                return;
+            }
+        }
+    }
+}
+
+void benchmark()
+{
+    enum { NRANGES= 100000 };
+    typedef std::chrono::steady_clock clock;
+    auto ms= [](clock::time_point t0) { return std::chrono::duration<double,std::milli>(clock::now()-t0).count(); };
+
+    // 100k used ranges with gaps of 0x10..0x4f bytes
+    std::vector<allocmap::extent> ranges;
+    uint32_t ofs= 0x80000000;
+    srand(42);
+    for (int i=0 ; i<NRANGES ; i++) {
+        uint32_t size= 0x20+4*(rand()%64);
+        ranges.push_back(allocmap::extent{ofs, size});
+        ofs += size + 0x10+4*(rand()%16);
     }
+
+    auto t0= clock::now();
+    allocmap m;
+    m.beginbulk();
+    for (auto const& r : ranges)
+        m.markused(r.ofs, r.size, "bench");
+    m.endbulk();
+    printf("bulk markused    %6d ranges: %8.2f ms\n", NRANGES, ms(t0));
+
+    t0= clock::now();
+    allocmap m2;
+    for (auto const& r : ranges)
+        m2.markused(r.ofs, r.size, "bench");
+    printf("ordered markused %6d ranges: %8.2f ms\n", NRANGES, ms(t0));
+
+    // gaps of 0x40 and up are rare, so most of these have to look far
+    t0= clock::now();
+    for (int i=0 ; i<NRANGES ; i++)
+        m.findfree(0x40+4*(i%4));
+    printf("findfree         %6d allocs: %8.2f ms\n", NRANGES, ms(t0));
+
+    t0= clock::now();
+    for (int i=0 ; i<NRANGES/10 ; i++) {
+        auto const& r= ranges[(i*7919)%NRANGES];
+        m2.markfree(r.ofs, 4);
+    }
+    printf("markfree         %6d frees : %8.2f ms\n", NRANGES/10, ms(t0));
+
+    t0= clock::now();
+    for (int i=0 ; i<NRANGES/10 ; i++)
+        m2.findbestfit(4);
+    printf("findbestfit      %6d allocs: %8.2f ms\n", NRANGES/10, ms(t0));
 }
 
-int main(int,char**)
+int main(int argc,char**argv)
 {
     try {
     tstamap();
     tstamap2();
+    tsterrors();
+    tstbulk();
+    tstrandom();
+    if (argc>1 && strcmp(argv[1], "-bench")==0)
+        benchmark();
     }
     catch(const char*msg)
     {
@@ -82,5 +320,5 @@ int main(int,char**)
         printf("EXCEPTION\n");
         return 1;
     }
-    return 0;
+    return testresult("allocmap");
 }
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <map>
+#include <algorithm>
+#include "blocktable.h"
+#include "tstutil.h"
+
+// unit test for blocktable, compared against a std::map.
+// floor() is queried in patterns which hit and miss the cursor.
+
+typedef blocktable<uint32_t, uint32_t> table_t;
+typedef std::map<uint32_t, uint32_t> model_t;
+
+// the key of the last block starting at or before 'key'
+bool samefloor(const table_t& t, const model_t& ref, uint32_t key)
+{
+    size_t ix= t.floor(key);
+    auto i= ref.upper_bound(key);
+    if (i==ref.begin())
+        return ix==table_t::npos;
+    --i;
+    return ix!=table_t::npos && t.key(ix)==i->first && t[ix]==i->second;
+}
+
+void tstempty()
+{
+    table_t t;
+    CHECK(t.empty());
+    CHECK(t.floor(0)==table_t::npos);
+    CHECK(t.floor(~0U)==table_t::npos);
+    CHECK(t.find(0)==table_t::npos);
+
+    t.set(10, 1);
+    CHECK(t.floor(9)==table_t::npos);
+    CHECK(t.floor(10)==0);
+    CHECK(t.floor(~0U)==0);
+
+    // insert keeps the existing item, set replaces it
+    CHECK(!t.insert(10, 2));
+    CHECK(t[0]==1);
+    t.set(10, 3);
+    CHECK(t[0]==3);
+    CHECK(t.size()==1);
+}
+
+void tstrandom()
+{
+    srand(1234);
+    for (int round=0 ; round<100 ; round++) {
+        table_t t;
+        model_t ref;
+        uint32_t space= 1+rand()%100000;
+        int nkeys= rand()%300;
+        for (int k=0 ; k<nkeys ; k++) {
+            uint32_t key= rand()%space;
+            uint32_t item= rand();
+            if (rand()%2) {
+                t.set(key, item);
+                ref[key]= item;
+            }
+            else {
+                CHECK(t.insert(key, item)==ref.insert(model_t::value_type(key, item)).second);
+            }
+        }
+        CHECK(t.size()==ref.size());
+
+        // keys are sorted, and find locates each of them
+        size_t ix= 0;
+        for (auto const& kv : ref) {
+            CHECK(t.key(ix)==kv.first);
+            CHECK(t.find(kv.first)==ix);
+            ix++;
+        }
+
+        // sequential, with small steps: mostly cursor hits
+        for (uint32_t key=0 ; key<space+10 ; key+=1+rand()%50)
+            CHECK(samefloor(t, ref, key));
+        // backwards: the cursor is always behind
+        for (uint32_t key=space+10 ; key>0 ; key-= std::min(key, uint32_t(1+rand()%50)))
+            CHECK(samefloor(t, ref, key));
+        // random
+        for (int q=0 ; q<1000 ; q++)
+            CHECK(samefloor(t, ref, rand()%(space+10)));
+        // exactly on, and just before each key
+        for (auto const& kv : ref) {
+            CHECK(samefloor(t, ref, kv.first));
+            if (kv.first)
+                CHECK(samefloor(t, ref, kv.first-1));
+        }
+        CHECK(samefloor(t, ref, ~0U));
+
+        // adding keys moves items after the cursor
+        t.floor(space/2);
+        for (int k=0 ; k<10 ; k++) {
+            uint32_t key= rand()%space;
+            t.set(key, k);
+            ref[key]= k;
+        }
+        for (uint32_t key=0 ; key<space+10 ; key+=1+rand()%50)
+            CHECK(samefloor(t, ref, key));
+    }
+}
+
+int main()
+{
+    tstempty();
+    tstrandom();
+
+    return testresult("blocktable");
+}
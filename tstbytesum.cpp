@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include "bytesum.h"
+#include "tstutil.h"
+
+// unit test for bytesum, compared against the plain loop,
+// for all alignments and lengths around the vector sizes.
+
+uint32_t refsum(const uint8_t *p, size_t n)
+{
+    uint32_t sum= 0;
+    while (n--)
+        sum += *p++;
+    return sum;
+}
+
+void tstalignment()
+{
+    srand(1234);
+    std::vector<uint8_t> data(0x200+64);
+    for (auto& b : data)
+        b= rand();
+
+    for (size_t ofs=0 ; ofs<64 ; ofs++)
+        for (size_t n=0 ; n<=0x200 ; n++)
+            CHECK(bytesum(&data[ofs], n)==refsum(&data[ofs], n));
+}
+
+void tstlarge()
+{
+    // all 0xFF: the 32 bit sum wraps, the 64 bit lanes must not overflow
+    std::vector<uint8_t> ff(0x1000003, 0xFF);
+    CHECK(bytesum(&ff[0], ff.size())==refsum(&ff[0], ff.size()));
+    CHECK(bytesum(&ff[1], ff.size()-1)==refsum(&ff[1], ff.size()-1));
+
+    std::vector<uint8_t> data(0x10001);
+    for (auto& b : data)
+        b= rand();
+    CHECK(bytesum(&data[0], data.size())==refsum(&data[0], data.size()));
+    CHECK(bytesum(&data[3], data.size()-3)==refsum(&data[3], data.size()-3));
+}
+
+int main()
+{
+    tstalignment();
+    tstlarge();
+
+    return testresult("bytesum");
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#include "xpr_codec.h"
+#include "xph_codec.h"
+#include "lzx_codec.h"
+#include "rom34_codec.h"
+#include "tstutil.h"
+#include "tstcodecs_vectors.h"
+
+// round trip test for the native XPR, XPH, LZX, ROM3 and ROM4 codecs,
+// and known answer tests against the output of the compression dlls.
+
+typedef std::vector<uint8_t> ByteVector;
+typedef uint32_t (*codecfn)(const uint8_t *in, uint32_t insize, uint8_t *out, uint32_t outsize);
+
+struct codec_t {
+    const char *name;
+    codecfn compress;
+    codecfn decompress;
+};
+codec_t codecs[]= {
+    { "xpr", xpr_compress, xpr_decompress },
+    { "xph", xph_compress, xph_decompress },
+    { "lzx", lzx_compress, lzx_decompress },
+    { "rom3", rom3_compress, rom3_decompress },
+    { "rom4", rom4_compress, rom4_decompress },
+};
+
+enum { GUARD= 64, GUARDBYTE= 0xA5 };
+
+bool guardintact(const ByteVector& buf, size_t size)
+{
+    for (size_t i=size ; i<size+GUARD ; i++)
+        if (buf[i]!=GUARDBYTE)
+            return false;
+    return true;
+}
+
+// compresses 'data' and checks that it decompresses to the same bytes
+void roundtrip(const codec_t& c, const char *desc, const ByteVector& data)
+{
+    uint32_t n= data.size();
+    const uint8_t *in= data.empty() ? NULL : &data[0];
+
+    // room for the worst case expansion
+    uint32_t compmax= 2*n+0x1000;
+    ByteVector comp(compmax+GUARD, GUARDBYTE);
+    uint32_t compsize= c.compress(in, n, &comp[0], compmax);
+    if (compsize==0xFFFFFFFF || compsize>compmax) {
+        printf("%s %s: compress failed: %08x\n", c.name, desc, compsize);
+        g_failures++;
+        return;
+    }
+    CHECK(guardintact(comp, compmax));
+
+    ByteVector full(n+GUARD, GUARDBYTE);
+    uint32_t fullsize= c.decompress(&comp[0], compsize, &full[0], n);
+    if (fullsize!=n) {
+        printf("%s %s: decompress returned %08x, expected %08x\n", c.name, desc, fullsize, n);
+        g_failures++;
+        return;
+    }
+    CHECK(guardintact(full, n));
+    if (!std::equal(data.begin(), data.end(), full.begin())) {
+        printf("%s %s: data differs after roundtrip\n", c.name, desc);
+        g_failures++;
+    }
+}
+
+// like eimgfs does, compress into a buffer smaller than the input:
+// incompressible data must fail, without writing past the end.
+void tstnoexpand(const codec_t& c, const char *desc, const ByteVector& data)
+{
+    uint32_t n= data.size();
+    ByteVector comp(n-1+GUARD, GUARDBYTE);
+    uint32_t compsize= c.compress(&data[0], n, &comp[0], n-1);
+    if (compsize!=0xFFFFFFFF) {
+        printf("%s %s: expected compress to fail, got %08x\n", c.name, desc, compsize);
+        g_failures++;
+    }
+    CHECK(guardintact(comp, n-1));
+}
+
+ByteVector randomdata(size_t n)
+{
+    ByteVector data(n);
+    for (size_t i=0 ; i<n ; i++)
+        data[i]= rand();
+    return data;
+}
+// text like data, with many short repeats
+ByteVector textdata(size_t n)
+{
+    static const char *words[]= { "the ", "image ", "file ", "system ", "block ", "chunk ", "\r\n", "0x1000 " };
+    ByteVector data;
+    while (data.size()<n) {
+        const char *w= words[rand()%8];
+        data.insert(data.end(), w, w+strlen(w));
+    }
+    data.resize(n);
+    return data;
+}
+
+void tstcodec(const codec_t& c)
+{
+    srand(1234);
+
+    roundtrip(c, "empty", ByteVector());
+    roundtrip(c, "1 byte", ByteVector(1, 0x41));
+    roundtrip(c, "2 bytes", ByteVector(2, 0x42));
+    roundtrip(c, "3 bytes", ByteVector{1,2,3});
+
+    // the frame and block sizes, and one byte around them
+    for (size_t n : { size_t(0x8000), size_t(0x10000) }) {
+        for (size_t m : { n-1, n, n+1 }) {
+            char desc[64];
+            snprintf(desc, sizeof(desc), "text %x", unsigned(m));
+            roundtrip(c, desc, textdata(m));
+            snprintf(desc, sizeof(desc), "random %x", unsigned(m));
+            roundtrip(c, desc, randomdata(m));
+        }
+    }
+    roundtrip(c, "random 1000", randomdata(0x1000));
+    roundtrip(c, "random 3", randomdata(3));
+    tstnoexpand(c, "random 1000", randomdata(0x1000));
+    tstnoexpand(c, "random 10000", randomdata(0x10000));
+
+    // long runs, longer than the maximum match length
+    roundtrip(c, "zeros 1000", ByteVector(0x1000, 0));
+    roundtrip(c, "zeros 20000", ByteVector(0x20000, 0));
+    roundtrip(c, "ff 10001", ByteVector(0x10001, 0xFF));
+    ByteVector runs;
+    for (int i=0 ; i<64 ; i++)
+        runs.insert(runs.end(), 1+rand()%2000, uint8_t(rand()));
+    roundtrip(c, "runs", runs);
+
+    // mixed: repeats with a distance larger than a block
+    ByteVector head= randomdata(0x3000);
+    ByteVector text= textdata(0xC000);
+    ByteVector mixed= head;
+    mixed.insert(mixed.end(), text.begin(), text.end());
+    mixed.insert(mixed.end(), head.begin(), head.end());
+    roundtrip(c, "mixed", mixed);
+}
+
+// the inputs of the known answers, from a fixed generator,
+// so they do not depend on the rand() of the c library.
+uint32_t g_kaseed;
+uint32_t karand()
+{
+    g_kaseed= g_kaseed*1103515245+12345;
+    return (g_kaseed>>16)&0x7FFF;
+}
+// text, optionally with x86 call instructions, for the lzx e8 translation
+ByteVector kawords(size_t n, bool calls)
+{
+    static const char *words[]= { "the ", "image ", "file ", "system ", "block ", "chunk ", "\r\n", "0x1000 " };
+    g_kaseed= 1;
+    ByteVector data;
+    while (data.size()<n) {
+        if (calls && karand()%4==0) {
+            uint32_t rel= karand()%0x2000 - 0x1000;
+            data.push_back(0xE8);
+            for (int i=0 ; i<4 ; i++)
+                data.push_back(uint8_t(rel>>(8*i)));
+        }
+        else {
+            const char *w= words[karand()%8];
+            data.insert(data.end(), w, w+strlen(w));
+        }
+    }
+    data.resize(n);
+    return data;
+}
+ByteVector kainput(const char *name)
+{
+    if (strcmp(name, "abc")==0) {
+        ByteVector data;
+        for (int i=0 ; i<100 ; i++)
+            data.insert(data.end(), { 'a', 'b', 'c' });
+        return data;
+    }
+    if (strcmp(name, "abcdefgh")==0)
+        return ByteVector{ 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h' };
+    if (strcmp(name, "text")==0)
+        return kawords(1000, false);
+    if (strcmp(name, "pages")==0) {
+        // two full pages: the repeats are more than a page apart
+        ByteVector text= kawords(1000, false);
+        ByteVector data;
+        while (data.size()<8192)
+            data.insert(data.end(), text.begin(), text.end());
+        data.resize(8192);
+        return data;
+    }
+    return kawords(600, true);
+}
+
+struct knownanswer_t {
+    const codec_t *codec;
+    const char *input;
+    const uint8_t *comp;
+    uint32_t compsize;
+};
+#define KNOWNANSWER(codec, input)  { &codecs[codec], #input, ka_##codec##_##input, sizeof(ka_##codec##_##input) }
+enum { xpr, xph, lzx, rom3, rom4 };
+knownanswer_t knownanswers[]= {
+    KNOWNANSWER(xpr, abc),          // one long overlapping match
+    KNOWNANSWER(xpr, text),
+    KNOWNANSWER(xph, text),
+    KNOWNANSWER(lzx, abcdefgh),     // an uncompressed block
+    KNOWNANSWER(lzx, text),         // a verbatim block
+    KNOWNANSWER(lzx, calls),        // with e8 translation
+    KNOWNANSWER(rom3, text),
+    KNOWNANSWER(rom3, pages),       // ends with an empty page
+    KNOWNANSWER(rom4, text),
+    KNOWNANSWER(rom4, pages),
+};
+
+// the native decoder must restore the dll output exactly
+void tstknownanswer(const knownanswer_t& ka)
+{
+    ByteVector data= kainput(ka.input);
+    uint32_t n= data.size();
+    ByteVector full(n+GUARD, GUARDBYTE);
+    uint32_t fullsize= ka.codec->decompress(ka.comp, ka.compsize, &full[0], n);
+    if (fullsize!=n) {
+        printf("%s known answer %s: decompress returned %08x, expected %08x\n", ka.codec->name, ka.input, fullsize, n);
+        g_failures++;
+        return;
+    }
+    CHECK(guardintact(full, n));
+    if (!std::equal(data.begin(), data.end(), full.begin())) {
+        printf("%s known answer %s: data differs\n", ka.codec->name, ka.input);
+        g_failures++;
+    }
+}
+
+// the page table only has room for 24 bit sizes and offsets
+void tstrom34limits()
+{
+    ByteVector big(0x1000000, 0);
+    ByteVector comp(0x10000);
+    CHECK(rom3_compress(&big[0], big.size(), &comp[0], comp.size())==0xFFFFFFFF);
+    CHECK(rom4_compress(&big[0], big.size(), &comp[0], comp.size())==0xFFFFFFFF);
+
+    // truncated input must fail, not read past the end
+    ByteVector data= kainput("pages");
+    ByteVector full(data.size());
+    for (const codec_t *c : { &codecs[rom3], &codecs[rom4] }) {
+        uint32_t compsize= c->compress(&data[0], data.size(), &comp[0], comp.size());
+        CHECK(compsize!=0xFFFFFFFF);
+        for (uint32_t n : { 3U, 8U, compsize/2, compsize-1 }) {
+            ByteVector trunc(comp.begin(), comp.begin()+n);
+            CHECK(c->decompress(&trunc[0], n, &full[0], full.size())==0xFFFFFFFF);
+        }
+        CHECK(c->decompress(&comp[0], compsize, &full[0], full.size()-1)==0xFFFFFFFF);
+    }
+}
+
+void tsthighbit()
+{
+    for (int bit=0 ; bit<32 ; bit++) {
+        CHECK(xph_highbit(uint32_t(1)<<bit)==bit);
+        CHECK(xph_highbit((uint32_t(1)<<bit)|1)==bit);
+        CHECK(xph_highbit(uint32_t(0xFFFFFFFF)>>(31-bit))==bit);
+    }
+}
+
+int main()
+{
+    tsthighbit();
+    for (const codec_t& c : codecs)
+        tstcodec(c);
+    for (const knownanswer_t& ka : knownanswers)
+        tstknownanswer(ka);
+    tstrom34limits();
+
+    return testresult("codecs");
+}
@@ -0,0 +1,258 @@
+#pragma once
+#include <stdint.h>
+
+// known answers for tstcodecs: the output of the real compression dlls,
+//   xpr and lzx from cecompr_nt-v2.dll, xph from cecompr_nt_xphxpr.dll,
+//   rom3 from CECompressv3.dll, rom4 from CECompressv4.dll,
+// called with the same parameters as lzxxpr_convert and rom34_convert use.
+// the inputs are made by kainput() in tstcodecs.cpp.
+
+const uint8_t ka_xpr_abc[]= {
+    0xff, 0xff, 0xff, 0x0f, 0x61, 0x62, 0x63, 0x61, 0x17, 0x00, 0x0f, 0xff, 0x25, 0x01,
+};
+const uint8_t ka_xpr_text[]= {
+    0x00, 0x88, 0x00, 0x00, 0x0d, 0x0a, 0x0d, 0x0a, 0x69, 0x6d, 0x61, 0x67, 0x65, 0x20, 0x73, 0x79,
+    0x73, 0x74, 0x65, 0x6d, 0x37, 0x00, 0x95, 0x66, 0x69, 0x6c, 0xce, 0x00, 0x62, 0x6c, 0x6f, 0x63,
+    0x6b, 0x20, 0x0d, 0x0a, 0x63, 0x68, 0x75, 0x33, 0xe6, 0x7d, 0x00, 0x6e, 0x6b, 0x20, 0x30, 0x78,
+    0x31, 0x30, 0x30, 0x30, 0xa4, 0x00, 0x2b, 0x00, 0x3b, 0x02, 0xc4, 0x00, 0x67, 0x00, 0x0d, 0x58,
+    0x03, 0x82, 0x02, 0xac, 0x00, 0x37, 0x00, 0x34, 0x0d, 0x0a, 0x67, 0x01, 0x42, 0x01, 0x74, 0x68,
+    0x65, 0xdf, 0x02, 0x93, 0xa2, 0x00, 0x0d, 0x0a, 0x1f, 0x05, 0xa3, 0x04, 0xff, 0xf9, 0xff, 0xff,
+    0x2b, 0x01, 0xaf, 0x01, 0x30, 0x2b, 0x00, 0x87, 0x05, 0x6e, 0x03, 0xab, 0x00, 0x1f, 0x02, 0x62,
+    0x22, 0x00, 0x17, 0x02, 0x07, 0x01, 0x32, 0x01, 0x06, 0x27, 0x05, 0x27, 0x07, 0x63, 0x07, 0x03,
+    0x3e, 0x05, 0x61, 0x02, 0x6b, 0x03, 0x2b, 0x00, 0x5e, 0x02, 0x42, 0x00, 0xb5, 0x0a, 0x0d, 0x0a,
+    0x4f, 0x07, 0x32, 0x4b, 0x01, 0x76, 0x03, 0x25, 0x0d, 0x51, 0x02, 0x19, 0x00, 0xcc, 0x02, 0x67,
+    0x04, 0x37, 0x03, 0x00, 0xff, 0xff, 0xff, 0xff, 0x4f, 0x00, 0xcb, 0x00, 0x4f, 0x06, 0x13, 0x1f,
+    0x04, 0xff, 0x04, 0x11, 0xff, 0x0a, 0xb7, 0x0a, 0x18, 0x36, 0x04, 0x9f, 0x00, 0x57, 0x0c, 0x54,
+    0x17, 0x02, 0x7d, 0x0f, 0xc3, 0x03, 0x56, 0x0e, 0x6f, 0x04, 0x22, 0xfc, 0x01, 0x37, 0x05, 0x36,
+    0x03, 0xa7, 0x07, 0x55, 0x25, 0x04, 0x97, 0x10, 0x5f, 0x07, 0x30, 0x7b, 0x00, 0x8f, 0x14, 0x9f,
+    0x16, 0xb3, 0x27, 0x03, 0x87, 0x04, 0x30, 0x2f, 0x0a, 0xcf, 0x0a, 0x94, 0x07, 0x02, 0x6f, 0x0e,
+    0x26, 0x2f, 0x00, 0xff, 0xff, 0xff, 0xe7, 0xc7, 0x14, 0x14, 0xbd, 0x05, 0x2f, 0x0e, 0x0d, 0x0a,
+    0x7f, 0x05, 0xa0, 0x84, 0x06, 0xef, 0x1b, 0x27, 0x14, 0x46, 0x6f, 0x04, 0x3e, 0x08, 0x17, 0x06,
+    0xe0, 0x7f, 0x10, 0xbe, 0x0d,
+};
+const uint8_t ka_xph_text[]= {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x05, 0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x06, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x76, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x70, 0x67, 0x60, 0x77, 0x66, 0x60, 0x66, 0x77, 0x00, 0x60, 0x76, 0x00, 0x77, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x07, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x70, 0x67, 0x00, 0x00, 0x70, 0x70, 0x07, 0x00, 0x00, 0x07, 0x00, 0x70, 0x00, 0x00, 0x00, 0x70,
+    0x00, 0x67, 0x06, 0x07, 0x07, 0x00, 0x00, 0x00, 0x00, 0x67, 0x00, 0x70, 0x70, 0x07, 0x00, 0x00,
+    0x67, 0x67, 0x06, 0x75, 0x70, 0x07, 0x67, 0x60, 0x70, 0x70, 0x67, 0x56, 0x66, 0x75, 0x07, 0x70,
+    0x00, 0x00, 0x60, 0x06, 0x06, 0x67, 0x70, 0x70, 0x00, 0x00, 0x00, 0x00, 0x00, 0x76, 0x77, 0x60,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x52, 0x91, 0x83, 0xad, 0x56, 0xcc, 0xab, 0xea, 0xa6, 0x1e, 0xba, 0x3e, 0xe8, 0x29,
+    0xc9, 0xaa, 0x39, 0xda, 0x00, 0x23, 0x21, 0x47, 0xca, 0x6e, 0x1b, 0x46, 0xa1, 0x72, 0x9a, 0xa6,
+    0xaf, 0xca, 0x43, 0x38, 0x9a, 0x33, 0xeb, 0x86, 0x01, 0xa2, 0x37, 0x62, 0xcb, 0x5b, 0xc0, 0xa9,
+    0x5b, 0x20, 0x2b, 0x27, 0x7f, 0xa8, 0x33, 0xca, 0x0b, 0xa5, 0x4e, 0x01, 0x36, 0x5a, 0x2f, 0xbb,
+    0x88, 0x15, 0x61, 0xee, 0x89, 0xb8, 0x78, 0x81, 0x81, 0x3d, 0x04, 0xe9, 0x4b, 0xa9, 0xe8, 0x95,
+    0x50, 0x61, 0xae, 0xd9, 0xbc, 0x5c, 0x32, 0x33, 0x15, 0x19, 0x51, 0xc0, 0x69, 0xea, 0xbe, 0x43,
+    0x56, 0x4a, 0xbe, 0xcb, 0xd1, 0x3a, 0xf0, 0x46, 0x2a, 0x9f, 0x8b, 0x62, 0x20, 0x2a, 0x20, 0x91,
+    0x83, 0x99, 0xbc, 0xe2, 0xf4, 0x21, 0x00, 0xf1, 0xa4, 0xc3, 0x7c, 0xc1, 0x93, 0x65, 0xce, 0x8c,
+    0xcb, 0xa0, 0x73, 0x9c, 0x46, 0xf8, 0x73, 0x00, 0xeb, 0xc1, 0x5f, 0x6c, 0x32, 0x28, 0x60, 0x50,
+    0x49, 0x7e, 0xd4, 0x11, 0x52, 0x03, 0x8d, 0xf4, 0xd3, 0x3a, 0xfb, 0xe0, 0xc3, 0xce, 0x01, 0x4c,
+    0x7d, 0xe2, 0xc0, 0x60, 0x6c, 0x18, 0x11, 0xa3, 0x76, 0xfb, 0x4d, 0x17, 0xfa, 0x02, 0xe9, 0xb8,
+    0x09, 0x42, 0x90, 0x0e, 0xb7, 0x84, 0x06, 0x80, 0x17, 0x00, 0x00,
+};
+const uint8_t ka_lzx_abcdefgh[]= {
+    0x1c, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x5b, 0x80, 0x80, 0x8d, 0x00, 0x30, 0x80, 0x00,
+    0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x61, 0x62, 0x63, 0x64,
+    0x65, 0x66, 0x67, 0x68,
+};
+const uint8_t ka_lzx_text[]= {
+    0x10, 0x01, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x5b, 0x80, 0x80, 0x8d, 0x00, 0x10, 0x82, 0x3e,
+    0x00, 0x00, 0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x0c, 0x33, 0x0e, 0xa2, 0xd4, 0xd2, 0xd0, 0x4f,
+    0x2d, 0xb1, 0x28, 0x0d, 0x82, 0x14, 0xff, 0xff, 0x82, 0xf5, 0x00, 0x00, 0x00, 0x00, 0x6a, 0x04,
+    0x00, 0xc0, 0x1c, 0x8c, 0x70, 0xe9, 0xe2, 0xa2, 0xac, 0x5c, 0x4c, 0x16, 0x34, 0xc2, 0xc8, 0x34,
+    0xd0, 0x9e, 0x57, 0x9e, 0xc2, 0x03, 0xf1, 0xd2, 0x62, 0x4b, 0x7d, 0x1f, 0xde, 0xc2, 0x5e, 0xe1,
+    0x57, 0xe1, 0xdc, 0x13, 0xff, 0x4b, 0x81, 0xff, 0x00, 0x00, 0x00, 0x00, 0x22, 0x00, 0x98, 0x92,
+    0x07, 0x01, 0x5c, 0xf8, 0x50, 0xe0, 0xf5, 0x0e, 0xf7, 0xfb, 0xc6, 0xef, 0xd8, 0x2c, 0x6d, 0xd2,
+    0x77, 0xdb, 0x59, 0x99, 0x8f, 0xec, 0xcb, 0x3e, 0xe3, 0xb1, 0xb7, 0x75, 0xc9, 0x38, 0xcc, 0x71,
+    0x5f, 0x2c, 0xa0, 0x5b, 0xd6, 0xb0, 0x1a, 0x2c, 0xf1, 0xa5, 0x5f, 0xda, 0xef, 0x46, 0x42, 0x11,
+    0xf6, 0x88, 0xe1, 0xf7, 0x4c, 0xd4, 0x31, 0x82, 0xb9, 0xdf, 0xf2, 0xdf, 0xda, 0xb7, 0xbf, 0x67,
+    0xfd, 0xa6, 0x3b, 0x52, 0xb5, 0x37, 0x06, 0xcb, 0x68, 0x80, 0xa6, 0x9a, 0x01, 0x1c, 0xd0, 0xe8,
+    0x94, 0x4e, 0x4f, 0xa7, 0x9f, 0x04, 0x8f, 0x58, 0x0a, 0xd1, 0x7f, 0xa8, 0x44, 0x98, 0x3a, 0x1e,
+    0xd2, 0x1f, 0x28, 0x65, 0xc3, 0xfa, 0x31, 0x15, 0x06, 0x87, 0x03, 0xa0, 0x09, 0x05, 0xa6, 0xf1,
+    0xb3, 0x43, 0x18, 0xd0, 0x30, 0x34, 0xb3, 0xc8, 0x2b, 0xce, 0x52, 0xd0, 0xc8, 0x65, 0x3f, 0x07,
+    0x46, 0x16, 0x3e, 0xb5, 0x1a, 0xcd, 0x36, 0x43, 0x12, 0x53, 0xa9, 0x58, 0x28, 0x07, 0x21, 0x15,
+    0x2b, 0x99, 0x15, 0x25, 0xd5, 0x7a, 0xc1, 0x71, 0x14, 0x35, 0x6e, 0xe9, 0x86, 0x1e, 0x4c, 0x97,
+    0x28, 0x7a, 0x0e, 0x9b, 0xae, 0xa9, 0x32, 0xc4, 0x4f, 0x44, 0xc0, 0xfe, 0x87, 0x29, 0x43, 0x1c,
+    0xa4, 0xe0, 0x55, 0x41, 0x2f, 0xe1, 0xd0, 0xd1,
+};
+const uint8_t ka_lzx_calls[]= {
+    0x40, 0x01, 0x00, 0x00, 0x58, 0x02, 0x00, 0x00, 0x5b, 0x80, 0x80, 0x8d, 0x00, 0x10, 0x81, 0x25,
+    0x00, 0x00, 0x00, 0x00, 0x50, 0x32, 0x00, 0x60, 0x0c, 0x46, 0x35, 0xd4, 0xbd, 0x67, 0x55, 0xae,
+    0x6e, 0x0b, 0xe1, 0x16, 0x73, 0x5b, 0xe1, 0x37, 0x71, 0x61, 0xca, 0x2b, 0x2a, 0xbd, 0x5e, 0xd8,
+    0xcc, 0xc6, 0xf1, 0x1b, 0x0b, 0xb7, 0xb7, 0x74, 0xb9, 0x32, 0xba, 0x10, 0x12, 0xd7, 0xdc, 0x17,
+    0x3c, 0x49, 0x3d, 0xbc, 0x20, 0x2c, 0x00, 0x00, 0x04, 0x00, 0xa0, 0x88, 0x08, 0x00, 0xab, 0xa1,
+    0x81, 0x81, 0x2e, 0x71, 0xc4, 0x55, 0x25, 0xce, 0x28, 0x70, 0xb2, 0x91, 0xe8, 0xa6, 0xea, 0x86,
+    0xb9, 0xb5, 0x96, 0x4a, 0x6e, 0xad, 0x3d, 0xf0, 0x8f, 0x15, 0x19, 0x3c, 0x03, 0x83, 0x85, 0x37,
+    0xff, 0x9f, 0xcc, 0xff, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x22, 0x00, 0x20, 0x00, 0x15, 0xa1,
+    0xff, 0xff, 0xfe, 0xff, 0x50, 0x01, 0xef, 0x68, 0x3a, 0x51, 0x08, 0x55, 0x75, 0xbd, 0xb3, 0x02,
+    0x46, 0xaf, 0xd6, 0xdd, 0x97, 0x8c, 0x13, 0x65, 0xf7, 0x92, 0x3e, 0x37, 0x97, 0x08, 0x7c, 0x36,
+    0x11, 0xa5, 0x84, 0x36, 0x89, 0x89, 0x8d, 0x93, 0x08, 0xbe, 0xfb, 0xeb, 0xcc, 0xa5, 0x73, 0x37,
+    0x77, 0x6a, 0xa7, 0x9a, 0xe9, 0xa2, 0x41, 0x36, 0xff, 0x68, 0x5e, 0x31, 0x2b, 0xcf, 0xdc, 0x04,
+    0xfe, 0x19, 0x17, 0x08, 0x4f, 0xf6, 0xef, 0x74, 0x67, 0xb2, 0x99, 0xed, 0xaa, 0x3b, 0x10, 0x0b,
+    0xdd, 0x13, 0x43, 0x2f, 0xe8, 0xf0, 0x4b, 0xdb, 0x82, 0xe3, 0xe5, 0xb3, 0x71, 0x50, 0x1f, 0x7b,
+    0x0c, 0xa6, 0x17, 0xa7, 0x82, 0xc2, 0x49, 0xd4, 0x9b, 0x18, 0xb6, 0xdd, 0x2c, 0xf1, 0xee, 0x35,
+    0xc1, 0xad, 0xd2, 0xb2, 0x7f, 0xc3, 0xff, 0x42, 0x09, 0xd5, 0x18, 0xab, 0x10, 0x1b, 0x7a, 0x57,
+    0x42, 0xba, 0x9e, 0xa8, 0xe5, 0xc2, 0x53, 0x99, 0x95, 0xf9, 0x79, 0x24, 0xda, 0x47, 0x57, 0x13,
+    0xaf, 0xfa, 0xa1, 0xf2, 0xc5, 0xc2, 0xb7, 0xfb, 0xa9, 0x41, 0xa9, 0x9e, 0x98, 0xf2, 0xe3, 0x47,
+    0xe3, 0x2d, 0x32, 0x46, 0xe0, 0x1c, 0xdc, 0x69, 0x21, 0xcd, 0xd6, 0xe7, 0x98, 0x67, 0xf0, 0x75,
+    0x2b, 0x9e, 0x0e, 0x28, 0x5f, 0x0b, 0xc2, 0x4c, 0xc8, 0x91, 0x3f, 0x11, 0xcd, 0x21, 0xe9, 0x57,
+    0xda, 0x0c, 0xc7, 0x4f, 0x08, 0x26, 0x20, 0x3d,
+};
+const uint8_t ka_rom3_text[]= {
+    0xe8, 0x03, 0x00, 0x18, 0x01, 0x00, 0x04, 0x0d, 0x0a, 0x01, 0x69, 0x6d, 0x61, 0x67, 0x65, 0x80,
+    0x20, 0x73, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x96, 0x00, 0x21, 0x06, 0x01, 0x20, 0x66, 0x69, 0x6c,
+    0x88, 0x00, 0x62, 0x6c, 0x00, 0x6f, 0x63, 0x6b, 0x20, 0x0d, 0x0a, 0x63, 0x68, 0x04, 0x75, 0x6e,
+    0x61, 0x30, 0x78, 0x31, 0x30, 0x30, 0xfe, 0x30, 0xa6, 0x02, 0x05, 0x04, 0x45, 0x00, 0x96, 0x03,
+    0xcc, 0x04, 0x95, 0x05, 0x03, 0x00, 0xcf, 0xf4, 0x01, 0xf6, 0x05, 0x56, 0x07, 0xc6, 0x07, 0x0d,
+    0x0a, 0xf8, 0x05, 0x83, 0x06, 0x39, 0x04, 0x07, 0x74, 0x68, 0x21, 0x6b, 0x04, 0x94, 0x09, 0x0d,
+    0x0a, 0xff, 0x10, 0x01, 0x02, 0x35, 0x03, 0x85, 0x0a, 0xe9, 0x09, 0x85, 0x0d, 0x3c, 0x03, 0xa6,
+    0x0e, 0x17, 0x03, 0xff, 0xcb, 0x0b, 0x74, 0x10, 0xef, 0x0c, 0x0b, 0x10, 0xc3, 0x06, 0xcc, 0x08,
+    0x85, 0x13, 0x50, 0x07, 0x02, 0xff, 0x63, 0x0f, 0x01, 0x16, 0x12, 0x73, 0x11, 0xa5, 0x0f, 0x85,
+    0x16, 0x88, 0x12, 0x44, 0x17, 0xff, 0xb7, 0x02, 0x01, 0x29, 0x0a, 0x67, 0x16, 0xf8, 0x12, 0x27,
+    0x00, 0x43, 0x16, 0xf3, 0x1a, 0xff, 0xd6, 0x15, 0x1c, 0x13, 0x49, 0x16, 0xb9, 0x1c, 0x55, 0x1c,
+    0xbc, 0x11, 0xea, 0x16, 0xda, 0x15, 0xff, 0x8a, 0x0a, 0xc0, 0x0b, 0x01, 0xe8, 0x19, 0xaa, 0x21,
+    0xea, 0x0a, 0x10, 0x20, 0x01, 0x67, 0x06, 0x55, 0x1e, 0xff, 0x98, 0x09, 0xfb, 0x1d, 0x96, 0x23,
+    0x9b, 0x1d, 0x58, 0x22, 0xe6, 0x28, 0x77, 0x1a, 0xf7, 0x21, 0xff, 0x9e, 0x09, 0xf9, 0x1c, 0x55,
+    0x2b, 0x9c, 0x03, 0x4c, 0x00, 0x00, 0x28, 0x04, 0x99, 0x26, 0xec, 0x1b, 0xff, 0x7d, 0x1b, 0xed,
+    0x2d, 0x6e, 0x1c, 0x65, 0x33, 0xc5, 0x33, 0x25, 0x34, 0x5d, 0x0b, 0x47, 0x2a, 0xff, 0x01, 0x2a,
+    0x15, 0x19, 0x2c, 0xa6, 0x2a, 0x40, 0x00, 0x03, 0x1f, 0x11, 0x8d, 0x31, 0xc8, 0x2a, 0x0f, 0x93,
+    0x3b, 0xb0, 0x30, 0x03, 0x69, 0x39, 0x78, 0x22,
+};
+const uint8_t ka_rom3_pages[]= {
+    0x00, 0x20, 0x00, 0xe5, 0x01, 0x00, 0xf2, 0x03, 0x00, 0xf2, 0x03, 0x00, 0x04, 0x0d, 0x0a, 0x01,
+    0x69, 0x6d, 0x61, 0x67, 0x65, 0x80, 0x20, 0x73, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x96, 0x00, 0x21,
+    0x06, 0x01, 0x20, 0x66, 0x69, 0x6c, 0x88, 0x00, 0x62, 0x6c, 0x00, 0x6f, 0x63, 0x6b, 0x20, 0x0d,
+    0x0a, 0x63, 0x68, 0x04, 0x75, 0x6e, 0x61, 0x30, 0x78, 0x31, 0x30, 0x30, 0xfe, 0x30, 0xa6, 0x02,
+    0x05, 0x04, 0x45, 0x00, 0x96, 0x03, 0xcc, 0x04, 0x95, 0x05, 0x03, 0x00, 0xcf, 0xf4, 0x01, 0xf6,
+    0x05, 0x56, 0x07, 0xc6, 0x07, 0x0d, 0x0a, 0xf8, 0x05, 0x83, 0x06, 0x39, 0x04, 0x07, 0x74, 0x68,
+    0x21, 0x6b, 0x04, 0x94, 0x09, 0x0d, 0x0a, 0xff, 0x10, 0x01, 0x02, 0x35, 0x03, 0x85, 0x0a, 0xe9,
+    0x09, 0x85, 0x0d, 0x3c, 0x03, 0xa6, 0x0e, 0x17, 0x03, 0xff, 0xcb, 0x0b, 0x74, 0x10, 0xef, 0x0c,
+    0x0b, 0x10, 0xc3, 0x06, 0xcc, 0x08, 0x85, 0x13, 0x50, 0x07, 0x02, 0xff, 0x63, 0x0f, 0x01, 0x16,
+    0x12, 0x73, 0x11, 0xa5, 0x0f, 0x85, 0x16, 0x88, 0x12, 0x44, 0x17, 0xff, 0xb7, 0x02, 0x01, 0x29,
+    0x0a, 0x67, 0x16, 0xf8, 0x12, 0x27, 0x00, 0x43, 0x16, 0xf3, 0x1a, 0xff, 0xd6, 0x15, 0x1c, 0x13,
+    0x49, 0x16, 0xb9, 0x1c, 0x55, 0x1c, 0xbc, 0x11, 0xea, 0x16, 0xda, 0x15, 0xff, 0x8a, 0x0a, 0xc0,
+    0x0b, 0x01, 0xe8, 0x19, 0xaa, 0x21, 0xea, 0x0a, 0x10, 0x20, 0x01, 0x67, 0x06, 0x55, 0x1e, 0xff,
+    0x98, 0x09, 0xfb, 0x1d, 0x96, 0x23, 0x9b, 0x1d, 0x58, 0x22, 0xe6, 0x28, 0x77, 0x1a, 0xf7, 0x21,
+    0xff, 0x9e, 0x09, 0xf9, 0x1c, 0x55, 0x2b, 0x9c, 0x03, 0x4c, 0x00, 0x00, 0x28, 0x04, 0x99, 0x26,
+    0xec, 0x1b, 0xff, 0x7d, 0x1b, 0xed, 0x2d, 0x6e, 0x1c, 0x65, 0x33, 0xc5, 0x33, 0x25, 0x34, 0x5d,
+    0x0b, 0x47, 0x2a, 0xff, 0x01, 0x2a, 0x15, 0x19, 0x2c, 0xa6, 0x2a, 0x40, 0x00, 0x03, 0x1f, 0x11,
+    0x8d, 0x31, 0xc8, 0x2a, 0xff, 0x93, 0x3b, 0xb0, 0x30, 0x03, 0x69, 0x39, 0x78, 0x22, 0x00, 0x00,
+    0x5c, 0xd0, 0x06, 0x5b, 0x90, 0x0d, 0x25, 0xf4, 0x3b, 0xff, 0x40, 0x11, 0x32, 0x76, 0x15, 0xe0,
+    0x15, 0x2b, 0xa0, 0x19, 0x19, 0x40, 0x1c, 0x22, 0x70, 0x1f, 0x73, 0xb0, 0x27, 0x04, 0x00, 0x29,
+    0x56, 0xff, 0x72, 0x6b, 0xa0, 0x2f, 0x28, 0x30, 0x33, 0x27, 0xb0, 0x36, 0x3d, 0x90, 0x3b, 0x0c,
+    0x60, 0x3d, 0x03, 0x01, 0xc0, 0x3e, 0x06, 0xff, 0x86, 0x79, 0x88, 0x7d, 0x30, 0x41, 0x62, 0x60,
+    0x48, 0x9a, 0x10, 0x53, 0x02, 0x40, 0x54, 0x97, 0xc0, 0x5e, 0x1e, 0xb0, 0x61, 0x03, 0xff, 0xf0,
+    0x62, 0x32, 0xc3, 0xa4, 0x60, 0x67, 0x56, 0xd0, 0x6d, 0x17, 0x50, 0x70, 0x03, 0x90, 0x71, 0x27,
+    0x57, 0x92, 0x90, 0x75, 0x2e, 0xff, 0x80, 0x79, 0x0d, 0x60, 0x7b, 0x17, 0xe0, 0x7d, 0x1a, 0x90,
+    0x80, 0x31, 0xc6, 0xc2, 0x36, 0xc3, 0x90, 0x85, 0x0d, 0x70, 0x87, 0x04, 0xff, 0xd6, 0xc6, 0x30,
+    0x89, 0x04, 0x80, 0x8a, 0x25, 0xf4, 0xb4, 0x30, 0x8e, 0x32, 0xa6, 0xb3, 0xd0, 0x92, 0x2b, 0x90,
+    0x96, 0x19, 0xff, 0x30, 0x99, 0x0d, 0x10, 0x9b, 0x09, 0xd8, 0xd6, 0x40, 0x9d, 0x1e, 0x30, 0xa0,
+    0x03, 0x70, 0xa1, 0x32, 0x43, 0xe3, 0xe0, 0xa5, 0x56, 0xff, 0x50, 0xac, 0x17, 0xd0, 0xae, 0x03,
+    0x10, 0xb0, 0x27, 0xd7, 0xd0, 0x10, 0xb4, 0x2e, 0x00, 0xb8, 0x0d, 0xe0, 0xb9, 0x17, 0x60, 0xbc,
+    0x1a, 0x01, 0x10, 0xbf, 0x16, 0x00, 0x78, 0x31, 0x30, 0x30, 0x30, 0x20, 0x69, 0x6d, 0x40, 0x61,
+    0x67, 0x65, 0x20, 0x0d, 0x0a, 0x01, 0x66, 0x74, 0x69, 0x6c, 0x71, 0x30, 0x05, 0x00, 0x56, 0x01,
+    0xc6, 0x01, 0x0d, 0x4e, 0x0a, 0x36, 0x02, 0x65, 0x00, 0x04, 0x01, 0x74, 0x68, 0x21, 0x62, 0x10,
+    0x6c, 0x6f, 0x63, 0x6b, 0x2b, 0x03, 0x0d, 0x0a, 0x73, 0xc0, 0x79, 0x73, 0x74, 0x65, 0x6d, 0x20,
+    0x56, 0x05, 0xe4, 0x04, 0xf0, 0x63, 0x68, 0x75, 0x6e, 0x67, 0x04, 0xe9, 0x03, 0x85, 0x07, 0x85,
+    0x06, 0xff, 0xcf, 0x01, 0x45, 0x08, 0xcb, 0x05, 0x74, 0x0a, 0xef, 0x06, 0x0b, 0x0a, 0xc3, 0x00,
+    0xcc, 0x02, 0xff, 0x85, 0x0d, 0x50, 0x01, 0x02, 0x63, 0x09, 0x01, 0x16, 0x0c, 0x73, 0x0b, 0xa5,
+    0x09, 0x85, 0x10, 0xff, 0x88, 0x0c, 0x44, 0x11, 0xb5, 0x0b, 0x93, 0x11, 0x29, 0x04, 0x67, 0x10,
+    0xf8, 0x0c, 0x71, 0xff, 0x19, 0x0b, 0xf3, 0x14, 0xd6, 0x0f, 0x1c, 0x0d, 0x49, 0x10, 0xb9, 0x16,
+    0x55, 0x16, 0xbc, 0x0b, 0xff, 0xea, 0x10, 0xda, 0x0f, 0x8a, 0x04, 0xc0, 0x05, 0x01, 0xe8, 0x13,
+    0xaa, 0x1b, 0xea, 0x04, 0x10, 0x1a, 0x01, 0xff, 0x67, 0x00, 0x55, 0x18, 0x98, 0x03, 0xfb, 0x17,
+    0x96, 0x1d, 0x9b, 0x17, 0x58, 0x1c, 0xe6, 0x22, 0xff, 0x77, 0x14, 0xf7, 0x1b, 0x9e, 0x03, 0xf9,
+    0x16, 0x55, 0x25, 0x56, 0x23, 0xcb, 0x12, 0xbc, 0x18, 0xff, 0x6e, 0x22, 0x99, 0x20, 0xec, 0x15,
+    0x7d, 0x15, 0xed, 0x27, 0x6e, 0x16, 0x65, 0x2d, 0xc5, 0x2d, 0xff, 0x25, 0x2e, 0x5d, 0x05, 0x47,
+    0x24, 0x01, 0x2a, 0x0f, 0x19, 0x26, 0xa6, 0x24, 0xbc, 0x2a, 0xff, 0x86, 0x32, 0x1f, 0x0b, 0x8d,
+    0x2b, 0xc8, 0x24, 0x93, 0x35, 0xb0, 0x2a, 0x03, 0x69, 0x33, 0x78, 0x1c, 0xff, 0xd3, 0x30, 0x20,
+    0x32, 0x03, 0x96, 0x39, 0xeb, 0x1a, 0x57, 0x31, 0x4c, 0x08, 0x8b, 0x07, 0xe0, 0x29, 0x02, 0xff,
+    0xac, 0x3d, 0xc0, 0x00, 0x2a, 0x70, 0x04, 0x04, 0xd6, 0x43, 0x30, 0x06, 0x04, 0x80, 0x07, 0x25,
+    0xf4, 0x31, 0x30, 0x0b, 0x32, 0xff, 0xa6, 0x30, 0xd0, 0x0f, 0x2b, 0x90, 0x13, 0x19, 0x30, 0x16,
+    0x0d, 0x10, 0x18, 0x09, 0xd8, 0x53, 0x40, 0x1a, 0x1e, 0x30, 0x1d, 0x03, 0xff, 0x70, 0x1e, 0x32,
+    0x43, 0x60, 0xe0, 0x22, 0x56, 0x50, 0x29, 0x17, 0xd0, 0x2b, 0x03, 0x10, 0x2d, 0x27, 0xd7, 0x4d,
+    0x10, 0x31, 0x2e, 0xff, 0x00, 0x35, 0x0d, 0xe0, 0x36, 0x17, 0x60, 0x39, 0x1a, 0x10, 0x3c, 0x31,
+    0x46, 0x7e, 0xb6, 0x7e, 0x10, 0x41, 0x0d, 0xf0, 0x42, 0x04, 0xff, 0x56, 0x82, 0xb0, 0x44, 0x04,
+    0x00, 0x46, 0x25, 0x74, 0x70, 0xb0, 0x49, 0x32, 0x26, 0x6f, 0x50, 0x4e, 0x2b, 0x10, 0x52, 0x19,
+    0xff, 0xb0, 0x54, 0x0d, 0x90, 0x56, 0x09, 0x58, 0x92, 0xc0, 0x58, 0x1e, 0xb0, 0x5b, 0x03, 0xf0,
+    0x5c, 0x32, 0xc3, 0x9e, 0x60, 0x61, 0x56, 0xff, 0xd0, 0x67, 0x17, 0x50, 0x6a, 0x03, 0x90, 0x6b,
+    0x27, 0x57, 0x8c, 0x90, 0x6f, 0x2e, 0x80, 0x73, 0x0d, 0x60, 0x75, 0x17, 0xe0, 0x77, 0x1a, 0xff,
+    0x90, 0x7a, 0x31, 0xc6, 0xbc, 0x36, 0xbd, 0x90, 0x7f, 0x0d, 0x70, 0x81, 0x04, 0xd6, 0xc0, 0x30,
+    0x83, 0x04, 0x80, 0x84, 0x25, 0xff, 0xf4, 0xae, 0x30, 0x88, 0x32, 0xa6, 0xad, 0xd0, 0x8c, 0x2b,
+    0x90, 0x90, 0x19, 0x30, 0x93, 0x0d, 0x10, 0x95, 0x09, 0xd8, 0xd0, 0xff, 0x40, 0x97, 0x1e, 0x30,
+    0x9a, 0x03, 0x70, 0x9b, 0x32, 0x43, 0xdd, 0xe0, 0x9f, 0x56, 0x50, 0xa6, 0x17, 0xd0, 0xa8, 0x03,
+    0x10, 0xaa, 0x27, 0xff, 0xd7, 0xca, 0x10, 0xae, 0x2e, 0x00, 0xb2, 0x0d, 0xe0, 0xb3, 0x17, 0x60,
+    0xb6, 0x1a, 0x10, 0xb9, 0x31, 0x46, 0xfb, 0xb6, 0xfb, 0x07, 0x10, 0xbe, 0x0d, 0xf0, 0xbf, 0x04,
+    0x53, 0xff,
+};
+const uint8_t ka_rom4_text[]= {
+    0xe8, 0x03, 0x00, 0x26, 0x01, 0x00, 0x10, 0x00, 0x00, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x10, 0x01,
+    0x00, 0x00, 0xe8, 0x03, 0x00, 0x00, 0x5b, 0x80, 0x80, 0x8d, 0x00, 0x10, 0x82, 0x3e, 0x00, 0x00,
+    0x00, 0x00, 0x20, 0x02, 0x00, 0x00, 0x0c, 0x33, 0x0e, 0xa2, 0xd4, 0xd2, 0xd0, 0x4f, 0x2d, 0xb1,
+    0x28, 0x0d, 0x82, 0x14, 0xff, 0xff, 0x82, 0xf5, 0x00, 0x00, 0x00, 0x00, 0x6a, 0x04, 0x00, 0xc0,
+    0x1c, 0x8c, 0x70, 0xe9, 0xe2, 0xa2, 0xac, 0x5c, 0x4c, 0x16, 0x34, 0xc2, 0xc8, 0x34, 0xd0, 0x9e,
+    0x57, 0x9e, 0xc2, 0x03, 0xf1, 0xd2, 0x62, 0x4b, 0x7d, 0x1f, 0xde, 0xc2, 0x5e, 0xe1, 0x57, 0xe1,
+    0xdc, 0x13, 0xff, 0x4b, 0x81, 0xff, 0x00, 0x00, 0x00, 0x00, 0x22, 0x00, 0x98, 0x92, 0x07, 0x01,
+    0x5c, 0xf8, 0x50, 0xe0, 0xf5, 0x0e, 0xf7, 0xfb, 0xc6, 0xef, 0xd8, 0x2c, 0x6d, 0xd2, 0x77, 0xdb,
+    0x59, 0x99, 0x8f, 0xec, 0xcb, 0x3e, 0xe3, 0xb1, 0xb7, 0x75, 0xc9, 0x38, 0xcc, 0x71, 0x5f, 0x2c,
+    0xa0, 0x5b, 0xd6, 0xb0, 0x1a, 0x2c, 0xf1, 0xa5, 0x5f, 0xda, 0xef, 0x46, 0x42, 0x11, 0xf6, 0x88,
+    0xe1, 0xf7, 0x4c, 0xd4, 0x31, 0x82, 0xb9, 0xdf, 0xf2, 0xdf, 0xda, 0xb7, 0xbf, 0x67, 0xfd, 0xa6,
+    0x3b, 0x52, 0xb5, 0x37, 0x06, 0xcb, 0x68, 0x80, 0xa6, 0x9a, 0x01, 0x1c, 0xd0, 0xe8, 0x94, 0x4e,
+    0x4f, 0xa7, 0x9f, 0x04, 0x8f, 0x58, 0x0a, 0xd1, 0x7f, 0xa8, 0x44, 0x98, 0x3a, 0x1e, 0xd2, 0x1f,
+    0x28, 0x65, 0xc3, 0xfa, 0x31, 0x15, 0x06, 0x87, 0x03, 0xa0, 0x09, 0x05, 0xa6, 0xf1, 0xb3, 0x43,
+    0x18, 0xd0, 0x30, 0x34, 0xb3, 0xc8, 0x2b, 0xce, 0x52, 0xd0, 0xc8, 0x65, 0x3f, 0x07, 0x46, 0x16,
+    0x3e, 0xb5, 0x1a, 0xcd, 0x36, 0x43, 0x12, 0x53, 0xa9, 0x58, 0x28, 0x07, 0x21, 0x15, 0x2b, 0x99,
+    0x15, 0x25, 0xd5, 0x7a, 0xc1, 0x71, 0x14, 0x35, 0x6e, 0xe9, 0x86, 0x1e, 0x4c, 0x97, 0x28, 0x7a,
+    0x0e, 0x9b, 0xae, 0xa9, 0x32, 0xc4, 0x4f, 0x44, 0xc0, 0xfe, 0x87, 0x29, 0x43, 0x1c, 0xa4, 0xe0,
+    0x55, 0x41, 0x2f, 0xe1, 0xd0, 0xd1,
+};
+const uint8_t ka_rom4_pages[]= {
+    0x00, 0x20, 0x00, 0x3d, 0x01, 0x00, 0x6b, 0x02, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+    0x00, 0x24, 0x01, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x5b, 0x80, 0x80, 0x8d, 0x01, 0x10, 0x02,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x42, 0x00, 0x00, 0x0f, 0x43, 0x83, 0x53, 0x4b, 0xbf, 0x9d,
+    0xe8, 0x52, 0xa1, 0x1a, 0x5a, 0x0a, 0xe4, 0x77, 0x41, 0xf2, 0xf7, 0x00, 0xc1, 0x00, 0x00, 0x72,
+    0x00, 0x60, 0x35, 0x47, 0x00, 0x27, 0x0e, 0x2e, 0xc1, 0x5c, 0x14, 0x95, 0x4b, 0xf6, 0x43, 0xc2,
+    0x4c, 0x34, 0x34, 0x9e, 0xc8, 0x99, 0xd0, 0x0f, 0x5c, 0x4b, 0x0b, 0x2d, 0xc5, 0x7b, 0x88, 0x2d,
+    0xdc, 0x15, 0xee, 0x15, 0xee, 0x3e, 0x71, 0x6f, 0xe2, 0xff, 0xff, 0x00, 0x81, 0x00, 0x00, 0x00,
+    0x00, 0xa1, 0x19, 0x01, 0xa0, 0x86, 0x06, 0x71, 0xbb, 0x00, 0x27, 0xfd, 0x4a, 0xf7, 0xfb, 0x4f,
+    0xe9, 0xfc, 0xfd, 0x69, 0xce, 0x37, 0xcb, 0x59, 0x58, 0x4e, 0xdc, 0xc3, 0xbc, 0xd6, 0x90, 0x4d,
+    0xe3, 0x52, 0xf0, 0x77, 0xd3, 0xde, 0xed, 0x98, 0x5b, 0x67, 0xdb, 0xf7, 0x07, 0xbe, 0xfc, 0x0b,
+    0x1b, 0xdb, 0xe6, 0x27, 0xe0, 0x1e, 0x51, 0xfb, 0xcd, 0x79, 0xba, 0x43, 0x90, 0xdb, 0x1d, 0x3f,
+    0x97, 0xbc, 0x8d, 0x1d, 0xcb, 0x27, 0xbd, 0x94, 0xe8, 0x37, 0x7d, 0xe6, 0xa5, 0xc1, 0x82, 0x26,
+    0xda, 0x21, 0xa7, 0x19, 0xbc, 0x4c, 0x9b, 0xb3, 0xd4, 0x1c, 0x1d, 0x9f, 0x44, 0x9f, 0x50, 0x3d,
+    0xd1, 0xbf, 0x53, 0x20, 0xc4, 0x9c, 0x0c, 0xe5, 0xff, 0x94, 0x31, 0x61, 0xf9, 0x88, 0x4a, 0x9d,
+    0xbf, 0x03, 0xad, 0x30, 0xb1, 0x8b, 0x4b, 0x1d, 0x31, 0x98, 0x5e, 0x18, 0x62, 0x51, 0xc8, 0x94,
+    0x65, 0xa2, 0x55, 0x98, 0x30, 0x60, 0xf2, 0xd2, 0xe6, 0xd4, 0xc4, 0xc9, 0xa7, 0x68, 0xa8, 0xc6,
+    0x64, 0x56, 0x52, 0x54, 0x45, 0x30, 0x1c, 0x86, 0x54, 0x36, 0x44, 0x79, 0x50, 0x4e, 0xad, 0xe9,
+    0x9c, 0xa7, 0x8c, 0xb8, 0x55, 0x35, 0x6a, 0x30, 0x5d, 0x0c, 0xfa, 0x3f, 0x9b, 0x57, 0x54, 0x7c,
+    0x5a, 0x93, 0x92, 0x60, 0xaf, 0xc3, 0x06, 0xa1, 0xa2, 0x52, 0xec, 0xa3, 0x50, 0x2f, 0xd1, 0xd5,
+    0xa9, 0x50, 0x67, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x10, 0x00, 0x00,
+    0x00, 0x00, 0x10, 0x00, 0x00, 0x1e, 0x01, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x5b, 0x80, 0x80,
+    0x8d, 0x01, 0x10, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x30, 0x01, 0x00, 0x00, 0x0e, 0x44, 0x4e,
+    0x59, 0x75, 0xdb, 0xea, 0x47, 0x86, 0x35, 0x55, 0x98, 0x8f, 0xb2, 0xff, 0xff, 0x08, 0xd7, 0x00,
+    0x00, 0x00, 0x00, 0x22, 0x12, 0x02, 0x80, 0x5c, 0x28, 0x42, 0x2f, 0x59, 0x44, 0xb9, 0xca, 0x29,
+    0x54, 0x30, 0x9b, 0x86, 0x46, 0x8c, 0x4a, 0x55, 0x90, 0x32, 0x71, 0x69, 0x14, 0x6f, 0x46, 0x7d,
+    0x0b, 0xdd, 0xc2, 0x6f, 0xe2, 0xb8, 0x0a, 0xc4, 0x9b, 0xff, 0xcf, 0x10, 0xf8, 0x00, 0x00, 0x00,
+    0x00, 0x29, 0x02, 0x80, 0x29, 0x23, 0x10, 0xa8, 0x8f, 0x01, 0x3c, 0xbf, 0xde, 0xfd, 0x7e, 0xa6,
+    0xf8, 0x56, 0xc1, 0x26, 0xa6, 0xb9, 0x9d, 0xcb, 0x5a, 0x53, 0x8d, 0xa1, 0xa5, 0xd7, 0x61, 0xf5,
+    0xb5, 0x11, 0x25, 0xcb, 0xe3, 0xef, 0x13, 0x6e, 0xfd, 0x58, 0x0b, 0xbd, 0xeb, 0xbb, 0x79, 0x6f,
+    0x7c, 0x7f, 0xe6, 0xf0, 0x0b, 0x71, 0x39, 0x3b, 0xa2, 0x76, 0xfb, 0xdd, 0xaf, 0x1e, 0xed, 0x21,
+    0x48, 0x1f, 0xcf, 0x28, 0x61, 0x6d, 0x30, 0x42, 0x53, 0x39, 0xf8, 0x32, 0xf8, 0x85, 0x78, 0x8a,
+    0x7e, 0xf4, 0x2a, 0xb0, 0xff, 0x1a, 0xda, 0x17, 0x9d, 0x32, 0xf5, 0x16, 0x15, 0xc9, 0x76, 0xb3,
+    0xe3, 0x5a, 0x43, 0x60, 0x48, 0xcf, 0x43, 0x29, 0x69, 0xea, 0xed, 0x08, 0x86, 0xd4, 0x30, 0xf4,
+    0x50, 0xd0, 0x09, 0x99, 0x74, 0xa0, 0x32, 0xf8, 0xe6, 0x52, 0xa5, 0xe9, 0xa7, 0x21, 0xa2, 0x24,
+    0x97, 0xbd, 0xc4, 0xb8, 0x8a, 0x90, 0x39, 0x37, 0x55, 0x53, 0x70, 0xc9, 0x42, 0xd4, 0x09, 0x71,
+    0xfc, 0xd6, 0xb4, 0x5c, 0x48, 0x68, 0xb8, 0xe6, 0x35, 0xf8, 0x98, 0x9b, 0x64, 0x53, 0x47, 0x72,
+    0xd7, 0x92, 0x8c, 0xe6, 0x99, 0xb3, 0x48, 0xc7, 0x61, 0x5d, 0x10, 0x48, 0x0a, 0xf0, 0xac, 0xfa,
+    0x97, 0xf3, 0x75, 0xe6, 0xa7, 0xa9, 0x18, 0x41, 0x64, 0x73, 0x40, 0xa5, 0x40, 0x72, 0x0e, 0x3d,
+    0xf4, 0x82, 0x40, 0x20, 0x08, 0x08, 0x82, 0x82, 0x20, 0x00, 0x08,
+};
@@ -0,0 +1,169 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include "freerunmap.h"
+#include "tstutil.h"
+
+// unit test for freerunmap, compared against a plain vector<bool>.
+
+// the straightforward implementation of the freerunmap queries
+struct freemodel {
+    std::vector<bool> free;
+    uint32_t blocksize;
+
+    explicit freemodel(uint32_t blocksize) : blocksize(blocksize) { }
+
+    void resize(uint32_t newsize)
+    {
+        if (newsize>free.size())
+            free.resize(newsize, true);
+    }
+    void mark(uint32_t ix, uint32_t n, bool isfree)
+    {
+        if (n==0)
+            return;
+        resize(ix+n);
+        for (uint32_t i=ix ; i<ix+n ; i++)
+            free[i]= isfree;
+    }
+    uint32_t freeatend() const
+    {
+        uint32_t n= 0;
+        for (size_t i=free.size() ; i>0 && free[i-1] ; i--)
+            n++;
+        return n;
+    }
+    int64_t findrun(uint32_t n) const
+    {
+        if (n==0)
+            return -1;
+        uint32_t run= 0;
+        for (uint32_t i=0 ; i<free.size() ; i++) {
+            run= free[i] ? run+1 : 0;
+            if (run==n)
+                return i+1-n;
+        }
+        return -1;
+    }
+    // only whole blocks within the map count
+    int64_t findblock() const
+    {
+        for (uint32_t blk=0 ; (blk+1)*blocksize<=free.size() ; blk++) {
+            bool allfree= true;
+            for (uint32_t i=blk*blocksize ; i<(blk+1)*blocksize ; i++)
+                allfree= allfree && free[i];
+            if (allfree)
+                return blk;
+        }
+        return -1;
+    }
+};
+
+bool samestate(const freerunmap& m, const freemodel& ref)
+{
+    if (m.size()!=ref.free.size())
+        return false;
+    for (uint32_t i=0 ; i<ref.free.size()+4 ; i++)
+        if (m.isfree(i) != (i<ref.free.size() && ref.free[i]))
+            return false;
+    return true;
+}
+
+void tstempty()
+{
+    freerunmap m;
+    CHECK(m.size()==0);
+    CHECK(m.freeatend()==0);
+    CHECK(m.findrun(1)==-1);
+    CHECK(m.findrun(0)==-1);
+    CHECK(m.findblock()==-1);
+    CHECK(!m.isfree(0));
+
+    m.resize(10);
+    CHECK(m.freeatend()==10);
+    CHECK(m.findrun(10)==0);
+    CHECK(m.findrun(11)==-1);
+    m.mark(3, 2, false);
+    CHECK(m.findrun(3)==0);
+    CHECK(m.findrun(4)==5);
+    CHECK(m.freeatend()==5);
+    m.mark(9, 1, false);
+    CHECK(m.freeatend()==0);
+}
+
+void tstrandom()
+{
+    srand(1234);
+    for (int round=0 ; round<200 ; round++) {
+        uint32_t blocksize= 1<<(rand()%5);
+        freerunmap m(blocksize);
+        freemodel ref(blocksize);
+
+        // mostly small maps, so runs and blocks are found often,
+        // some large ones to exercise the deeper trees.
+        uint32_t space= round%10==0 ? 5000 : 1+rand()%200;
+
+        for (int step=0 ; step<300 ; step++) {
+            switch(rand()%8) {
+            case 0: {
+                uint32_t n= rand()%space;
+                m.resize(n);
+                ref.resize(n);
+                break;
+            }
+            case 1: {
+                // allocate the lowest fitting run, like the allocators do
+                uint32_t n= 1+rand()%16;
+                int64_t ix= m.findrun(n);
+                CHECK(ix==ref.findrun(n));
+                if (ix>=0) {
+                    m.mark(uint32_t(ix), n, false);
+                    ref.mark(uint32_t(ix), n, false);
+                }
+                break;
+            }
+            case 2: {
+                uint32_t n= 1+rand()%space;
+                CHECK(m.findrun(n)==ref.findrun(n));
+                break;
+            }
+            case 3:
+                CHECK(m.findblock()==ref.findblock());
+                break;
+            case 4:
+                CHECK(m.freeatend()==ref.freeatend());
+                break;
+            case 5:
+                if (rand()%20==0) {
+                    blocksize= 1<<(rand()%5);
+                    m.setblocksize(blocksize);
+                    ref.blocksize= blocksize;
+                }
+                break;
+            default: {
+                // mark a range, possibly extending the map
+                uint32_t ix= rand()%space;
+                uint32_t n= rand()%24;
+                bool isfree= rand()%3==0;
+                m.mark(ix, n, isfree);
+                ref.mark(ix, n, isfree);
+                break;
+            }
+            }
+        }
+        CHECK(samestate(m, ref));
+        CHECK(m.freeatend()==ref.freeatend());
+        CHECK(m.findblock()==ref.findblock());
+        for (uint32_t n=1 ; n<40 ; n++)
+            CHECK(m.findrun(n)==ref.findrun(n));
+    }
+}
+
+int main()
+{
+    tstempty();
+    tstrandom();
+
+    return testresult("freerunmap");
+}
@@ -0,0 +1,18 @@
+#pragma once
+#include <stdio.h>
+
+// shared by the unit tests: CHECK reports and counts failures,
+// main returns testresult("name") as its exit code.
+
+static int g_failures= 0;
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: FAILED: %s\n", __FILE__, __LINE__, #cond); g_failures++; } } while(0)
+
+static int testresult(const char *name)
+{
+    if (g_failures) {
+        printf("%s: %d failures\n", name, g_failures);
+        return 1;
+    }
+    printf("%s: all tests passed\n", name);
+    return 0;
+}